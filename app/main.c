@@ -17,6 +17,13 @@
 #include "sync_timestamp.h"
 #ifdef MODULE_MQTTSN_PUBLISHER
 #include "mqttsn_publisher.h"
+#include "report.h"
+#ifdef MEM_STATS
+#include "mem_stats.h"
+#endif /* MEM_STATS */
+#ifdef MQPUB_TRACE
+#include "mqpub_trace.h"
+#endif /* MQPUB_TRACE */
 #endif
 
 #if 0
@@ -65,6 +72,15 @@ static const shell_command_t shell_commands[] = {
 #endif /* MODULE_SIM7020 */
 #ifdef MODULE_MQTTSN_PUBLISHER
     { "mqstat", "print MQTT status", mqttsn_stats_cmd},
+#ifdef REPORT_BENCH
+    { "repbench", "benchmark report formatting", report_bench_cmd},
+#endif /* REPORT_BENCH */
+#ifdef MEM_STATS
+    { "memstat", "print stack and buffer memory use", mem_stats_cmd},
+#endif /* MEM_STATS */
+#ifdef MQPUB_TRACE
+    { "mqtrace", "print MQTT event trace [clear|pub]", mqpub_trace_cmd},
+#endif /* MQPUB_TRACE */
 #endif /* MODULE_MQTTSN_PUBLISHER */
     { NULL, NULL, NULL }
 };
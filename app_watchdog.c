@@ -14,6 +14,9 @@
 
 #include "xtimer.h"
 #include "timex.h"
+#ifdef MQPUB_TICKLESS
+#include "ztimer.h"
+#endif /* MQPUB_TICKLESS */
 
 #ifdef MODULE_SIM7020
 #include "net/af.h"
@@ -35,8 +38,13 @@
 #endif
 #include "report.h"
 #include "sync_timestamp.h"
+#include "mqttsn_publisher.h"
 
 #include "app_watchdog.h"
+#ifdef MQPUB_TICKLESS
+#include "mqpub_events.h"
+#endif /* MQPUB_TICKLESS */
+#include "mqpub_trace.h"
 
 static uint16_t consec_fails;
 static uint32_t last_recovery;
@@ -55,9 +63,10 @@ static perm_awd_stats_t perm_awd_stats;
 static EEMEM perm_awd_stats_t ee_perm_awd_stats;
 static EEMEM uint32_t ee_hash;
 
+#define APPWD_UPDATE_INTERVAL_SEC (5*SEC_PER_MIN)
+
 #ifdef APP_WATCHDOG_THREAD
 #define APPWD_THREAD_PERIOD_SEC 2
-#define APPWD_UPDATE_INTERVAL_SEC (5*SEC_PER_MIN)
 #define APPWD_PRIO  (THREAD_PRIORITY_MIN - \
                      (SCHED_PRIO_LEVELS - 1))
 #define APPWD_STACK THREAD_STACKSIZE_SMALL
@@ -72,6 +81,36 @@ static void *appwd_thread(void *arg);
 #define WDT_PERIOD_MSEC 1000
 #endif
 
+#ifdef MQPUB_TICKLESS
+static void appwd_handler(mqpub_event_t *ev);
+static mqpub_event_t appwd_ev = MQPUB_EVENT_INIT(appwd_handler);
+#ifdef WDT_WATCHDOG
+/*
+ * The hardware watchdog cannot wait longer than WDT_MAX_MSEC. Kick it
+ * from a timer at half that, instead of from a thread every 2 secs --
+ * but only while the event loop shows signs of life. A handler beats
+ * after each network operation, and the kicks stop when there has been
+ * no beat for APP_WATCHDOG_BUSY_MAX_SEC.
+ */
+#define WDT_KICK_MSEC (WDT_MAX_MSEC/2)
+static ztimer_t wdt_timer;
+
+static void wdt_kick_cb(void *arg) {
+    static uint32_t busy_msec;
+
+    (void) arg;
+    mqpub_events_timer_wakeup();
+    if (mqpub_events_alive())
+        busy_msec = 0;
+    else if (busy_msec < APP_WATCHDOG_BUSY_MAX_SEC * MS_PER_SEC)
+        busy_msec += WDT_KICK_MSEC;
+    if (busy_msec < APP_WATCHDOG_BUSY_MAX_SEC * MS_PER_SEC)
+        wdt_kick();
+    ztimer_set(ZTIMER_MSEC, &wdt_timer, WDT_KICK_MSEC);
+}
+#endif /* WDT_WATCHDOG */
+#endif /* MQPUB_TICKLESS */
+
 /*
  * Read DNS cache from EEPROM. Use a hash in EEPROM to verify that the info in the
  * EEPROM is valid. Read info, compute hash, and compare with
@@ -117,6 +156,16 @@ void app_watchdog_init(void) {
     wdt_setup_reboot(0, WDT_MAX_MSEC);
     wdt_start();
 #endif /* WDT_WATCHDOG */
+#ifdef MQPUB_TICKLESS
+    mqpub_event_in(&appwd_ev, APPWD_UPDATE_INTERVAL_SEC * MS_PER_SEC);
+#ifdef WDT_WATCHDOG
+    wdt_timer.callback = wdt_kick_cb;
+    ztimer_set(ZTIMER_MSEC, &wdt_timer, WDT_KICK_MSEC);
+#endif /* WDT_WATCHDOG */
+#endif /* MQPUB_TICKLESS */
+    static report_sched_t appwd_sched;
+    report_register(&appwd_sched, app_watchdog_report, "appwd",
+                    MQTTSN_PUBLISH_INTERVAL, 3*MQTTSN_PUBLISH_INTERVAL, 3);
 }
 
 /*
@@ -178,6 +227,11 @@ static void awd_recovery(void) {
 }
 
 void app_watchdog_update(int progress) {
+    MQPUB_TRACE_EV(MQPUB_TR_WATCHDOG, progress);
+#ifdef MQPUB_TICKLESS
+    /* An operation is done, with or without progress -- not stuck */
+    mqpub_events_heartbeat();
+#endif /* MQPUB_TICKLESS */
     if (progress) 
         consec_fails = 0;
     else {
@@ -210,6 +264,18 @@ static void *appwd_thread(__attribute__((unused)) void *arg)
     return NULL;
 }
 #endif /* APPWD_THREAD */
+
+#ifdef MQPUB_TICKLESS
+/*
+ * No progress reported for an update interval counts as a failure
+ */
+static void appwd_handler(mqpub_event_t *ev) {
+    if (consec_fails > 0)
+        printf("APPWD: %d fails\n", consec_fails+1);
+    app_watchdog_update(0);
+    mqpub_event_in(ev, APPWD_UPDATE_INTERVAL_SEC * MS_PER_SEC);
+}
+#endif /* MQPUB_TICKLESS */
  
 int app_watchdog_report(uint8_t *buf, size_t len, uint8_t *finished, 
                         __attribute__((unused)) char **topicp, __attribute__((unused)) char **basenamep) {
@@ -219,14 +285,17 @@ int app_watchdog_report(uint8_t *buf, size_t len, uint8_t *finished,
      
      *finished = 0;
      RECORD_START(s + nread, l - nread);
-     PUTFMT(",{\"n\":\"appwd;stats;\",\"vj\":[");
-     PUTFMT("{\"n\":\"noprogress\",\"u\":\"count\",\"v\":%" PRIu32 "},", awd_stats.noprogress);
-     PUTFMT("{\"n\":\"recovery\",\"u\":\"count\",\"v\":%" PRIu32 "},", awd_stats.recovery);
-     PUTFMT("{\"n\":\"restarts\",\"u\":\"count\",\"v\":%" PRIu32 "},", perm_awd_stats.restarts);
+     PUTGROUP("appwd;stats;");
+     PUTCOUNT("noprogress", awd_stats.noprogress);
+     PUTCOUNT("recovery", awd_stats.recovery);
+     PUTCOUNT("restarts", perm_awd_stats.restarts);
      uint32_t utime_sec = perm_awd_stats.last_timestamp/US_PER_SEC;
      uint32_t utime_msec = (perm_awd_stats.last_timestamp/MS_PER_SEC) % MS_PER_SEC;
-     PUTFMT("{\"n\":\"restart_time\",\"v\":%" PRIu32 ".%03" PRIu32 "}", utime_sec, utime_msec);
-     PUTFMT("]}");
+     PUTNAME("restart_time");
+     PUTKEY(SENML_V);
+     PUTSEC(utime_sec, utime_msec);
+     PUTCLOSE();
+     PUTGROUPEND();
      RECORD_END(nread);
      *finished = 1;
 
@@ -16,8 +16,24 @@
 #define APP_WATCHDOG_MAX_RECOVERIES 5 //9
 #endif /* APP_WATCHDOG_MAX_RECOVERIES */
 
+/* Max time the tickless event loop may go without a heartbeat before
+ * the hardware watchdog is no longer kicked. A handler beats after
+ * each network operation (app_watchdog_update()), and the longest is
+ * one message with all its retries -- twice that, for margin.
+ */
+#ifndef APP_WATCHDOG_BUSY_MAX_SEC
+#include "net/emcute.h"
+#if defined(CONFIG_EMCUTE_T_RETRY)
+#define APP_WATCHDOG_BUSY_MAX_SEC (2 * (CONFIG_EMCUTE_N_RETRY + 1) * CONFIG_EMCUTE_T_RETRY)
+#else
+#define APP_WATCHDOG_BUSY_MAX_SEC (2 * (EMCUTE_N_RETRY + 1) * EMCUTE_T_RETRY)
+#endif /* defined(CONFIG_EMCUTE_T_RETRY) */
+#endif /* APP_WATCHDOG_BUSY_MAX_SEC */
+
 /* Define to have a separate thread to trigger watchdog check */
+#ifndef MQPUB_TICKLESS
 #define APP_WATCHDOG_THREAD
+#endif /* MQPUB_TICKLESS */
 
 void app_watchdog_init(void);
 void app_watchdog_update(int progress);
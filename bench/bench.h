@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Rounds of each publish cycle, for timing */
+#ifndef BENCH_ROUNDS
+#define BENCH_ROUNDS 50
+#endif /* BENCH_ROUNDS */
+
+/* Stack of the thread that runs the generators */
+#ifndef BENCH_STACKSIZE
+#define BENCH_STACKSIZE (THREAD_STACKSIZE_DEFAULT)
+#endif /* BENCH_STACKSIZE */
+
+/*
+ * Fill statistics sources with fixed values
+ */
+void bench_stubs_init(void);
+
+#endif /* BENCH_H */
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# Compare report pipeline benchmark results with a baseline.
+# Usage: compare.py <baseline file> [<results file>]
+# Results are read from stdin if no results file is given.
+
+import sys
+
+def readresults(f):
+        results = {}
+        header = None
+        for line in f:
+                fields = line.split()
+                if line.startswith('# report '):
+                        header = fields[3:]
+                        continue
+                if len(fields) < 3 or line.startswith('#'):
+                        continue
+                try:
+                        values = [int(v) for v in fields[2:]]
+                except ValueError:
+                        # Not a result line -- RIOT start-up output
+                        continue
+                results[(fields[0], fields[1])] = values
+        return header, results
+
+if len(sys.argv) < 2:
+        sys.stderr.write('Usage: compare.py <baseline> [<results>]\n')
+        sys.exit(1)
+
+with open(sys.argv[1]) as f:
+        header, baseline = readresults(f)
+if len(sys.argv) > 2:
+        with open(sys.argv[2]) as f:
+                _, results = readresults(f)
+else:
+        _, results = readresults(sys.stdin)
+
+if header is None:
+        header = ["rec/cyc", "pkt/cyc", "B/pkt", "ns/rec", "stack"]
+
+print(f"{'report':10} {'enc':5} " + " ".join(f"{h:>16}" for h in header))
+for key, values in results.items():
+        base = baseline.get(key)
+        cols = []
+        for i, v in enumerate(values):
+                if base is None:
+                        cols.append(f"{v:>8} {'new':>7}")
+                elif base[i] == 0:
+                        cols.append(f"{v:>8} {'':>7}" if v == 0 else f"{v:>8} {'+inf':>7}")
+                else:
+                        cols.append(f"{v:>8} {100.0 * (v - base[i]) / base[i]:>+6.1f}%")
+        print(f"{key[0]:10} {key[1]:5} " + " ".join(cols))
+for key in baseline:
+        if key not in results:
+                print(f"{key[0]:10} {key[1]:5} missing")
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Benchmark for the report pipeline, on the native board. Each
+ * report generator is run alone through makereport(), in the same
+ * way as a publish cycle in the publisher, with the statistics
+ * sources filled with fixed values (stubs.c). Then all generators
+ * together. For each generator and encoding, the result is records
+ * and packets per cycle, bytes per packet, time per record and peak
+ * stack use.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "msg.h"
+#include "thread.h"
+#include "xtimer.h"
+#include "periph/pm.h"
+
+#include "mqttsn_publisher.h"
+#include "report.h"
+#include "report_schema.h"
+#include "bench.h"
+
+int boot_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
+int rpl_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
+int sim7020_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
+int if_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
+
+#define REPORT_SCHEMA_MQTTSN_STATS
+#define REPORT_SCHEMA_SET mqttsn_stats_schema
+#define REPORT_SCHEMA_TYPE mqttsn_stats_t
+#include "report_schema_gen.h"
+#undef REPORT_SCHEMA_MQTTSN_STATS
+
+/*
+ * The counters of mqttsn_report() -- the rest of it needs emcute
+ */
+static int mqttsn_stats_report(uint8_t *buf, size_t len, uint8_t *finished,
+                               char **topicp, char **basenamep) {
+    static uint8_t schema_state;
+    REPORT_DELTA_SLOTS(delta, REPORT_SCHEMA_LEN(mqttsn_stats_schema));
+
+    (void) topicp;
+    (void) basenamep;
+    return report_schema_gen(mqttsn_stats_schema, REPORT_SCHEMA_LEN(mqttsn_stats_schema), &mqttsn_stats,
+                             REPORT_DELTA_ARG(delta), &schema_state, (char *) buf, len, finished);
+}
+
+static struct {
+    const char *name;
+    report_gen_t gen;
+    report_sched_t sched;
+} gens[] = {
+    { .name = "boot", .gen = boot_report },
+    { .name = "rpl", .gen = rpl_report },
+    { .name = "sim7020", .gen = sim7020_report },
+    { .name = "if", .gen = if_report },
+    { .name = "mqtt_sn", .gen = mqttsn_stats_report },
+};
+#define NGENS (sizeof(gens)/sizeof(gens[0]))
+/* Index for all generators together */
+#define ALL NGENS
+
+static char json_topic[] = MQTT_TOPIC_BASE "/bench/sensors";
+static char cbor_topic[] = MQTT_TOPIC_BASE "/bench/sensors/cbor";
+static char basename[MQPUB_BASENAME_LENGTH];
+
+typedef struct {
+    uint32_t records;
+    uint32_t packets;
+    uint32_t bytes;
+    uint32_t usec;
+    unsigned stack;
+} result_t;
+
+static result_t result;
+static char *topic;
+static char worker_stack[BENCH_STACKSIZE];
+static kernel_pid_t main_pid;
+
+/*
+ * Make generator due, or all of them
+ */
+static void select_gen(unsigned g) {
+    unsigned i;
+
+    for (i = 0; i < NGENS; i++)
+        if (i == g || g == ALL)
+            /* Never run -- due at once */
+            gens[i].sched.flags = 0;
+}
+
+/*
+ * One publish cycle, with full snapshot records
+ */
+static void run_cycle(result_t *r) {
+    static uint8_t buf[MQTTSN_BUFFER_SIZE];
+    static report_commit_t commit;
+    uint8_t finished;
+
+    report_delta_snapshot();
+    report_delta_cycle();
+    report_commit_init(&commit);
+    do {
+        char *t = topic, *b = basename;
+        size_t n = makereport(buf, sizeof(buf), &finished, &t, &b);
+
+        report_commit(&commit, 1);
+        if (n > 0) {
+            r->packets++;
+            r->bytes += n;
+        }
+    } while (!finished);
+}
+
+static void *worker(void *arg) {
+    unsigned g = (unsigned) (uintptr_t) arg;
+    uint32_t records = report_stats.records;
+    unsigned i;
+    msg_t msg;
+
+    memset(&result, 0, sizeof(result));
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        uint32_t start;
+
+        select_gen(g);
+        start = xtimer_now_usec();
+        run_cycle(&result);
+        result.usec += xtimer_now_usec() - start;
+    }
+    result.records = report_stats.records - records;
+    msg_send(&msg, main_pid);
+    return NULL;
+}
+
+/*
+ * Run generator in a fresh thread, to measure its stack use
+ */
+static void bench_gen(unsigned g) {
+    msg_t msg;
+
+    thread_create(worker_stack, sizeof(worker_stack), THREAD_PRIORITY_MAIN - 1,
+                  THREAD_CREATE_STACKTEST, worker, (void *) (uintptr_t) g, "bench");
+    msg_receive(&msg);
+    result.stack = sizeof(worker_stack) - thread_measure_stack_free(worker_stack);
+}
+
+static void print_result(const char *name, const char *enc, const result_t *r) {
+    printf("%-10s %-5s %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8u\n",
+           name, enc, r->records / BENCH_ROUNDS, r->packets / BENCH_ROUNDS,
+           r->packets ? r->bytes / r->packets : 0,
+           r->records ? (uint32_t) ((uint64_t) r->usec * 1000 / r->records) : 0,
+           r->stack);
+}
+
+int main(void) {
+    static const struct {
+        const char *name;
+        char *topic;
+    } encs[] = {
+        { "json", json_topic },
+        { "cbor", cbor_topic },
+    };
+    unsigned e, g;
+
+    main_pid = thread_getpid();
+    bench_stubs_init();
+    snprintf(basename, sizeof(basename), MQPUB_BASENAME_FMT, "fcc23d000000857b");
+    report_set_topic_enc(cbor_topic, REPORT_ENC_CBOR);
+    for (g = 0; g < NGENS; g++)
+        report_register(&gens[g].sched, gens[g].gen, gens[g].name, REPORT_PERIOD_ONCE, 0, g);
+
+    printf("# report pipeline: %s, buffer %u bytes, %u rounds\n",
+           RIOT_BOARD, (unsigned) MQTTSN_BUFFER_SIZE, BENCH_ROUNDS);
+    printf("# %-8s %-5s %8s %8s %8s %8s %8s\n",
+           "report", "enc", "rec/cyc", "pkt/cyc", "B/pkt", "ns/rec", "stack");
+    for (e = 0; e < sizeof(encs)/sizeof(encs[0]); e++) {
+        topic = encs[e].topic;
+        /* Warm up */
+        bench_gen(ALL);
+        for (g = 0; g <= ALL; g++) {
+            bench_gen(g);
+            print_result(g == ALL ? "all" : gens[g].name, encs[e].name, &result);
+        }
+    }
+    pm_off();
+    return 0;
+}
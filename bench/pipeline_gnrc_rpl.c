@@ -0,0 +1,10 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/* Module source, built into the benchmark without the rest of the module */
+#include "../gnrc_rpl.c"
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Statistics sources for the report generators, filled with fixed
+ * values, so that every run formats the same records: an RPL
+ * instance with two parents and RPL message counters, SIM7020
+ * counters and identities, one network interface with layer 2
+ * counters, and MQTT-SN counters.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "net/netif.h"
+#include "net/netopt.h"
+#include "net/netstats.h"
+#include "net/gnrc/rpl.h"
+#include "net/gnrc/rpl/structs.h"
+#include "net/sim7020.h"
+
+#include "mqttsn_publisher.h"
+#include "bench.h"
+
+/* Spread over small and large values */
+#define VAL(N) ((uint32_t) ((N) + 1) * 7919UL << (2 * ((N) % 8)))
+
+/*
+ * RPL
+ */
+gnrc_rpl_instance_t gnrc_rpl_instances[GNRC_RPL_INSTANCES_NUMOF];
+netstats_rpl_t gnrc_rpl_netstats;
+
+static gnrc_rpl_of_t bench_of;
+static gnrc_rpl_parent_t bench_parents[2];
+
+static void rpl_init(void) {
+    gnrc_rpl_instance_t *inst = &gnrc_rpl_instances[0];
+    gnrc_rpl_dodag_t *dodag = &inst->dodag;
+    uint32_t *c = (uint32_t *) &gnrc_rpl_netstats;
+    unsigned i;
+
+    bench_of.ocp = 1;
+    inst->state = 1;
+    inst->id = 0;
+    inst->mop = GNRC_RPL_MOP_STORING_MODE_NO_MC;
+    inst->of = &bench_of;
+    ipv6_addr_from_str(&dodag->dodag_id, "fd95:9bba:768f:0:216:3eff:fec6:99db");
+    dodag->instance = inst;
+    dodag->my_rank = 512;
+    dodag->version = 240;
+    dodag->prf = 0;
+    dodag->grounded = 1;
+    dodag->node_status = GNRC_RPL_NORMAL_NODE;
+    for (i = 0; i < 2; i++) {
+        gnrc_rpl_parent_t *parent = &bench_parents[i];
+
+        ipv6_addr_from_str(&parent->addr, i == 0 ? "fe80::216:3eff:fe00:8571" : "fe80::216:3eff:fe00:8572");
+        parent->rank = 256 + 128 * i;
+        parent->dodag = dodag;
+        parent->next = i == 0 ? &bench_parents[1] : NULL;
+    }
+    dodag->parents = &bench_parents[0];
+    for (i = 0; i < sizeof(gnrc_rpl_netstats)/sizeof(uint32_t); i++)
+        c[i] = VAL(i);
+}
+
+/*
+ * SIM7020
+ */
+static sim7020_netstats_t sim7020_netstats;
+uint32_t sim7020_activation_usecs = 5312000;
+uint64_t sim7020_prev_active_duration_usecs = 86400000000ULL;
+
+sim7020_netstats_t *sim7020_get_netstats(void) {
+    return &sim7020_netstats;
+}
+
+int sim7020_active(void) {
+    return 1;
+}
+
+int sim7020_imsi(char *buf, int len) {
+    return snprintf(buf, len, "240075810012345");
+}
+
+int sim7020_imei(char *buf, int len) {
+    return snprintf(buf, len, "869951031234567");
+}
+
+static void sim7020_init(void) {
+    uint32_t *c = (uint32_t *) &sim7020_netstats;
+    unsigned i;
+
+    for (i = 0; i < sizeof(sim7020_netstats)/sizeof(uint32_t); i++)
+        c[i] = VAL(i + 3);
+}
+
+/*
+ * Network interface
+ */
+static netif_t bench_netif;
+static netstats_t bench_netstats;
+
+netif_t *netif_iter(netif_t *last) {
+    return last == NULL ? &bench_netif : NULL;
+}
+
+int netif_get_name(netif_t *netif, char *name) {
+    (void) netif;
+    strcpy(name, "7");
+    return 1;
+}
+
+int netif_get_opt(netif_t *netif, netopt_t opt, uint16_t context, void *value, size_t max_len) {
+    (void) netif;
+    (void) context;
+    switch (opt) {
+    case NETOPT_STATS:
+        *(netstats_t **) value = &bench_netstats;
+        return sizeof(netstats_t *);
+    case NETOPT_CHANNEL:
+        *(uint16_t *) value = 26;
+        return sizeof(uint16_t);
+    case NETOPT_RSSI:
+        *(int8_t *) value = -71;
+        return sizeof(int8_t);
+    default:
+        (void) max_len;
+        return -ENOTSUP;
+    }
+}
+
+static void netif_init(void) {
+    bench_netstats.rx_bytes = VAL(5);
+    bench_netstats.rx_count = VAL(4);
+    bench_netstats.tx_unicast_count = VAL(3);
+    bench_netstats.tx_mcast_count = VAL(2);
+}
+
+/*
+ * MQTT-SN
+ */
+mqttsn_stats_t mqttsn_stats;
+
+static void mqttsn_init(void) {
+    uint32_t *c = (uint32_t *) &mqttsn_stats;
+    unsigned i;
+
+    for (i = 0; i < sizeof(mqttsn_stats)/sizeof(uint32_t); i++)
+        c[i] = VAL(i);
+}
+
+/*
+ * Platform
+ */
+uint8_t soft_rst;
+
+void bench_stubs_init(void) {
+    rpl_init();
+    sim7020_init();
+    netif_init();
+    mqttsn_init();
+}
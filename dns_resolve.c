@@ -16,6 +16,10 @@
 #ifdef APP_WATCHDOG
 #include "app_watchdog.h"
 #endif /* APP_WATCHDOG */
+#ifdef MQPUB_LATENCY
+#include "mqpub_latency.h"
+#endif /* MQPUB_LATENCY */
+#include "mqpub_trace.h"
 #ifdef BOARD_AVR_RSS2
 #include "pstr_print.h"
 #endif
@@ -156,8 +160,16 @@ static int _resolve_inetaddr(char *host, ipv6_addr_t *result) {
     result->u64[0].u64 = 0;
     result->u16[4].u16 = 0;
     result->u16[5].u16 = 0xffff;
+#ifdef MQPUB_LATENCY
+    uint32_t start = xtimer_now_usec();
+#endif /* MQPUB_LATENCY */
+    MQPUB_TRACE_EV(MQPUB_TR_DNS, 0);
     int res = sock_dns_query(host, &result->u32[3].u32, AF_INET);
+    MQPUB_TRACE_EV(MQPUB_TR_DNS | MQPUB_TR_END, res < 0 ? res : 0);
     if (res >= 0) {
+#ifdef MQPUB_LATENCY
+        mqpub_lat_add(MQPUB_LAT_DNS, xtimer_now_usec() - start);
+#endif /* MQPUB_LATENCY */
         /* Cache result */
         cache_update(host, result);
     }
@@ -213,3 +225,7 @@ void dns_resolve_refresh(void) {
     }
 }
 
+
+size_t dns_resolve_cache_bytes(void) {
+    return sizeof(dns_resolve_cache);
+}
@@ -9,5 +9,7 @@
 void dns_resolve_init(void);
 int dns_resolve_inetaddr(char *host, ipv6_addr_t *result);
 void dns_resolve_refresh(void);
+/* Size of DNS cache in RAM */
+size_t dns_resolve_cache_bytes(void);
 
 #endif /* DNS_RESOLVE_H */
@@ -29,63 +29,17 @@
 #endif
 
 #ifdef MODULE_NETSTATS_RPL
-typedef enum {s_dio, s_dis, s_dao, s_dao_ack} s_stats_t;
+#define REPORT_SCHEMA_RPL_STATS
+#define REPORT_SCHEMA_SET rpl_stats
+#define REPORT_SCHEMA_TYPE netstats_rpl_t
+#include "report_schema_gen.h"
 
 static int stats(char *str, size_t len, uint8_t *done) {
-     char *s = str;
-     size_t l = len;
-     static s_stats_t state = s_dio;
-     *done = 0;
-     int nread = 0;
-     
-     switch (state) {
-     case s_dio:
-       RECORD_START(s + nread, l - nread);
-       PUTFMT(",{\"n\":\"rpl;stats;dio\",\"vj\":[");
-       PUTFMT("{\"n\":\"u_rx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dio_rx_ucast_count);
-       PUTFMT(",{\"n\":\"u_tx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dio_tx_ucast_count);
-       PUTFMT(",{\"n\":\"m_rx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dio_rx_mcast_count);
-       PUTFMT(",{\"n\":\"m_tx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dio_tx_mcast_count);
-       PUTFMT("]}");
-       RECORD_END(nread);
-       state = s_dis;
-
-     case s_dis:
-       RECORD_START(s + nread, l - nread);
-       PUTFMT(",{\"n\":\"rpl;stats;dis\",\"vj\":[");
-       PUTFMT("{\"n\":\"u_rx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dis_rx_ucast_count);
-       PUTFMT(",{\"n\":\"u_tx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dis_tx_ucast_count);
-       PUTFMT(",{\"n\":\"m_rx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dis_rx_mcast_count);
-       PUTFMT(",{\"n\":\"m_tx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dis_tx_mcast_count);
-       PUTFMT("]}");
-       RECORD_END(nread);     
-       state = s_dao;
-
-     case s_dao:
-       RECORD_START(s + nread, l - nread);
-       PUTFMT(",{\"n\":\"rpl;stats;dao\",\"vj\":[");
-       PUTFMT("{\"n\":\"u_rx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dao_rx_ucast_count);
-       PUTFMT(",{\"n\":\"u_tx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dao_tx_ucast_count);
-       PUTFMT(",{\"n\":\"m_rx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dao_rx_mcast_count);
-       PUTFMT(",{\"n\":\"m_tx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dao_tx_mcast_count);
-       PUTFMT("]}");
-       RECORD_END(nread);
-       state = s_dao_ack;
-
-     case s_dao_ack:
-       RECORD_START(s + nread, l - nread);
-       PUTFMT(",{\"n\":\"rpl;stats;dao_ack\",\"vj\":[");
-       PUTFMT("{\"n\":\"u_rx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dao_ack_rx_ucast_count);
-       PUTFMT(",{\"n\":\"u_tx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dao_ack_tx_ucast_count);
-       PUTFMT(",{\"n\":\"m_rx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dao_ack_rx_mcast_count);
-       PUTFMT(",{\"n\":\"m_tx\",\"u\":\"count\",\"v\":%d}", gnrc_rpl_netstats.dao_ack_tx_mcast_count);
-       PUTFMT("]}");
-       RECORD_END(nread);     
-       state = s_dio;
-       
-       *done = 1;
-     }
-     return nread;
+     static uint8_t state;
+     REPORT_DELTA_SLOTS(delta, REPORT_SCHEMA_LEN(rpl_stats));
+
+     return report_schema_gen(rpl_stats, REPORT_SCHEMA_LEN(rpl_stats), &gnrc_rpl_netstats,
+                              REPORT_DELTA_ARG(delta), &state, str, len, done);
 }
 
 #endif /* MODULE_NETSTATS_RPL */
@@ -96,53 +50,71 @@ static int instances(char *str, size_t len) {
      size_t nread = 0;
      
      RECORD_START(s + nread, l - nread);
-     PUTFMT(",{\"n\":\"rpl;inst\",\"vj\":[");
+     PUTGROUP("rpl;inst");
      for (uint8_t i = 0; i < GNRC_RPL_INSTANCES_NUMOF; ++i) {
-          uint8_t first = 1;
           if (gnrc_rpl_instances[i].state != 0) {
-               if (first)
-                    first = 0;
-               else
-                    PUTFMT(",");
-               PUTFMT("{\"id\":%d,\"mop\":%d,\"ocp\":%d}",
-                       gnrc_rpl_instances[i].id, gnrc_rpl_instances[i].mop, gnrc_rpl_instances[i].of->ocp);
+               PUTOPEN();
+               PUTTKEY("id");
+               PUTU32(gnrc_rpl_instances[i].id);
+               PUTTKEY("mop");
+               PUTU32(gnrc_rpl_instances[i].mop);
+               PUTTKEY("ocp");
+               PUTU32(gnrc_rpl_instances[i].of->ocp);
+               PUTCLOSE();
           }
      }
-     PUTFMT("]}");
+     PUTGROUPEND();
      RECORD_END(nread);     
 
      return nread;
 }
 
+/*
+ * Short form of DODAG id -- last two bytes in hex
+ */
+static char *dodag_short_id(gnrc_rpl_dodag_t *dodag, char *buf, size_t len, char *prefix) {
+     size_t n = strlcpy(buf, prefix, len);
+     if (n + 2*2 < len)
+          report_hex(buf + n, &dodag->dodag_id.u8[14], 2);
+     return buf;
+}
+
 static int dags(char *str, size_t len) {
      char *s = str;
      size_t l = len;
      size_t nread = 0;
      
      RECORD_START(s + nread, l - nread);
-     PUTFMT(",{\"n\":\"rpl;dag\",\"vj\":[");
+     PUTGROUP("rpl;dag");
 
      for (uint8_t i = 0; i < GNRC_RPL_INSTANCES_NUMOF; ++i) {
-          uint8_t first = 1;
           if (gnrc_rpl_instances[i].state != 0) {
-               if (first)
-                    first = 0;
-               else
-                    PUTFMT(",");
-               
                gnrc_rpl_dodag_t *dodag = NULL;
                dodag = &gnrc_rpl_instances[i].dodag;
-
-               PUTFMT("{\"root\":\":%02x%02x\", \"inst\":%d, \"rank\":%d, \"ver\":%d, \"pref\":%d, \"status\":\"%s%s\"}",
-               //ipv6_addr_to_str(addr_str, &dodag->dodag_id, sizeof(addr_str)),
-                      dodag->dodag_id.u8[14], dodag->dodag_id.u8[15], 
-                      dodag->instance->id,
-                      dodag->my_rank, dodag->version, dodag->prf,
-                      dodag->grounded ? "g": "",
-                      (dodag->node_status == GNRC_RPL_LEAF_NODE ? "l" : "r"));
+               char id[sizeof(":ffff")];
+               char status[3];
+
+               status[0] = dodag->grounded ? 'g' : '\0';
+               status[1] = '\0';
+               strlcat(status, (dodag->node_status == GNRC_RPL_LEAF_NODE ? "l" : "r"), sizeof(status));
+
+               PUTOPEN();
+               PUTTKEY("root");
+               PUTSTR(dodag_short_id(dodag, id, sizeof(id), ":"));
+               PUTTKEY("inst");
+               PUTU32(dodag->instance->id);
+               PUTTKEY("rank");
+               PUTU32(dodag->my_rank);
+               PUTTKEY("ver");
+               PUTU32(dodag->version);
+               PUTTKEY("pref");
+               PUTU32(dodag->prf);
+               PUTTKEY("status");
+               PUTSTR(status);
+               PUTCLOSE();
           }
      }
-     PUTFMT("]}");
+     PUTGROUPEND();
      RECORD_END(nread);     
      return nread;
 }
@@ -153,41 +125,64 @@ static int parents(char *str, size_t len) {
      size_t nread = 0;
      
      RECORD_START(s + nread, l - nread);
-     PUTFMT(",{\"n\":\"rpl;parents\",\"vj\":[");
+     PUTGROUP("rpl;parents");
 
      for (uint8_t i = 0; i < GNRC_RPL_INSTANCES_NUMOF; ++i) {
-          uint8_t first = 1;
           if (gnrc_rpl_instances[i].state != 0) {
-               if (first)
-                    first = 0;
-               else
-                    PUTFMT(",");
-
                gnrc_rpl_dodag_t *dodag = NULL;
                dodag = &gnrc_rpl_instances[i].dodag;
 
                {
                     gnrc_rpl_parent_t *parent = NULL;
-                    uint8_t first = 1;
+                    char id[sizeof("ffff")];
                     char addr_str[IPV6_ADDR_MAX_STR_LEN];
                     LL_FOREACH(gnrc_rpl_instances[i].dodag.parents, parent) {
-                         if (first)
-                              first = 0;
-                         else
-                              PUTFMT(",");
-                         PUTFMT("{\"dag\":\"%02x%02x\"", dodag->dodag_id.u8[14], dodag->dodag_id.u8[15]);
-                         PUTFMT(",\"parent\":\"%s\",\"rank\":%d}",
-                                ipv6_addr_to_str(addr_str, &parent->addr, sizeof(addr_str)),
-                                parent->rank);
+                         PUTOPEN();
+                         PUTTKEY("dag");
+                         PUTSTR(dodag_short_id(dodag, id, sizeof(id), ""));
+                         PUTTKEY("parent");
+                         PUTSTR(ipv6_addr_to_str(addr_str, &parent->addr, sizeof(addr_str)));
+                         PUTTKEY("rank");
+                         PUTU32(parent->rank);
+                         PUTCLOSE();
                     }
                }
           }
      }
-     PUTFMT("]}");
+     PUTGROUPEND();
      RECORD_END(nread);     
      return nread;
 }
 
+static uint32_t _fnv(uint32_t h, const void *data, size_t len) {
+     const uint8_t *p = data;
+
+     while (len-- > 0)
+          h = (h ^ *p++) * 16777619U;
+     return h;
+}
+
+/*
+ * Signature of the RPL topology -- instance, DODAG, version and
+ * preferred parent. It changes when the node moves in the topology.
+ */
+uint32_t rpl_topology_sig(void) {
+     uint32_t sig = 2166136261U;
+
+     for (uint8_t i = 0; i < GNRC_RPL_INSTANCES_NUMOF; ++i) {
+          if (gnrc_rpl_instances[i].state != 0) {
+               gnrc_rpl_dodag_t *dodag = &gnrc_rpl_instances[i].dodag;
+
+               sig = _fnv(sig, &gnrc_rpl_instances[i].id, sizeof(gnrc_rpl_instances[i].id));
+               sig = _fnv(sig, &dodag->dodag_id, sizeof(dodag->dodag_id));
+               sig = _fnv(sig, &dodag->version, sizeof(dodag->version));
+               if (dodag->parents != NULL)
+                    sig = _fnv(sig, &dodag->parents->addr, sizeof(dodag->parents->addr));
+          }
+     }
+     return sig;
+}
+
 typedef enum {s_instances, s_dags, s_parents, s_stats} rpl_state_t;
 
 int rpl_report(uint8_t *buf, size_t len, uint8_t *finished, 
@@ -228,9 +223,10 @@ int rpl_report(uint8_t *buf, size_t len, uint8_t *finished,
      
             do {
                  n = stats(s + nread, l - nread, &done);
-                 if (n == 0)
-                      return (nread);
                  nread += n;
+                 /* Nothing written and not done -- no room */
+                 if (n == 0 && !done)
+                      return (nread);
             } while (!done);
        }
 #endif
@@ -30,46 +30,52 @@
 
 #ifdef MODULE_NETSTATS
 
-static int iface_name(netif_t *iface, char *str, size_t len) {
+/*
+ * SenML name for interface: "netif;<name>;<suffix>"
+ */
+static char *iface_name(netif_t *iface, char *str, size_t len, char *suffix) {
     char name[CONFIG_NETIF_NAMELENMAX];
     netif_get_name(iface, name);
-    strncpy(str, name, len < sizeof(name) ? len : sizeof(name));
-    return strlen(str);
+    strlcpy(str, "netif;", len);
+    strlcat(str, name, len);
+    strlcat(str, suffix, len);
+    return str;
 }
 
 static int stats(netif_t *iface, char *str, size_t len, __attribute__((unused)) uint8_t *finished) {
     char *s = str;
     size_t l = len;
     int nread = 0;
+    char name[CONFIG_NETIF_NAMELENMAX + sizeof("netif;;stats;")];
 
     netstats_t *netstats;
     int res = netif_get_opt(iface, NETOPT_STATS, NETSTATS_LAYER2, &netstats,
                             sizeof(&netstats));
 
     RECORD_START(s + nread, l - nread);
-    PUTFMT(",{\"n\":\"netif;");
-    RECORD_ADD((unsigned) iface_name(iface, RECORD_STR(), RECORD_LEN()));
-    PUTFMT(";stats;\",\"vj\":[");
+    PUTGROUP(iface_name(iface, name, sizeof(name), ";stats;"));
     if (res >= 0) {
-        PUTFMT("{\"n\":\"rx_bytes\",\"u\":\"count\",\"v\":%" PRIu32 "},", netstats->rx_bytes);
-        PUTFMT("{\"n\":\"rx\",\"u\":\"count\",\"v\":%" PRIu32 "},", netstats->rx_count);
+        PUTCOUNT("rx_bytes", netstats->rx_bytes);
+        PUTCOUNT("rx", netstats->rx_count);
         uint32_t tx_count = netstats->tx_unicast_count + netstats->tx_mcast_count;
-        PUTFMT("{\"n\":\"tx\",\"u\":\"count\",\"v\":%" PRIu32 "}", tx_count);
+        PUTCOUNT("tx", tx_count);
     }
-    PUTFMT("]}");
+    PUTGROUPEND();
     uint16_t u16;
     res = netif_get_opt(iface, NETOPT_CHANNEL, 0, &u16, sizeof(u16));
     if (res >= 0) {
-        PUTFMT(",{\"n\":\"netif;");
-        RECORD_ADD((unsigned) iface_name(iface, RECORD_STR(), RECORD_LEN()));
-        PUTFMT(";chan;\",\"v\":%" PRIu16 "}", u16);
+        PUTNAME(iface_name(iface, name, sizeof(name), ";chan;"));
+        PUTKEY(SENML_V);
+        PUTU32(u16);
+        PUTCLOSE();
     }
     int8_t i8;
     res = netif_get_opt(iface, NETOPT_RSSI, 0, &i8, sizeof(i8));
     if (res >= 0) {
-        PUTFMT(",{\"n\":\"netif;");
-        RECORD_ADD((unsigned) iface_name(iface, RECORD_STR(), RECORD_LEN()));
-        PUTFMT(";rssi;\",\"v\":%" PRIi8 "}", i8);
+        PUTNAME(iface_name(iface, name, sizeof(name), ";rssi;"));
+        PUTKEY(SENML_V);
+        PUTI32(i8);
+        PUTCLOSE();
     }
     RECORD_END(nread);
 
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MEM_STATS
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "thread.h"
+#include "net/emcute.h"
+#include "net/ipv6/addr.h"
+
+#include "mqttsn_publisher.h"
+#include "report.h"
+#include "mem_stats.h"
+#include "dns_resolve.h"
+#include "mqpub_topics.h"
+#ifdef REPORT_QUEUE
+#include "report_queue.h"
+#endif /* REPORT_QUEUE */
+
+#ifdef BOARD_AVR_RSS2
+#include "pstr_print.h"
+#endif
+
+/* emcute has one receive and one send buffer */
+#if defined(CONFIG_EMCUTE_BUFSIZE)
+#define MEM_EMCUTE_BYTES (2 * CONFIG_EMCUTE_BUFSIZE)
+#elif defined(EMCUTE_BUFSIZE)
+#define MEM_EMCUTE_BYTES (2 * EMCUTE_BUFSIZE)
+#else
+#define MEM_EMCUTE_BYTES (2 * (MQTTSN_BUFFER_SIZE + 16))
+#endif /* defined(CONFIG_EMCUTE_BUFSIZE) */
+
+typedef struct {
+    const char *name;
+    size_t bytes;
+} mem_static_t;
+
+#define MEM_STATIC_NUMOF 5
+
+/*
+ * Sizes of static buffers. Return number of buffers.
+ */
+static unsigned _static_sizes(mem_static_t *st) {
+    unsigned n = 0;
+
+    st[n].name = "payload";
+    st[n++].bytes = mqpub_buffer_bytes();
+    st[n].name = "emcute";
+    st[n++].bytes = MEM_EMCUTE_BYTES;
+    st[n].name = "dns_cache";
+    st[n++].bytes = dns_resolve_cache_bytes();
+    st[n].name = "topics";
+    st[n++].bytes = mqpub_topics_bytes();
+#ifdef REPORT_QUEUE
+    st[n].name = "queue";
+    st[n++].bytes = REPORT_QUEUE_SIZE;
+#endif /* REPORT_QUEUE */
+    return n;
+}
+
+/*
+ * Thread with pid, or NULL if there is none. Stack used so far --
+ * the high-water mark -- in *used, unless used is NULL.
+ */
+static thread_t *_thread(kernel_pid_t pid, size_t *used) {
+    thread_t *t = (thread_t *) thread_get(pid);
+
+    if (t == NULL)
+        return NULL;
+    if (used != NULL)
+        *used = t->stack_size - thread_measure_stack_free(t->stack_start);
+    return t;
+}
+
+typedef enum {
+    s_stack, s_stacksize, s_static,
+} mem_report_state_t;
+
+int mem_stats_report(uint8_t *buf, size_t len, uint8_t *finished,
+                     __attribute__((unused)) char **topicp, __attribute__((unused)) char **basenamep) {
+    char *s = (char *) buf;
+    size_t l = len;
+    int nread = 0;
+    static mem_report_state_t state = s_stack;
+    /* One record per thread, so that each is small */
+    static kernel_pid_t pid = KERNEL_PID_FIRST;
+    thread_t *t;
+    size_t used;
+
+    *finished = 0;
+
+    switch (state) {
+    case s_stack:
+        for (; pid <= KERNEL_PID_LAST; pid++) {
+            /* Measure before the record, which may be sized first */
+            if ((t = _thread(pid, &used)) == NULL)
+                continue;
+            RECORD_START(s + nread, l - nread);
+            PUTGROUP("mem;stack;");
+            PUTMEAS(t->name, "byte", (uint32_t) used);
+            PUTGROUPEND();
+            RECORD_END(nread);
+        }
+        pid = KERNEL_PID_FIRST;
+        /* Sizes do not change -- only in full snapshots */
+        if (!report_delta_full())
+            break;
+        state = s_stacksize;
+    case s_stacksize:
+        for (; pid <= KERNEL_PID_LAST; pid++) {
+            if ((t = _thread(pid, NULL)) == NULL)
+                continue;
+            RECORD_START(s + nread, l - nread);
+            PUTGROUP("mem;stacksize;");
+            PUTMEAS(t->name, "byte", (uint32_t) t->stack_size);
+            PUTGROUPEND();
+            RECORD_END(nread);
+        }
+        pid = KERNEL_PID_FIRST;
+        state = s_static;
+    case s_static:
+    {
+        mem_static_t st[MEM_STATIC_NUMOF];
+        unsigned i, n = _static_sizes(st);
+
+        RECORD_START(s + nread, l - nread);
+        PUTGROUP("mem;static;");
+        for (i = 0; i < n; i++) {
+            PUTMEAS(st[i].name, "byte", (uint32_t) st[i].bytes);
+        }
+        PUTGROUPEND();
+        RECORD_END(nread);
+    }
+    }
+    state = s_stack;
+    *finished = 1;
+
+    return nread;
+}
+
+int mem_stats_cmd(int argc, char **argv) {
+    mem_static_t st[MEM_STATIC_NUMOF];
+    unsigned i, n;
+    kernel_pid_t pid;
+    thread_t *t;
+    size_t used, total = 0;
+
+    (void) argc;
+    (void) argv;
+    printf("%3s %-12s %6s %6s %6s\n", "pid", "thread", "size", "used", "free");
+    for (pid = KERNEL_PID_FIRST; pid <= KERNEL_PID_LAST; pid++) {
+        if ((t = _thread(pid, &used)) != NULL) {
+            printf("%3d %-12s %6u %6u %6u\n", pid, t->name, (unsigned) t->stack_size,
+                   (unsigned) used, (unsigned) (t->stack_size - used));
+        }
+    }
+    n = _static_sizes(st);
+    for (i = 0; i < n; i++) {
+        printf("%-16s %6u\n", st[i].name, (unsigned) st[i].bytes);
+        total += st[i].bytes;
+    }
+    printf("%-16s %6u\n", "static total", (unsigned) total);
+    return 0;
+}
+
+void mem_stats_init(void) {
+    static report_sched_t mem_sched;
+    report_register(&mem_sched, mem_stats_report, "mem",
+                    MEM_STATS_PERIOD, 3*MEM_STATS_PERIOD, 3);
+}
+
+#endif /* MEM_STATS */
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Memory use. Stack high-water marks of all threads, measured on the
+ * stacks of threads created with THREAD_CREATE_STACKTEST, and the
+ * sizes of the large static buffers of the publisher: payload
+ * buffers, emcute buffers, DNS cache, topic table and store-and-forward
+ * queue. Use them to see how much RAM stacks and buffers can give up.
+ *
+ * Enabled with MEM_STATS. Needs DEVELHELP, for stack sizes and
+ * thread names.
+ */
+
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef DEVELHELP
+#error "MEM_STATS needs DEVELHELP"
+#endif /* DEVELHELP */
+
+/* Report interval, sec. Stack use only grows, and slowly. */
+#ifndef MEM_STATS_PERIOD
+#define MEM_STATS_PERIOD 3600
+#endif /* MEM_STATS_PERIOD */
+
+void mem_stats_init(void);
+int mem_stats_cmd(int argc, char **argv);
+int mem_stats_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
+
+#endif /* MEM_STATS_H */
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MQPUB_AIRTIME
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "xtimer.h"
+#include "net/sim7020.h"
+
+#include "mqpub_airtime.h"
+
+extern uint32_t sim7020_activation_usecs;
+
+mqpub_airtime_stats_t mqpub_airtime_stats;
+
+/* Counters at start of cycle */
+static uint32_t start_tx, start_rx;
+static uint32_t start_activations;
+static uint32_t sent, acked;
+/* Cycle in progress, and attempt in progress */
+static uint8_t in_cycle, in_attempt;
+/* Start of attempt, and active time of earlier attempts */
+static uint32_t attempt_usec;
+static uint32_t active_usec;
+
+void mqpub_airtime_start(void) {
+    sim7020_netstats_t *ns = sim7020_get_netstats();
+
+    start_tx = ns->tx_bytes;
+    start_rx = ns->rx_bytes;
+    start_activations = ns->activation_count;
+    sent = acked = 0;
+    active_usec = 0;
+    in_cycle = 1;
+    in_attempt = 0;
+    mqpub_airtime_resume();
+}
+
+void mqpub_airtime_resume(void) {
+    if (in_cycle && !in_attempt) {
+        attempt_usec = xtimer_now_usec();
+        in_attempt = 1;
+    }
+}
+
+void mqpub_airtime_pause(void) {
+    if (in_attempt) {
+        active_usec += xtimer_now_usec() - attempt_usec;
+        in_attempt = 0;
+    }
+}
+
+void mqpub_airtime_sent(size_t len) {
+    sent += len;
+}
+
+void mqpub_airtime_acked(size_t len) {
+    acked += len;
+}
+
+void mqpub_airtime_end(void) {
+    mqpub_airtime_stats_t *st = &mqpub_airtime_stats;
+    sim7020_netstats_t *ns = sim7020_get_netstats();
+
+    if (!in_cycle)
+        return;
+    mqpub_airtime_pause();
+    in_cycle = 0;
+    st->active_ms = active_usec / US_PER_MS;
+    /* Activated in this cycle -- time spent before first send */
+    if (ns->activation_count != start_activations)
+        st->activation_ms = sim7020_activation_usecs / US_PER_MS;
+    else
+        st->activation_ms = 0;
+    st->tx_bytes = ns->tx_bytes - start_tx;
+    st->rx_bytes = ns->rx_bytes - start_rx;
+    st->sent = sent;
+    st->acked = acked;
+    st->cycles++;
+    st->total_active_ms += st->active_ms;
+    st->total_activation_ms += st->activation_ms;
+    st->total_sent += sent;
+    st->total_acked += acked;
+}
+
+uint32_t mqpub_airtime_rate(int total) {
+    mqpub_airtime_stats_t *st = &mqpub_airtime_stats;
+    uint32_t bytes = total ? st->total_acked : st->acked;
+    uint32_t ms = total ? st->total_active_ms : st->active_ms;
+
+    if (ms == 0)
+        return 0;
+    return (uint32_t) ((uint64_t) bytes * MS_PER_SEC / ms);
+}
+
+uint32_t mqpub_airtime_overhead(void) {
+    mqpub_airtime_stats_t *st = &mqpub_airtime_stats;
+
+    if (st->acked == 0)
+        return 0;
+    return (uint32_t) ((uint64_t) (st->tx_bytes + st->rx_bytes) * 100 / st->acked);
+}
+
+void mqpub_airtime_print(void) {
+    mqpub_airtime_stats_t *st = &mqpub_airtime_stats;
+
+    printf("  airtime: last cycle active %" PRIu32 " ms (activation %" PRIu32 " ms), tx %" PRIu32
+           " bytes, rx %" PRIu32 " bytes, payload sent %" PRIu32 " acked %" PRIu32 " bytes, %" PRIu32
+           " bytes/s, overhead %" PRIu32 "%%\n",
+           st->active_ms, st->activation_ms, st->tx_bytes, st->rx_bytes, st->sent, st->acked,
+           mqpub_airtime_rate(0), mqpub_airtime_overhead());
+    printf("  airtime: %" PRIu32 " cycles, active %" PRIu32 " ms (activation %" PRIu32 " ms), payload sent %" PRIu32
+           " acked %" PRIu32 " bytes, %" PRIu32 " bytes/s\n",
+           st->cycles, st->total_active_ms, st->total_activation_ms, st->total_sent, st->total_acked,
+           mqpub_airtime_rate(1));
+}
+
+#endif /* MQPUB_AIRTIME */
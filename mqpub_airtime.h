@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Modem airtime accounting. For each publish cycle, the time the
+ * SIM7020 is active on behalf of the publisher is set against the
+ * SenML payload bytes that were delivered, to give delivered bytes
+ * per modem-second, and the bytes the modem sent and received per
+ * payload byte (overhead). Active time is the sum of the publisher's
+ * attempts in the cycle -- not the waits between them. Activation
+ * time, spent on AT commands for attach and PDP context before
+ * anything can be sent, is counted separately as AT overhead.
+ *
+ * Enabled with MQPUB_AIRTIME. Needs the SIM7020.
+ */
+
+#ifndef MQPUB_AIRTIME_H
+#define MQPUB_AIRTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef MODULE_SIM7020
+#error "MQPUB_AIRTIME needs MODULE_SIM7020"
+#endif /* MODULE_SIM7020 */
+
+typedef struct {
+    /* Last publish cycle */
+    uint32_t active_ms;         /* Modem active for the publisher */
+    uint32_t activation_ms;     /* Modem activation -- AT overhead */
+    uint32_t tx_bytes;          /* Sent by modem */
+    uint32_t rx_bytes;          /* Received by modem */
+    uint32_t sent;              /* SenML payload bytes sent */
+    uint32_t acked;             /* SenML payload bytes acknowledged -- delivered */
+    /* All cycles */
+    uint32_t cycles;
+    uint32_t total_active_ms;
+    uint32_t total_activation_ms;
+    uint32_t total_sent;
+    uint32_t total_acked;
+} mqpub_airtime_stats_t;
+
+extern mqpub_airtime_stats_t mqpub_airtime_stats;
+
+/*
+ * Start of publish cycle, and of its first attempt
+ */
+void mqpub_airtime_start(void);
+/*
+ * Publisher is using the modem again, or no longer, in the cycle --
+ * start and end of an attempt
+ */
+void mqpub_airtime_resume(void);
+void mqpub_airtime_pause(void);
+/*
+ * Payload of len bytes sent, or acknowledged
+ */
+void mqpub_airtime_sent(size_t len);
+void mqpub_airtime_acked(size_t len);
+/*
+ * End of publish cycle -- all reports are published. Nothing if the
+ * cycle has ended already.
+ */
+void mqpub_airtime_end(void);
+/*
+ * Delivered payload bytes per modem-second, for last cycle, or for
+ * all cycles
+ */
+uint32_t mqpub_airtime_rate(int total);
+/*
+ * Bytes sent and received by modem per 100 delivered payload bytes,
+ * last cycle
+ */
+uint32_t mqpub_airtime_overhead(void);
+/*
+ * Print statistics
+ */
+void mqpub_airtime_print(void);
+
+#endif /* MQPUB_AIRTIME_H */
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MQPUB_DISCOVERY
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "net/ipv6/addr.h"
+#include "net/sock/udp.h"
+#include "random.h"
+#include "xtimer.h"
+
+#include "mqttsn_publisher.h"
+#include "mqpub_gateway.h"
+#include "mqpub_discovery.h"
+
+/* MQTT-SN message types */
+enum {
+    ADVERTISE = 0x00,
+    SEARCHGW  = 0x01,
+    GWINFO    = 0x02,
+};
+
+static sock_udp_t sock;
+static uint8_t sock_open;
+static uint8_t radius = 1;
+static uint32_t last_search;
+static uint8_t searched;
+
+mqpub_discovery_stats_t mqpub_discovery_stats;
+
+int mqpub_discovery_init(void) {
+    sock_udp_ep_t local = SOCK_IPV6_EP_ANY;
+
+    local.port = MQPUB_DISCOVERY_PORT;
+    if (sock_udp_create(&sock, &local, NULL, 0) < 0) {
+        printf("mqpub_discovery: cannot open port %u\n", MQPUB_DISCOVERY_PORT);
+        return -1;
+    }
+    sock_open = 1;
+    return 0;
+}
+
+/*
+ * Receive and handle one message. t0 is the time SEARCHGW was sent,
+ * for RTT of GWINFO. Return message type, or a negative sock error.
+ */
+static int _recv(uint32_t timeout, uint32_t t0) {
+    uint8_t buf[24];
+    sock_udp_ep_t remote;
+    ssize_t n = sock_udp_recv(&sock, buf, sizeof(buf), timeout, &remote);
+
+    if (n < 0)
+        return n;
+    if (n < 3 || buf[0] != n)
+        /* Discovery messages are short -- one-byte length */
+        return 0;
+    switch (buf[1]) {
+    case ADVERTISE:
+        if (n >= 5) {
+            uint16_t duration = ((uint16_t) buf[3] << 8) | buf[4];
+
+            mqpub_discovery_stats.advertise++;
+            mqpub_gw_discovered((ipv6_addr_t *) &remote.addr.ipv6, remote.port, buf[2], 0,
+                                (uint32_t) duration * MQPUB_DISCOVERY_N_ADV);
+        }
+        break;
+    case GWINFO:
+        mqpub_discovery_stats.gwinfo++;
+        if (n == 3) {
+            /* From the gateway itself */
+            uint32_t rtt = t0 != 0 ? (xtimer_now_usec() - t0) / US_PER_MS : 0;
+
+            mqpub_gw_discovered((ipv6_addr_t *) &remote.addr.ipv6, remote.port, buf[2], rtt,
+                                MQPUB_DISCOVERY_TTL);
+        }
+        else if (n == 3 + sizeof(ipv6_addr_t)) {
+            /* From another client, with the gateway address */
+            mqpub_gw_discovered((ipv6_addr_t *) &buf[3], MQPUB_DISCOVERY_GW_PORT, buf[2], 0,
+                                MQPUB_DISCOVERY_TTL);
+        }
+        break;
+    default:
+        break;
+    }
+    return buf[1];
+}
+
+void mqpub_discovery_poll(void) {
+    if (!sock_open)
+        return;
+    while (_recv(0, 0) >= 0)
+        ;
+}
+
+int mqpub_discovery_search(void) {
+    sock_udp_ep_t group = { .family = AF_INET6, .port = MQPUB_DISCOVERY_GW_PORT };
+    uint8_t msg[3] = { 3, SEARCHGW, 0 };
+    uint32_t now = xtimer_now_usec();
+    uint32_t t0, elapsed;
+    int found = 0;
+
+    if (!sock_open)
+        return 0;
+    if (searched && now - last_search < MQPUB_DISCOVERY_INTERVAL * US_PER_SEC)
+        return 0;
+    /* Spread searches from nodes that lost the gateway together */
+    xtimer_usleep(random_uint32_range(0, MQPUB_DISCOVERY_JITTER_MS * US_PER_MS + 1));
+    ipv6_addr_from_str((ipv6_addr_t *) &group.addr.ipv6, radius > 1 ? "ff03::1" : "ff02::1");
+    msg[2] = radius;
+    printf("mqpub_discovery: SEARCHGW radius %u\n", radius);
+    t0 = xtimer_now_usec();
+    last_search = t0;
+    searched = 1;
+    if (sock_udp_send(&sock, msg, sizeof(msg), &group) < 0)
+        return 0;
+    mqpub_discovery_stats.searches++;
+    while ((elapsed = xtimer_now_usec() - t0) < MQPUB_DISCOVERY_WAIT_MS * US_PER_MS) {
+        int res = _recv(MQPUB_DISCOVERY_WAIT_MS * US_PER_MS - elapsed, t0);
+
+        if (res == GWINFO)
+            found++;
+        else if (res < 0 && res != -EAGAIN)
+            break;
+    }
+    if (found == 0 && radius < MQPUB_DISCOVERY_RADIUS_MAX)
+        radius++;
+    return found;
+}
+
+#endif /* MQPUB_DISCOVERY */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Gateway discovery. Gateways are found from their ADVERTISE
+ * messages, and by multicasting SEARCHGW and collecting GWINFO
+ * replies, with the round-trip time. Discovered gateways are added
+ * to the gateway list (mqpub_gateway.h), where they compete with the
+ * configured ones.
+ *
+ * Enabled with MQPUB_DISCOVERY.
+ */
+
+#ifndef MQPUB_DISCOVERY_H
+#define MQPUB_DISCOVERY_H
+
+#include <stdint.h>
+
+/* Max discovered gateways kept */
+#ifndef MQPUB_DISCOVERY_MAX_GW
+#define MQPUB_DISCOVERY_MAX_GW 3
+#endif /* MQPUB_DISCOVERY_MAX_GW */
+
+/* Local port, for ADVERTISE and GWINFO */
+#ifndef MQPUB_DISCOVERY_PORT
+#define MQPUB_DISCOVERY_PORT (1885U)
+#endif /* MQPUB_DISCOVERY_PORT */
+
+/* Gateway port, for SEARCHGW */
+#ifndef MQPUB_DISCOVERY_GW_PORT
+#define MQPUB_DISCOVERY_GW_PORT MQTTSN_GATEWAY_PORT
+#endif /* MQPUB_DISCOVERY_GW_PORT */
+
+/*
+ * Max SEARCHGW radius. Radius 1 is sent to the link-local all-nodes
+ * group, larger radius to the realm-local group. The radius is only
+ * carried in the message and picks the group: the IPv6 hop limit is
+ * not set (sock_udp has no per-send hop limit), and the realm-local
+ * group reaches past the first hop only where the routing forwards
+ * it -- not with RPL in non-storing mode. Gateways further away are
+ * found through their ADVERTISE messages.
+ */
+#ifndef MQPUB_DISCOVERY_RADIUS_MAX
+#define MQPUB_DISCOVERY_RADIUS_MAX 3
+#endif /* MQPUB_DISCOVERY_RADIUS_MAX */
+
+/* Time to collect GWINFO replies, msec */
+#ifndef MQPUB_DISCOVERY_WAIT_MS
+#define MQPUB_DISCOVERY_WAIT_MS 2000
+#endif /* MQPUB_DISCOVERY_WAIT_MS */
+
+/* Max random delay before SEARCHGW, msec */
+#ifndef MQPUB_DISCOVERY_JITTER_MS
+#define MQPUB_DISCOVERY_JITTER_MS 500
+#endif /* MQPUB_DISCOVERY_JITTER_MS */
+
+/* Min interval between searches, sec */
+#ifndef MQPUB_DISCOVERY_INTERVAL
+#define MQPUB_DISCOVERY_INTERVAL 60
+#endif /* MQPUB_DISCOVERY_INTERVAL */
+
+/* Lifetime of a gateway found through GWINFO, sec */
+#ifndef MQPUB_DISCOVERY_TTL
+#define MQPUB_DISCOVERY_TTL 3600
+#endif /* MQPUB_DISCOVERY_TTL */
+
+/* Missed ADVERTISE periods before an advertised gateway is forgotten */
+#ifndef MQPUB_DISCOVERY_N_ADV
+#define MQPUB_DISCOVERY_N_ADV 3
+#endif /* MQPUB_DISCOVERY_N_ADV */
+
+typedef struct {
+    uint16_t searches;          /* SEARCHGW sent */
+    uint16_t gwinfo;            /* GWINFO received */
+    uint16_t advertise;         /* ADVERTISE received */
+} mqpub_discovery_stats_t;
+
+extern mqpub_discovery_stats_t mqpub_discovery_stats;
+
+int mqpub_discovery_init(void);
+/*
+ * Handle ADVERTISE and GWINFO messages received since last call
+ */
+void mqpub_discovery_poll(void);
+/*
+ * Search for gateways, unless a search was made recently. The
+ * radius grows for each search that finds nothing. Return number of
+ * gateways that replied.
+ */
+int mqpub_discovery_search(void);
+
+#endif /* MQPUB_DISCOVERY_H */
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MQPUB_TICKLESS
+
+#include <stdint.h>
+
+#include "irq.h"
+#include "mbox.h"
+#include "thread.h"
+#include "ztimer.h"
+
+#include "mqpub_events.h"
+
+#define MS_PER_HOUR (3600UL * MS_PER_SEC)
+
+/* Events in deadline order */
+static mqpub_event_t *head;
+
+/* Wakeup messages, from timer and from other threads */
+#define WAKE_QUEUE_SIZE 2
+static msg_t wake_queue[WAKE_QUEUE_SIZE];
+static mbox_t wake_mbox = MBOX_INIT(wake_queue, WAKE_QUEUE_SIZE);
+static ztimer_t timer;
+/* Thread running the events */
+static kernel_pid_t loop_pid = KERNEL_PID_UNDEF;
+
+static uint32_t hour_start;
+/* Also counted from interrupt context */
+static uint32_t hour_wakeups;
+
+/* Loop has run since mqpub_events_alive(), or waits for events */
+static volatile uint8_t heartbeat, idle;
+
+mqpub_events_stats_t mqpub_events_stats;
+
+int mqpub_events_alive(void) {
+    unsigned state = irq_disable();
+    int alive = heartbeat || idle;
+
+    heartbeat = 0;
+    irq_restore(state);
+    return alive;
+}
+
+void mqpub_events_heartbeat(void) {
+    heartbeat = 1;
+}
+
+void mqpub_events_timer_wakeup(void) {
+    unsigned state = irq_disable();
+
+    mqpub_events_stats.wakeups++;
+    mqpub_events_stats.timer_wakeups++;
+    hour_wakeups++;
+    irq_restore(state);
+}
+
+uint32_t mqpub_events_now(void) {
+    return ztimer_now(ZTIMER_MSEC);
+}
+
+static void _wake(void *arg) {
+    msg_t msg;
+
+    (void) arg;
+    /* One message is enough -- a full mailbox already wakes the thread */
+    mbox_try_put(&wake_mbox, &msg);
+}
+
+/*
+ * Unlink event. Call with interrupts disabled.
+ */
+static void _remove(mqpub_event_t *ev) {
+    mqpub_event_t **pp;
+
+    for (pp = &head; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == ev) {
+            *pp = ev->next;
+            break;
+        }
+    }
+    ev->pending = 0;
+}
+
+void mqpub_event_at(mqpub_event_t *ev, uint32_t deadline) {
+    mqpub_event_t **pp;
+    unsigned state = irq_disable();
+
+    if (ev->pending)
+        _remove(ev);
+    ev->deadline = deadline;
+    /* After events with the same deadline */
+    for (pp = &head; *pp != NULL && (int32_t) ((*pp)->deadline - deadline) <= 0; pp = &(*pp)->next)
+        ;
+    ev->next = *pp;
+    *pp = ev;
+    ev->pending = 1;
+    irq_restore(state);
+    if (head == ev && thread_getpid() != loop_pid)
+        /* New first deadline -- let the loop set the timer */
+        _wake(NULL);
+}
+
+void mqpub_event_in(mqpub_event_t *ev, uint32_t msec) {
+    mqpub_event_at(ev, mqpub_events_now() + msec);
+}
+
+void mqpub_event_post(mqpub_event_t *ev) {
+    mqpub_event_at(ev, mqpub_events_now());
+}
+
+void mqpub_event_cancel(mqpub_event_t *ev) {
+    unsigned state = irq_disable();
+
+    if (ev->pending)
+        _remove(ev);
+    irq_restore(state);
+}
+
+/*
+ * Take first event, if its deadline has expired
+ */
+static mqpub_event_t *_next_due(uint32_t now) {
+    mqpub_event_t *ev = NULL;
+    unsigned state = irq_disable();
+
+    if (head != NULL && (int32_t) (now - head->deadline) >= 0) {
+        ev = head;
+        head = ev->next;
+        ev->pending = 0;
+    }
+    irq_restore(state);
+    return ev;
+}
+
+void mqpub_events_loop(void) {
+    mqpub_events_stats_t *st = &mqpub_events_stats;
+
+    loop_pid = thread_getpid();
+    timer.callback = _wake;
+    hour_start = mqpub_events_now();
+    while (1) {
+        mqpub_event_t *ev;
+        uint32_t now = mqpub_events_now();
+        msg_t msg;
+        unsigned state;
+
+        while ((ev = _next_due(now)) != NULL) {
+            if (now - ev->deadline > st->late_ms)
+                st->late_ms = now - ev->deadline;
+            st->events++;
+            /* Handler may schedule events, including this one */
+            ev->handler(ev);
+            heartbeat = 1;
+            now = mqpub_events_now();
+        }
+        ztimer_remove(ZTIMER_MSEC, &timer);
+        state = irq_disable();
+        if (head != NULL)
+            ztimer_set(ZTIMER_MSEC, &timer,
+                       (int32_t) (head->deadline - now) > 0 ? head->deadline - now : 0);
+        irq_restore(state);
+
+        idle = 1;
+        mbox_get(&wake_mbox, &msg);
+        idle = 0;
+        heartbeat = 1;
+        while (mbox_try_get(&wake_mbox, &msg))
+            ;
+        now = mqpub_events_now();
+        state = irq_disable();
+        st->wakeups++;
+        hour_wakeups++;
+        if (now - hour_start >= MS_PER_HOUR) {
+            st->hour_wakeups = hour_wakeups;
+            hour_wakeups = 0;
+            hour_start = now;
+        }
+        irq_restore(state);
+    }
+}
+
+#endif /* MQPUB_TICKLESS */
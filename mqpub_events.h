@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Deadline-ordered event queue. Publisher, watchdog and housekeeping
+ * work is scheduled as events, and run by the publisher thread. One
+ * timer is set for the earliest deadline, and nothing wakes the
+ * thread in between, so the MCU can stay in low-power mode.
+ *
+ * Enabled with MQPUB_TICKLESS.
+ */
+
+#ifndef MQPUB_EVENTS_H
+#define MQPUB_EVENTS_H
+
+#include <stdint.h>
+
+typedef struct mqpub_event mqpub_event_t;
+
+struct mqpub_event {
+    mqpub_event_t *next;
+    uint32_t deadline;          /* msec */
+    void (*handler)(mqpub_event_t *ev);
+    uint8_t pending;
+};
+
+#define MQPUB_EVENT_INIT(HANDLER) { NULL, 0, HANDLER, 0 }
+
+typedef struct {
+    uint32_t wakeups;           /* Wakeups -- thread and other timers */
+    uint32_t timer_wakeups;     /* Of them, by other timers */
+    uint32_t events;            /* Events run */
+    uint32_t hour_wakeups;      /* Wakeups in last full hour */
+    uint32_t late_ms;           /* Max lateness of an event, msec */
+} mqpub_events_stats_t;
+
+extern mqpub_events_stats_t mqpub_events_stats;
+
+/*
+ * Current time, msec
+ */
+uint32_t mqpub_events_now(void);
+/*
+ * Schedule event at deadline (msec), or move it if already
+ * scheduled. Can be called from any thread.
+ */
+void mqpub_event_at(mqpub_event_t *ev, uint32_t deadline);
+/*
+ * Schedule event msec from now
+ */
+void mqpub_event_in(mqpub_event_t *ev, uint32_t msec);
+/*
+ * Run event as soon as possible
+ */
+void mqpub_event_post(mqpub_event_t *ev);
+void mqpub_event_cancel(mqpub_event_t *ev);
+/*
+ * Run events as their deadlines expire. Does not return.
+ */
+void mqpub_events_loop(void);
+/*
+ * Event loop has run an event or woken up since the last call, or is
+ * waiting for the next event. For the hardware watchdog, so that it
+ * is not kicked when the loop is stuck in a handler. Clears the
+ * heartbeat; may be called from interrupt context.
+ */
+int mqpub_events_alive(void);
+/*
+ * Handler is making progress -- a long handler calls this between
+ * steps, so that the hardware watchdog is still kicked
+ */
+void mqpub_events_heartbeat(void);
+/*
+ * MCU was woken by a timer of its own, such as the hardware watchdog
+ * kick. Counted with the wakeups; may be called from interrupt
+ * context.
+ */
+void mqpub_events_timer_wakeup(void);
+
+#endif /* MQPUB_EVENTS_H */
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "random.h"
+#include "xtimer.h"
+
+#include "mqttsn_publisher.h"
+#include "mqpub_gateway.h"
+#ifdef MQPUB_DISCOVERY
+#include "net/ipv6/addr.h"
+#include "mqpub_discovery.h"
+#endif /* MQPUB_DISCOVERY */
+
+static const struct {
+    char *host;
+    uint16_t port;
+} gw_addrs[] = { MQTTSN_GATEWAYS };
+#define NUM_GATEWAYS (sizeof(gw_addrs)/sizeof(gw_addrs[0]))
+
+#ifdef MQPUB_DISCOVERY
+/* Discovered gateways follow the configured ones */
+#define NUM_DISCOVERED MQPUB_DISCOVERY_MAX_GW
+static char discovered_hosts[NUM_DISCOVERED][IPV6_ADDR_MAX_STR_LEN];
+#else
+#define NUM_DISCOVERED 0
+#endif /* MQPUB_DISCOVERY */
+
+static mqpub_gw_t gateways[NUM_GATEWAYS + NUM_DISCOVERED];
+static mqpub_gw_t *current;
+/* Gateway of the last successful connect, NULL for the preferred one
+ * before any connect */
+static mqpub_gw_t *connected;
+/* Last time the preferred gateway was tried, sec -- the interval is
+ * longer than 32-bit usec can hold */
+static uint32_t last_probe;
+
+static inline uint32_t _now_sec(void) {
+    return (uint32_t) (xtimer_now_usec64() / US_PER_SEC);
+}
+
+/* now and retry_at in sec -- intervals can be longer than 32-bit usec */
+static inline int _backed_off(const mqpub_gw_t *gw, uint32_t now) {
+    return gw->failures > 0 && (int32_t) (now - gw->retry_at) < 0;
+}
+
+/*
+ * Time until backed-off gateway can be tried, usec
+ */
+static uint32_t _wait_usec(const mqpub_gw_t *gw, uint32_t now) {
+    uint32_t sec = gw->retry_at - now;
+
+    return sec < UINT32_MAX / US_PER_SEC ? sec * US_PER_SEC : UINT32_MAX;
+}
+
+/*
+ * Gateway can be used -- configured, or discovered and not expired.
+ * If the current gateway expires, the preferred one becomes current,
+ * so that current always has a host.
+ */
+static int _usable(mqpub_gw_t *gw) {
+    if (gw->host == NULL)
+        return 0;
+    if (gw->expires != 0 && (int32_t) (_now_sec() - gw->expires) >= 0) {
+        printf("mqpub: discovered gateway [%s]:%u expired\n", gw->host, gw->port);
+        gw->host = NULL;
+        if (gw == current)
+            current = &gateways[0];
+        return 0;
+    }
+    return 1;
+}
+
+static void _init(void) {
+    uint8_t i;
+
+    for (i = 0; i < NUM_GATEWAYS; i++) {
+        gateways[i].host = gw_addrs[i].host;
+        gateways[i].port = gw_addrs[i].port;
+    }
+    current = &gateways[0];
+}
+
+static uint32_t _score(const mqpub_gw_t *gw) {
+    /* Unknown connect time scores best, so that the gateway is tried */
+    return gw->srtt + (uint32_t) gw->failures * MQPUB_GW_FAIL_PENALTY_MS;
+}
+
+mqpub_gw_t *mqpub_gw_select(uint32_t *waitp) {
+    uint32_t now = _now_sec();
+    uint32_t wait = UINT32_MAX;
+    mqpub_gw_t *gw, *best = NULL;
+
+    if (current == NULL)
+        _init();
+    if (current != &gateways[0] && !_backed_off(&gateways[0], now) &&
+        now - last_probe >= MQPUB_GW_REPROBE_SEC) {
+        /* Time to see if the preferred gateway is back */
+        best = &gateways[0];
+    }
+    else {
+        for (gw = gateways; gw < &gateways[NUM_GATEWAYS + NUM_DISCOVERED]; gw++) {
+            if (!_usable(gw))
+                continue;
+            if (_backed_off(gw, now)) {
+                if (_wait_usec(gw, now) < wait)
+                    wait = _wait_usec(gw, now);
+                continue;
+            }
+            /* Ties go to the earlier one in the list */
+            if (best == NULL || _score(gw) < _score(best))
+                best = gw;
+        }
+    }
+    if (best == NULL) {
+        *waitp = wait;
+        return NULL;
+    }
+    if (best == &gateways[0])
+        last_probe = now;
+    current = best;
+    return best;
+}
+
+mqpub_gw_t *mqpub_gw_current(void) {
+    if (current == NULL)
+        _init();
+    return current;
+}
+
+void mqpub_gw_result(mqpub_gw_t *gw, int ok, uint32_t usec) {
+    if (ok) {
+        gw->failures = 0;
+        gw->ok++;
+        if (usec > 0) {
+            uint32_t ms = usec / US_PER_MS;
+            /* Smoothed as in TCP, with gain 1/8 */
+            gw->srtt = gw->srtt == 0 ? ms : gw->srtt - gw->srtt/8 + ms/8;
+        }
+        /* Count changes of gateway, not connects */
+        if (gw != (connected != NULL ? connected : &gateways[0]))
+            mqttsn_stats.failover += 1;
+        connected = gw;
+    }
+    else {
+        uint32_t now = _now_sec();
+        uint32_t backoff = MQPUB_BACKOFF_MIN;
+
+        gw->fail++;
+        if (gw->failures < UINT8_MAX)
+            gw->failures++;
+        /* Exponential, with jitter in the upper half */
+        for (uint8_t i = 1; i < gw->failures && backoff < MQPUB_BACKOFF_MAX; i++)
+            backoff *= 2;
+        if (backoff > MQPUB_BACKOFF_MAX)
+            backoff = MQPUB_BACKOFF_MAX;
+        gw->retry_at = now + backoff/2 + random_uint32_range(0, backoff/2 + 1);
+        printf("mqpub: gateway [%s]:%u failed %u times, back off %" PRIu32 " sec\n",
+               gw->host, gw->port, gw->failures, gw->retry_at - now);
+    }
+}
+
+#ifdef MQPUB_DISCOVERY
+void mqpub_gw_discovered(const ipv6_addr_t *addr, uint16_t port, uint8_t gwid,
+                         uint32_t rtt_ms, uint32_t ttl_sec) {
+    char host[IPV6_ADDR_MAX_STR_LEN];
+    mqpub_gw_t *gw, *slot = NULL;
+
+    if (current == NULL)
+        _init();
+    ipv6_addr_to_str(host, addr, sizeof(host));
+    for (gw = &gateways[NUM_GATEWAYS]; gw < &gateways[NUM_GATEWAYS + NUM_DISCOVERED]; gw++) {
+        if (gw->host != NULL && strcmp(gw->host, host) == 0 && gw->port == port) {
+            slot = gw;
+            break;
+        }
+        /* Else a free place, or the one that expires first -- but not the one in use */
+        if (gw == current)
+            continue;
+        if (slot == NULL ||
+            (slot->host != NULL && (gw->host == NULL || (int32_t) (gw->expires - slot->expires) < 0)))
+            slot = gw;
+    }
+    if (slot == NULL)
+        return;
+    if (slot->host == NULL || strcmp(slot->host, host) != 0 || slot->port != port) {
+        char *buf = discovered_hosts[slot - &gateways[NUM_GATEWAYS]];
+
+        memset(slot, 0, sizeof(*slot));
+        strcpy(buf, host);
+        slot->host = buf;
+        slot->port = port;
+        printf("mqpub: discovered gateway %u at [%s]:%u\n", gwid, host, port);
+    }
+    slot->gwid = gwid;
+    if (rtt_ms > 0)
+        slot->srtt = slot->srtt == 0 ? rtt_ms : slot->srtt - slot->srtt/8 + rtt_ms/8;
+    slot->expires = _now_sec() + ttl_sec;
+    if (slot->expires == 0)
+        slot->expires = 1;
+}
+#endif /* MQPUB_DISCOVERY */
+
+int mqpub_gw_reprobe_due(void) {
+    return current != NULL && current != &gateways[0] &&
+        _now_sec() - last_probe >= MQPUB_GW_REPROBE_SEC;
+}
+
+uint32_t mqpub_gw_next_retry(void) {
+    uint32_t now = _now_sec();
+    uint32_t wait = UINT32_MAX;
+    mqpub_gw_t *gw;
+
+    if (current == NULL)
+        _init();
+    for (gw = gateways; gw < &gateways[NUM_GATEWAYS + NUM_DISCOVERED]; gw++) {
+        if (!_usable(gw))
+            continue;
+        if (!_backed_off(gw, now))
+            return 0;
+        if (_wait_usec(gw, now) < wait)
+            wait = _wait_usec(gw, now);
+    }
+    return wait;
+}
+
+void mqpub_gw_print(void) {
+    uint32_t now = _now_sec();
+    mqpub_gw_t *gw;
+
+    if (current == NULL)
+        _init();
+    for (gw = gateways; gw < &gateways[NUM_GATEWAYS + NUM_DISCOVERED]; gw++) {
+        if (gw->host == NULL)
+            continue;
+        printf("  %cgateway [%s]:%u: ok %u, fail %u, failures %u, srtt %" PRIu32 " ms",
+               gw == current ? '*' : ' ', gw->host, gw->port, gw->ok, gw->fail,
+               gw->failures, gw->srtt);
+        if (_backed_off(gw, now))
+            printf(", retry in %" PRIu32 " sec", gw->retry_at - now);
+        if (gw->expires != 0)
+            printf(", discovered id %u, expires in %" PRIu32 " sec", gw->gwid, gw->expires - now);
+        printf("\n");
+    }
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * MQTT-SN gateways. The publisher connects to the best-scoring
+ * gateway in a list, where the first one is preferred. A gateway that
+ * fails is backed off exponentially, with random jitter. A gateway
+ * that responds slowly, or has failed recently, scores worse. When
+ * connected to another gateway, the preferred one is probed again
+ * every MQPUB_GW_REPROBE_SEC.
+ */
+
+#ifndef MQPUB_GATEWAY_H
+#define MQPUB_GATEWAY_H
+
+#include <stdint.h>
+
+#ifdef MQPUB_DISCOVERY
+#include "net/ipv6/addr.h"
+#endif /* MQPUB_DISCOVERY */
+
+/*
+ * Gateway list, as initializers {"host", port}, separated by commas.
+ * The default is the single gateway MQTTSN_GATEWAY_HOST.
+ */
+#ifndef MQTTSN_GATEWAYS
+#define MQTTSN_GATEWAYS { MQTTSN_GATEWAY_HOST, MQTTSN_GATEWAY_PORT }
+#endif /* MQTTSN_GATEWAYS */
+
+/* Backoff after first failure, and max backoff, in seconds */
+#ifndef MQPUB_BACKOFF_MIN
+#define MQPUB_BACKOFF_MIN 2
+#endif /* MQPUB_BACKOFF_MIN */
+#ifndef MQPUB_BACKOFF_MAX
+#define MQPUB_BACKOFF_MAX 300
+#endif /* MQPUB_BACKOFF_MAX */
+
+/* Score penalty for each consecutive failure, in msec of connect time */
+#ifndef MQPUB_GW_FAIL_PENALTY_MS
+#define MQPUB_GW_FAIL_PENALTY_MS 5000
+#endif /* MQPUB_GW_FAIL_PENALTY_MS */
+
+/* Interval for probing the preferred gateway, when not using it */
+#ifndef MQPUB_GW_REPROBE_SEC
+#define MQPUB_GW_REPROBE_SEC 1800
+#endif /* MQPUB_GW_REPROBE_SEC */
+
+typedef struct {
+    char *host;
+    uint16_t port;
+    uint8_t failures;           /* Consecutive failures */
+    uint16_t ok;                /* Successful connects */
+    uint16_t fail;              /* Failed connects and publishes */
+    uint32_t srtt;              /* Smoothed connect time, msec. 0 if unknown */
+    uint32_t retry_at;          /* Backed off until, sec, if failures > 0 */
+    uint32_t expires;           /* Discovered gateway: forgotten at, sec. 0 if configured */
+    uint8_t gwid;               /* Discovered gateway: gateway ID */
+} mqpub_gw_t;
+
+/*
+ * Select gateway for next connect. Return NULL if all gateways are
+ * backed off, with the time until the first one can be tried in
+ * *waitp (usec).
+ */
+mqpub_gw_t *mqpub_gw_select(uint32_t *waitp);
+/*
+ * Gateway selected last
+ */
+mqpub_gw_t *mqpub_gw_current(void);
+/*
+ * Result of connect, or of a publish (usec 0)
+ */
+void mqpub_gw_result(mqpub_gw_t *gw, int ok, uint32_t usec);
+/*
+ * Connected to another than the preferred gateway, and it is time
+ * to try the preferred one again
+ */
+int mqpub_gw_reprobe_due(void);
+/*
+ * Time until a gateway can be tried (usec), 0 if one can be tried now
+ */
+uint32_t mqpub_gw_next_retry(void);
+#ifdef MQPUB_DISCOVERY
+/*
+ * Gateway found through ADVERTISE or GWINFO. It is used like the
+ * configured ones, until it has not been heard from in ttl_sec. rtt_ms
+ * is 0 if unknown.
+ */
+void mqpub_gw_discovered(const ipv6_addr_t *addr, uint16_t port, uint8_t gwid,
+                         uint32_t rtt_ms, uint32_t ttl_sec);
+#endif /* MQPUB_DISCOVERY */
+void mqpub_gw_print(void);
+
+#endif /* MQPUB_GATEWAY_H */
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MQPUB_LATENCY
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "timex.h"
+
+#include "report.h"
+#include "mqpub_latency.h"
+
+#if MQPUB_LAT_BUCKETS < 2
+#error "MQPUB_LAT_BUCKETS must be at least 2"
+#endif
+
+mqpub_lat_hist_t mqpub_lat_hist[MQPUB_LAT_NUMOF];
+
+static const char *const names[MQPUB_LAT_NUMOF] = {
+    "dns", "connect", "register", "publish", "disconnect", "cycle"
+};
+
+const char *mqpub_lat_name(mqpub_lat_phase_t phase) {
+    return names[phase];
+}
+
+/*
+ * Upper bound of bucket, msec
+ */
+static inline uint32_t _bound(uint8_t bucket) {
+    return (uint32_t) MQPUB_LAT_MIN_MS << (MQPUB_LAT_SHIFT * bucket);
+}
+
+void mqpub_lat_add(mqpub_lat_phase_t phase, uint32_t usec) {
+    mqpub_lat_hist_t *h = &mqpub_lat_hist[phase];
+    uint32_t ms = usec / US_PER_MS;
+    uint8_t b;
+
+    /* Shifts only -- no division on the AVR */
+    for (b = 0; b < MQPUB_LAT_BUCKETS - 1 && ms >= _bound(b); b++)
+        ;
+    h->count[b]++;
+    h->n++;
+    if (ms > h->max_ms)
+        h->max_ms = ms;
+}
+
+size_t mqpub_lat_bucket_name(char *buf, uint8_t bucket) {
+    if (bucket < MQPUB_LAT_BUCKETS - 1) {
+        strcpy(buf, "lt");
+        return 2 + report_utoa(buf + 2, _bound(bucket));
+    }
+    strcpy(buf, "ge");
+    return 2 + report_utoa(buf + 2, _bound(MQPUB_LAT_BUCKETS - 2));
+}
+
+void mqpub_lat_print(void) {
+    char name[MQPUB_LAT_NAMELEN];
+    uint8_t p, b;
+
+    printf("  %-15s %8s:", "latency (ms)", "n");
+    for (b = 0; b < MQPUB_LAT_BUCKETS; b++) {
+        mqpub_lat_bucket_name(name, b);
+        printf(" %7s", name);
+    }
+    printf(" %7s\n", "max");
+    for (p = 0; p < MQPUB_LAT_NUMOF; p++) {
+        mqpub_lat_hist_t *h = &mqpub_lat_hist[p];
+
+        printf("    %-13s %8" PRIu32 ":", names[p], h->n);
+        for (b = 0; b < MQPUB_LAT_BUCKETS; b++)
+            printf(" %7" PRIu32, h->count[b]);
+        printf(" %7" PRIu32 "\n", h->max_ms);
+    }
+}
+
+#endif /* MQPUB_LATENCY */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Latency histograms for the phases of a publish cycle: DNS lookup,
+ * CONNECT, REGISTER, PUBLISH to PUBACK, DISCONNECT, and the whole
+ * cycle. Buckets are fixed and log-scale: the first holds times below
+ * MQPUB_LAT_MIN_MS, and each following bucket is 2^MQPUB_LAT_SHIFT
+ * times wider than the one before. The last bucket has no upper
+ * bound. Only successful operations are counted -- failures are
+ * counted in mqttsn_stats.
+ *
+ * Enabled with MQPUB_LATENCY.
+ */
+
+#ifndef MQPUB_LATENCY_H
+#define MQPUB_LATENCY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Buckets per histogram. The bound of the last bucket,
+ * MQPUB_LAT_MIN_MS << (MQPUB_LAT_SHIFT * (MQPUB_LAT_BUCKETS - 2)),
+ * must fit in 32 bits.
+ */
+#ifndef MQPUB_LAT_BUCKETS
+#define MQPUB_LAT_BUCKETS 8
+#endif /* MQPUB_LAT_BUCKETS */
+
+/* Upper bound of first bucket, msec */
+#ifndef MQPUB_LAT_MIN_MS
+#define MQPUB_LAT_MIN_MS 16
+#endif /* MQPUB_LAT_MIN_MS */
+
+/* Log2 of ratio between bucket bounds */
+#ifndef MQPUB_LAT_SHIFT
+#define MQPUB_LAT_SHIFT 2
+#endif /* MQPUB_LAT_SHIFT */
+
+typedef enum {
+    MQPUB_LAT_DNS,
+    MQPUB_LAT_CONNECT,
+    MQPUB_LAT_REGISTER,
+    MQPUB_LAT_PUBLISH,          /* QoS 1, until PUBACK */
+    MQPUB_LAT_DISCONNECT,
+    MQPUB_LAT_CYCLE,            /* Start of cycle until all is published */
+    MQPUB_LAT_NUMOF
+} mqpub_lat_phase_t;
+
+typedef struct {
+    uint32_t n;                 /* Samples */
+    uint32_t max_ms;            /* Longest time, msec */
+    uint32_t count[MQPUB_LAT_BUCKETS];
+} mqpub_lat_hist_t;
+
+extern mqpub_lat_hist_t mqpub_lat_hist[MQPUB_LAT_NUMOF];
+
+/*
+ * Add time for phase, usec
+ */
+void mqpub_lat_add(mqpub_lat_phase_t phase, uint32_t usec);
+/*
+ * Name of phase
+ */
+const char *mqpub_lat_name(mqpub_lat_phase_t phase);
+/*
+ * Name of bucket -- "lt" and upper bound, or "ge" and lower bound
+ * for the last one. buf must have room for MQPUB_LAT_NAMELEN chars.
+ */
+#define MQPUB_LAT_NAMELEN sizeof("lt4294967295")
+size_t mqpub_lat_bucket_name(char *buf, uint8_t bucket);
+/*
+ * Print histograms
+ */
+void mqpub_lat_print(void);
+
+#endif /* MQPUB_LATENCY_H */
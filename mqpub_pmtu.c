@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MQPUB_PMTU
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "irq.h"
+#include "xtimer.h"
+
+#include "mqpub_pmtu.h"
+
+#if MQPUB_PMTU_BASE >= MQTTSN_BUFFER_SIZE
+#error "MQPUB_PMTU_BASE must be less than MQTTSN_BUFFER_SIZE"
+#endif
+
+/*
+ * Search state. lo is the largest size known to get through, and is
+ * the limit once known is set -- by a probe larger than the base
+ * size, a finished search, or failed publishes. Until then, there is
+ * no limit. hi is the smallest size known not to get through, or one
+ * more than the buffer size.
+ */
+static uint16_t lo = MQPUB_PMTU_BASE;
+static uint16_t hi = MQTTSN_BUFFER_SIZE + 1;
+static uint8_t known;
+static uint8_t searching = 1;
+static uint8_t fails;
+/* Time for next search, sec */
+static uint32_t raise_at;
+
+mqpub_pmtu_stats_t mqpub_pmtu_stats;
+
+static inline uint32_t _now_sec(void) {
+    return (uint32_t) (xtimer_now_usec64() / US_PER_SEC);
+}
+
+size_t mqpub_pmtu_limit(void) {
+    /* Read from the report thread too */
+    unsigned state = irq_disable();
+    size_t limit = known ? lo : MQTTSN_BUFFER_SIZE;
+
+    irq_restore(state);
+    return limit;
+}
+
+static void _set_lo(uint16_t size) {
+    unsigned state = irq_disable();
+
+    lo = size;
+    known = 1;
+    irq_restore(state);
+}
+
+size_t mqpub_pmtu_probe_size(void) {
+    if (!searching) {
+        if ((int32_t) (_now_sec() - raise_at) < 0 || lo >= MQTTSN_BUFFER_SIZE)
+            return 0;
+        /* Path may have changed -- measure the base round-trip
+         * time again, and look for a larger limit
+         */
+        searching = 1;
+        hi = MQTTSN_BUFFER_SIZE + 1;
+        mqpub_pmtu_stats.base_rtt = 0;
+    }
+    if (mqpub_pmtu_stats.base_rtt == 0)
+        return MQPUB_PMTU_BASE;
+    if (hi - lo > MQPUB_PMTU_STEP)
+        return (lo + hi) / 2;
+    searching = 0;
+    /* Nothing larger gets through */
+    _set_lo(lo);
+    mqpub_pmtu_stats.searches++;
+    raise_at = _now_sec() + MQPUB_PMTU_RAISE_SEC;
+    printf("mqpub: payload limit %u bytes\n", lo);
+    return 0;
+}
+
+void mqpub_pmtu_probe_fill(uint8_t *buf, size_t len) {
+    char *s = (char *) buf;
+    size_t n;
+
+    /* Valid JSON, padded with white space */
+    n = snprintf(s, len, "[{\"n\":\"pmtu;probe\",\"v\":%u}]", (unsigned) len);
+    if (n < len)
+        memset(s + n, ' ', len - n);
+}
+
+void mqpub_pmtu_probe_result(size_t len, int ok, uint32_t usec) {
+    mqpub_pmtu_stats_t *st = &mqpub_pmtu_stats;
+    uint32_t ms = usec / US_PER_MS;
+
+    st->probes++;
+    if (!ok) {
+        st->lost++;
+        if (len > MQPUB_PMTU_BASE)
+            hi = len;
+        return;
+    }
+    if (len <= MQPUB_PMTU_BASE) {
+        st->base_rtt = ms > 0 ? ms : 1;
+        return;
+    }
+    if (ms > st->base_rtt * MQPUB_PMTU_RTT_FACTOR + MQPUB_PMTU_RTT_SLACK_MS) {
+        st->slow++;
+        hi = len;
+    }
+    else if (len > lo)
+        _set_lo(len);
+}
+
+void mqpub_pmtu_publish_result(size_t len, int ok) {
+    if (ok || len <= MQPUB_PMTU_BASE) {
+        fails = 0;
+        return;
+    }
+    if (++fails < MQPUB_PMTU_MAX_FAILS)
+        return;
+    /* Large payloads do not get through -- start over from base size */
+    fails = 0;
+    mqpub_pmtu_stats.blackhole++;
+    hi = len;
+    _set_lo(MQPUB_PMTU_BASE);
+    searching = 1;
+    mqpub_pmtu_stats.base_rtt = 0;
+    printf("mqpub: payload limit dropped to %u bytes\n", MQPUB_PMTU_BASE);
+}
+
+#endif /* MQPUB_PMTU */
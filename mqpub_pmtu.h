@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Payload size limit. The largest payload that gets through to the
+ * gateway, without loss and without fragmentation, is searched for
+ * with QoS 1 probe publishes of different sizes, in the manner of
+ * packetization layer path MTU discovery (RFC 8899). A probe that is
+ * not acknowledged, or takes much longer than a small one -- as when
+ * the packet is split into 6LoWPAN fragments -- is too large.
+ * Reports are built to fit the limit.
+ *
+ * Enabled with MQPUB_PMTU.
+ */
+
+#ifndef MQPUB_PMTU_H
+#define MQPUB_PMTU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mqttsn_publisher.h"
+
+#ifdef MQPUB_WINDOW
+/* Probes need the PUBACK before the next message */
+#error "MQPUB_PMTU cannot be used with MQPUB_WINDOW"
+#endif /* MQPUB_WINDOW */
+
+/* Payload size that is assumed to always get through */
+#ifndef MQPUB_PMTU_BASE
+#define MQPUB_PMTU_BASE 64
+#endif /* MQPUB_PMTU_BASE */
+
+/* Search resolution, bytes */
+#ifndef MQPUB_PMTU_STEP
+#define MQPUB_PMTU_STEP 8
+#endif /* MQPUB_PMTU_STEP */
+
+/*
+ * A probe is too large if its round-trip time is more than
+ * MQPUB_PMTU_RTT_FACTOR times that of a base size probe, plus
+ * MQPUB_PMTU_RTT_SLACK_MS
+ */
+#ifndef MQPUB_PMTU_RTT_FACTOR
+#define MQPUB_PMTU_RTT_FACTOR 2
+#endif /* MQPUB_PMTU_RTT_FACTOR */
+#ifndef MQPUB_PMTU_RTT_SLACK_MS
+#define MQPUB_PMTU_RTT_SLACK_MS 50
+#endif /* MQPUB_PMTU_RTT_SLACK_MS */
+
+/* Max probes in a publish cycle */
+#ifndef MQPUB_PMTU_PROBES
+#define MQPUB_PMTU_PROBES 6
+#endif /* MQPUB_PMTU_PROBES */
+
+/* Interval for searching for a larger limit, sec */
+#ifndef MQPUB_PMTU_RAISE_SEC
+#define MQPUB_PMTU_RAISE_SEC 3600
+#endif /* MQPUB_PMTU_RAISE_SEC */
+
+/* Consecutive failed publishes above base size before the limit is dropped */
+#ifndef MQPUB_PMTU_MAX_FAILS
+#define MQPUB_PMTU_MAX_FAILS 2
+#endif /* MQPUB_PMTU_MAX_FAILS */
+
+/* Last part of probe topic */
+#ifndef MQPUB_PMTU_TOPIC
+#define MQPUB_PMTU_TOPIC "pmtu"
+#endif /* MQPUB_PMTU_TOPIC */
+
+typedef struct {
+    uint16_t probes;            /* Probes sent */
+    uint16_t lost;              /* Probes not acknowledged */
+    uint16_t slow;              /* Probes too slow -- fragmented */
+    uint16_t searches;          /* Searches completed */
+    uint16_t blackhole;         /* Limit dropped after failed publishes */
+    uint32_t base_rtt;          /* Round-trip time of base size probe, msec */
+} mqpub_pmtu_stats_t;
+
+extern mqpub_pmtu_stats_t mqpub_pmtu_stats;
+
+/*
+ * Current payload size limit. MQTTSN_BUFFER_SIZE until the search
+ * has found a limit.
+ */
+size_t mqpub_pmtu_limit(void);
+/*
+ * Size of next probe, or 0 if no probe is due
+ */
+size_t mqpub_pmtu_probe_size(void);
+/*
+ * Fill buf with a probe payload of len bytes
+ */
+void mqpub_pmtu_probe_fill(uint8_t *buf, size_t len);
+/*
+ * Result of probe, with round-trip time
+ */
+void mqpub_pmtu_probe_result(size_t len, int ok, uint32_t usec);
+/*
+ * Result of QoS 1 publish of a report
+ */
+void mqpub_pmtu_publish_result(size_t len, int ok);
+
+#endif /* MQPUB_PMTU_H */
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mqpub_topics.h"
+
+#if (MQPUB_TOPIC_BUCKETS & (MQPUB_TOPIC_BUCKETS - 1)) != 0
+#error "MQPUB_TOPIC_BUCKETS must be a power of two"
+#endif
+
+static mqpub_topic_t topics[MQTTSN_MAX_TOPICS];
+/* First topic in each hash chain, index + 1 */
+static uint8_t buckets[MQPUB_TOPIC_BUCKETS];
+static char arena[MQPUB_TOPIC_ARENA_SIZE];
+/* Topics in use, most recently used first -- indexes */
+static uint8_t lru[MQTTSN_MAX_TOPICS];
+/* Current gateway session, never 0 */
+static uint8_t session = 1;
+
+mqpub_topics_stats_t mqpub_topics_stats;
+
+/*
+ * FNV-1a
+ */
+static unsigned _hash(const char *topicstr) {
+    uint32_t h = 2166136261U;
+
+    while (*topicstr)
+        h = (h ^ (uint8_t) *topicstr++) * 16777619U;
+    return (unsigned) (h & (MQPUB_TOPIC_BUCKETS - 1));
+}
+
+/*
+ * Topic at position pos in the LRU list was used -- move it first
+ */
+static void _touch(uint8_t pos) {
+    uint8_t i = lru[pos];
+
+    memmove(&lru[1], &lru[0], pos);
+    lru[0] = i;
+}
+
+static mqpub_topic_t *_find(const char *topicstr, unsigned h, uint8_t *chainp) {
+    uint8_t i, pos, chain = 1;
+
+    for (i = buckets[h]; i != 0; i = topics[i - 1].next, chain++) {
+        if (strcmp(topics[i - 1].topic.name, topicstr) == 0) {
+            for (pos = 0; lru[pos] != i - 1; pos++)
+                ;
+            _touch(pos);
+            return &topics[i - 1];
+        }
+    }
+    if (chainp != NULL)
+        *chainp = chain;
+    return NULL;
+}
+
+mqpub_topic_t *mqpub_topic_lookup(const char *topicstr) {
+    return _find(topicstr, _hash(topicstr), NULL);
+}
+
+/*
+ * First fit in the arena, between the strings of the topics in use.
+ * Strings are never moved, so names stay valid while their topic is
+ * in the registry.
+ */
+static char *_alloc(size_t len) {
+    char *end = &arena[sizeof(arena)];
+    char *p = arena;
+
+    while (1) {
+        char *next = end;
+        uint8_t pos;
+
+        for (pos = 0; pos < mqpub_topics_stats.count; pos++) {
+            char *name = (char *) topics[lru[pos]].topic.name;
+
+            if (name >= p && name < next)
+                next = name;
+        }
+        if ((size_t) (next - p) >= len)
+            return p;
+        if (next == end)
+            return NULL;
+        p = next + strlen(next) + 1;
+    }
+}
+
+/*
+ * Evict the least recently used topic that can be registered again
+ * -- predefined topic IDs are configured, and stay. Return 0 if there
+ * is none.
+ */
+static int _evict(void) {
+    mqpub_topics_stats_t *st = &mqpub_topics_stats;
+    uint8_t pos, i = 0, *ip;
+
+    for (pos = st->count; pos > 0; pos--) {
+        i = lru[pos - 1];
+        if ((topics[i].flags & EMCUTE_TIT_MASK) != EMCUTE_TIT_PREDEF)
+            break;
+    }
+    if (pos == 0)
+        return 0;
+    for (ip = &buckets[_hash(topics[i].topic.name)]; *ip != i + 1; ip = &topics[*ip - 1].next)
+        ;
+    *ip = topics[i].next;
+    st->bytes -= strlen(topics[i].topic.name) + 1;
+    topics[i].topic.name = NULL;
+    /* Last in use, so that it is reused first */
+    memmove(&lru[pos - 1], &lru[pos], st->count - pos);
+    lru[--st->count] = i;
+    st->evicted++;
+    return 1;
+}
+
+mqpub_topic_t *mqpub_topic_intern(const char *topicstr) {
+    mqpub_topics_stats_t *st = &mqpub_topics_stats;
+    unsigned h = _hash(topicstr);
+    size_t len = strlen(topicstr) + 1;
+    mqpub_topic_t *tp;
+    char *name = NULL;
+    uint8_t i, chain;
+
+    if ((tp = _find(topicstr, h, &chain)) != NULL)
+        return tp;
+    if (len > sizeof(arena)) {
+        /* Would never fit -- keep what is there */
+        st->full++;
+        return NULL;
+    }
+    if (st->count == 0)
+        /* First use -- all places free */
+        for (i = 0; i < MQTTSN_MAX_TOPICS; i++)
+            lru[i] = i;
+    while (st->count >= MQTTSN_MAX_TOPICS || (name = _alloc(len)) == NULL) {
+        if (!_evict()) {
+            st->full++;
+            return NULL;
+        }
+    }
+    /* A free place follows the ones in use */
+    i = lru[st->count];
+    tp = &topics[i];
+    memcpy(name, topicstr, len);
+    tp->topic.name = name;
+    tp->topic.id = 0;
+    tp->flags = EMCUTE_TIT_NORMAL;
+    tp->session = 0;
+    tp->next = buckets[h];
+    buckets[h] = i + 1;
+    st->count++;
+    _touch(st->count - 1);
+    st->bytes += len;
+    if (chain > st->maxchain)
+        st->maxchain = chain;
+    return tp;
+}
+
+void mqpub_topics_session(void) {
+    if (++session == 0) {
+        /* Wrapped -- old session numbers would become valid again */
+        uint8_t i;
+
+        for (i = 0; i < MQTTSN_MAX_TOPICS; i++)
+            topics[i].session = 0;
+        session = 1;
+    }
+}
+
+int mqpub_topic_valid(const mqpub_topic_t *tp) {
+    /* Predefined and short topic IDs are not registered, and stay */
+    return (tp->flags & EMCUTE_TIT_MASK) != EMCUTE_TIT_NORMAL || tp->session == session;
+}
+
+void mqpub_topic_registered(mqpub_topic_t *tp) {
+    tp->session = session;
+}
+
+size_t mqpub_topics_bytes(void) {
+    return sizeof(topics) + sizeof(buckets) + sizeof(arena) + sizeof(lru);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Topic registry. Topic strings are interned -- copied into a
+ * fixed arena -- so callers need not keep them, and looked up
+ * through a hash table. Each topic records the gateway session in
+ * which it was registered, so a new session forgets all topic IDs
+ * at once, without a scan.
+ *
+ * The registry is a cache: when there is no room for a topic, the
+ * least recently used ones are evicted, and registered again when
+ * they are next used. Topics with predefined IDs are not evicted.
+ * A topic pointer is valid until MQTTSN_MAX_TOPICS - 1 other topics
+ * have been used -- so the topics in the MQPUB_WINDOW stay.
+ */
+
+#ifndef MQPUB_TOPICS_H
+#define MQPUB_TOPICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "net/emcute.h"
+
+/* Max topics */
+#ifndef MQTTSN_MAX_TOPICS
+#define MQTTSN_MAX_TOPICS 8
+#endif /* MQTTSN_MAX_TOPICS */
+
+#if MQTTSN_MAX_TOPICS > 255
+#error "MQTTSN_MAX_TOPICS must be less than 256"
+#endif
+
+/* Bytes for interned topic strings, including NULs */
+#ifndef MQPUB_TOPIC_ARENA_SIZE
+#define MQPUB_TOPIC_ARENA_SIZE 256
+#endif /* MQPUB_TOPIC_ARENA_SIZE */
+
+/* Hash buckets -- power of two */
+#ifndef MQPUB_TOPIC_BUCKETS
+#define MQPUB_TOPIC_BUCKETS 8
+#endif /* MQPUB_TOPIC_BUCKETS */
+
+/*
+ * Topic, with the type of its topic ID (EMCUTE_TIT_NORMAL for
+ * registered, EMCUTE_TIT_PREDEF or EMCUTE_TIT_SHORT)
+ */
+typedef struct {
+    emcute_topic_t topic;
+    uint8_t flags;
+    uint8_t session;            /* Session where registered, 0 if none */
+    uint8_t next;               /* Next in hash chain, index + 1 */
+} mqpub_topic_t;
+
+typedef struct {
+    uint8_t count;              /* Topics in registry */
+    uint8_t maxchain;           /* Longest hash chain */
+    uint16_t bytes;             /* Arena bytes used */
+    uint16_t evicted;           /* Topics evicted to make room */
+    uint16_t full;              /* Topics not added -- no room even after eviction */
+} mqpub_topics_stats_t;
+
+extern mqpub_topics_stats_t mqpub_topics_stats;
+
+/*
+ * Find topic. Return NULL if not in registry.
+ */
+mqpub_topic_t *mqpub_topic_lookup(const char *topicstr);
+/*
+ * Find topic, or add it with a copy of topicstr, evicting least
+ * recently used topics if needed. Return NULL if there is no room
+ * even so -- the string is longer than the arena, or all topics
+ * are predefined.
+ */
+mqpub_topic_t *mqpub_topic_intern(const char *topicstr);
+/*
+ * New gateway session -- registered topic IDs are no longer valid
+ */
+void mqpub_topics_session(void);
+/*
+ * Topic has an ID that can be used in this session
+ */
+int mqpub_topic_valid(const mqpub_topic_t *tp);
+/*
+ * Topic has been registered in this session
+ */
+void mqpub_topic_registered(mqpub_topic_t *tp);
+/*
+ * Size of topic table -- entries, hash buckets and string arena
+ */
+size_t mqpub_topics_bytes(void);
+
+#endif /* MQPUB_TOPICS_H */
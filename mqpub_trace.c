@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MQPUB_TRACE
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "irq.h"
+#include "timex.h"
+
+#include "report.h"
+#include "mqpub_trace.h"
+
+#ifdef BOARD_AVR_RSS2
+#include "pstr_print.h"
+#endif
+
+mqpub_trace_t mqpub_trace_ring[MQPUB_TRACE_SIZE];
+uint32_t mqpub_trace_count;
+
+static const char *const names[MQPUB_TR_NUMOF] = {
+    "cycle", "state", "con", "reg", "pub", "sub", "discon", "dns", "sim7020", "watchdog", "sleep", "ping"
+};
+
+/* Events before this have been delivered -- committed on PUBACK */
+static report_delta_t reported;
+
+static report_sched_t trace_sched;
+
+/*
+ * Copy event seq. Return 0 if it has been overwritten.
+ */
+static int _get(uint32_t seq, mqpub_trace_t *e) {
+    unsigned state = irq_disable();
+    int ok = mqpub_trace_count - seq <= MQPUB_TRACE_SIZE;
+
+    if (ok)
+        *e = mqpub_trace_ring[seq & (MQPUB_TRACE_SIZE - 1)];
+    irq_restore(state);
+    return ok;
+}
+
+static size_t _varint(uint8_t *buf, uint32_t v) {
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        buf[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = v;
+    return n;
+}
+
+/* Longest encoded event -- code, argument and time */
+#define EV_MAXLEN (1 + 3 + 5)
+
+static char hexbuf[2 * MQPUB_TRACE_CHUNK * EV_MAXLEN + 1];
+
+/*
+ * Encode events from *seqp, up to end and at most max, as hex in
+ * hexbuf. Each event is its code, the argument as a zigzag varint,
+ * and msec since the previous event as a varint. Events that have
+ * been overwritten are counted in *lostp. Time of first event, msec,
+ * in *msp.
+ */
+static void _encode(uint32_t *seqp, uint32_t end, uint8_t max, uint32_t *lostp, uint32_t *msp) {
+    uint32_t seq = *seqp, prev = 0;
+    size_t h = 0;
+    uint8_t n = 0;
+
+    *lostp = 0;
+    *msp = 0;
+    if (end - seq > MQPUB_TRACE_SIZE) {
+        *lostp = end - seq - MQPUB_TRACE_SIZE;
+        seq = end - MQPUB_TRACE_SIZE;
+    }
+    while (seq != end && n < max) {
+        uint8_t b[EV_MAXLEN];
+        mqpub_trace_t e;
+        uint32_t ms;
+        size_t k;
+
+        if (!_get(seq++, &e)) {
+            *lostp += 1;
+            continue;
+        }
+        if (n++ == 0) {
+            *msp = e.usec / US_PER_MS;
+            prev = e.usec - e.usec % US_PER_MS;
+        }
+        /* Round down, and carry the rest to the next event */
+        ms = (e.usec - prev) / US_PER_MS;
+        prev += ms * US_PER_MS;
+        b[0] = e.ev;
+        k = 1 + _varint(&b[1], (uint16_t) (((uint16_t) e.arg << 1) ^ (uint16_t) (e.arg >> 15)));
+        k += _varint(&b[k], ms);
+        h += report_hex(&hexbuf[h], b, k);
+    }
+    hexbuf[h] = '\0';
+    *seqp = seq;
+}
+
+/*
+ * Record with the events in hexbuf. Return its length, or 0 if it
+ * does not fit.
+ */
+static int _record(char *s, size_t l, uint32_t seq, uint32_t lost, uint32_t ms) {
+    int nread = 0;
+
+    RECORD_START(s + nread, l - nread);
+    PUTGROUP("mqtt_sn;trace;");
+    PUTCOUNT("seq", seq);
+    PUTMEAS("time", "msec", ms);
+    if (lost > 0) {
+        PUTCOUNT("lost", lost);
+    }
+    PUTNAME("ev");
+    PUTKEY(SENML_VS);
+    PUTSTR(hexbuf);
+    PUTCLOSE();
+    PUTGROUPEND();
+    RECORD_END(nread);
+    return nread;
+}
+
+int mqpub_trace_report(uint8_t *buf, size_t len, uint8_t *finished,
+                       __attribute__((unused)) char **topicp, __attribute__((unused)) char **basenamep) {
+    char *s = (char *) buf;
+    size_t l = len;
+    int nread = 0;
+    /* Events recorded while the report is built are left for the next one */
+    static uint32_t end;
+    /* Next event to report. Events are delivered when the payload is acknowledged. */
+    static uint32_t cur;
+    static uint8_t started;
+
+    *finished = 0;
+    if (!started) {
+        end = mqpub_trace_count;
+        cur = reported.acked;
+        started = 1;
+    }
+    while (cur != end) {
+        uint32_t next, lost, ms;
+        uint8_t max;
+        int n;
+
+        /* Fewer events per record, until it fits in what is left */
+        for (max = MQPUB_TRACE_CHUNK; ; max /= 2) {
+            next = cur;
+            _encode(&next, end, max, &lost, &ms);
+            if ((n = _record(s + nread, l - nread, cur + lost, lost, ms)) > 0 || max == 1)
+                break;
+        }
+        if (n == 0)
+            /* Continue in next payload */
+            return nread;
+        nread += n;
+        report_delta_add(&reported, next);
+        cur = next;
+    }
+    started = 0;
+    *finished = 1;
+
+    return nread;
+}
+
+void mqpub_trace_publish(void) {
+    report_sched_trigger(&trace_sched);
+}
+
+static void _print(void) {
+    uint32_t count = mqpub_trace_count, seq, prev = 0;
+
+    seq = count > MQPUB_TRACE_SIZE ? count - MQPUB_TRACE_SIZE : 0;
+    printf("%" PRIu32 " events, %" PRIu32 " unreported\n", count, count - reported.acked);
+    printf("  %14s %10s  %-8s %-3s %6s\n", "time (ms)", "+usec", "event", "", "arg");
+    for (; seq != count; seq++) {
+        mqpub_trace_t e;
+        uint8_t ev;
+
+        if (!_get(seq, &e))
+            continue;
+        ev = e.ev & ~MQPUB_TR_END;
+        printf("  %10" PRIu32 ".%03u %10" PRIu32 "  %-8s %-3s %6d\n",
+               e.usec / US_PER_MS, (unsigned) (e.usec % US_PER_MS), prev ? e.usec - prev : 0,
+               ev < MQPUB_TR_NUMOF ? names[ev] : "?", (e.ev & MQPUB_TR_END) ? "end" : "", e.arg);
+        prev = e.usec;
+    }
+}
+
+int mqpub_trace_cmd(int argc, char **argv) {
+    if (argc == 1) {
+        _print();
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        unsigned state = irq_disable();
+        mqpub_trace_count = 0;
+        reported.acked = 0;
+        irq_restore(state);
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "pub") == 0) {
+        mqpub_trace_publish();
+        return 0;
+    }
+    printf("Usage: %s [clear|pub]\n", argv[0]);
+    return 1;
+}
+
+void mqpub_trace_init(void) {
+    /* Trace from boot in the first cycle, then when asked for */
+    report_register(&trace_sched, mqpub_trace_report, "trace", REPORT_PERIOD_ONCE, 0, 3);
+    report_set_qos(&trace_sched, REPORT_QOS_1);
+}
+
+#endif /* MQPUB_TRACE */
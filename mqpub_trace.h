@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Event tracer. Timestamped binary events from the publisher --
+ * publish cycles, state machine, emcute calls, DNS lookups, SIM7020
+ * activation and watchdog updates -- in a fixed-size ring in RAM.
+ * Recording an event is a timer read and a few stores, so it can be
+ * left on where printf would change the timing. The ring is shown
+ * with the mqtrace command, and published in the "mqtt_sn;trace"
+ * report after a failed connection, or on demand.
+ *
+ * Enabled with MQPUB_TRACE. Without it, MQPUB_TRACE_EV() is empty.
+ */
+
+#ifndef MQPUB_TRACE_H
+#define MQPUB_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Events. Operations that can take long have a start event, and an
+ * end event with MQPUB_TR_END set in the event code. The argument of
+ * an end event is the result.
+ */
+typedef enum {
+    MQPUB_TR_CYCLE,             /* Publish cycle */
+    MQPUB_TR_STATE,             /* _publish_all() state, arg state */
+    MQPUB_TR_CON,               /* CONNECT, arg port */
+    MQPUB_TR_REG,               /* REGISTER */
+    MQPUB_TR_PUB,               /* PUBLISH, arg payload length */
+    MQPUB_TR_SUB,               /* SUBSCRIBE */
+    MQPUB_TR_DISCON,            /* DISCONNECT */
+    MQPUB_TR_DNS,               /* DNS lookup */
+    MQPUB_TR_SIM7020,           /* Modem seen active or not, arg 1 or 0 */
+    MQPUB_TR_WATCHDOG,          /* Watchdog update, arg progress */
+    MQPUB_TR_SLEEP,             /* DISCONNECT to sleep, arg duration */
+    MQPUB_TR_PING,              /* PINGREQ when asleep */
+    MQPUB_TR_NUMOF
+} mqpub_trace_ev_t;
+
+#define MQPUB_TR_END 0x80
+
+#ifdef MQPUB_TRACE
+
+#include "irq.h"
+#include "xtimer.h"
+
+/* Events in ring, a power of 2 */
+#ifndef MQPUB_TRACE_SIZE
+#define MQPUB_TRACE_SIZE 64
+#endif /* MQPUB_TRACE_SIZE */
+
+#if (MQPUB_TRACE_SIZE & (MQPUB_TRACE_SIZE - 1)) != 0
+#error "MQPUB_TRACE_SIZE must be a power of 2"
+#endif
+
+/* Max events per record in the trace report */
+#ifndef MQPUB_TRACE_CHUNK
+#define MQPUB_TRACE_CHUNK 16
+#endif /* MQPUB_TRACE_CHUNK */
+
+typedef struct {
+    uint32_t usec;              /* Time, xtimer_now_usec() */
+    int16_t arg;
+    uint8_t ev;
+} mqpub_trace_t;
+
+extern mqpub_trace_t mqpub_trace_ring[MQPUB_TRACE_SIZE];
+/* Events recorded. The newest is at (count - 1) modulo size. */
+extern uint32_t mqpub_trace_count;
+
+static inline void mqpub_trace(uint8_t ev, int16_t arg) {
+    uint32_t now = xtimer_now_usec();
+    unsigned state = irq_disable();
+    mqpub_trace_t *e = &mqpub_trace_ring[mqpub_trace_count++ & (MQPUB_TRACE_SIZE - 1)];
+
+    e->usec = now;
+    e->arg = arg;
+    e->ev = ev;
+    irq_restore(state);
+}
+
+#define MQPUB_TRACE_EV(EV, ARG) mqpub_trace((EV), (ARG))
+
+void mqpub_trace_init(void);
+/*
+ * Make the trace report due in the next publish cycle
+ */
+void mqpub_trace_publish(void);
+int mqpub_trace_cmd(int argc, char **argv);
+int mqpub_trace_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
+
+#else
+
+#define MQPUB_TRACE_EV(EV, ARG)
+
+#endif /* MQPUB_TRACE */
+
+#endif /* MQPUB_TRACE_H */
@@ -0,0 +1,567 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MQPUB_WINDOW
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "net/emcute.h"
+#include "net/sock/udp.h"
+#include "xtimer.h"
+
+#include "mqttsn_publisher.h"
+#include "mqpub_window.h"
+#ifdef MQPUB_LATENCY
+#include "mqpub_latency.h"
+#endif /* MQPUB_LATENCY */
+
+#if defined(CONFIG_EMCUTE_KEEPALIVE)
+#define WIN_KEEPALIVE CONFIG_EMCUTE_KEEPALIVE
+#define WIN_T_RETRY CONFIG_EMCUTE_T_RETRY
+#define WIN_N_RETRY CONFIG_EMCUTE_N_RETRY
+#else
+#define WIN_KEEPALIVE EMCUTE_KEEPALIVE
+#define WIN_T_RETRY EMCUTE_T_RETRY
+#define WIN_N_RETRY EMCUTE_N_RETRY
+#endif /* defined(CONFIG_EMCUTE_KEEPALIVE) */
+
+#define T_RETRY_USEC ((uint32_t) WIN_T_RETRY * US_PER_SEC)
+/* Long enough for all retransmissions of a message */
+#define T_WAIT_USEC ((uint32_t) (WIN_N_RETRY + 1) * T_RETRY_USEC)
+
+/* MQTT-SN message types */
+enum {
+    CONNECT    = 0x04,
+    CONNACK    = 0x05,
+    REGISTER   = 0x0a,
+    REGACK     = 0x0b,
+    PUBLISH    = 0x0c,
+    PUBACK     = 0x0d,
+    SUBSCRIBE  = 0x12,
+    SUBACK     = 0x13,
+    PINGREQ    = 0x16,
+    PINGRESP   = 0x17,
+    DISCONNECT = 0x18,
+};
+
+#define PROTOCOL_ID 0x01
+#define RC_ACCEPTED 0x00
+
+/*
+ * Message in flight. The payload is kept for retransmission.
+ */
+typedef struct {
+    const char *name;           /* Topic string */
+    uint16_t topic_id;
+    uint8_t flags;              /* PUBLISH flags, without DUP */
+    uint8_t retries;
+    uint8_t prio;               /* Passed back when dropped */
+    uint16_t msgid;             /* 0 for a free entry */
+    uint32_t seq;               /* Order of sending */
+    uint32_t first;             /* Time of first transmission, usec */
+    uint32_t sent;              /* Time of last (re)transmission, usec */
+    size_t len;
+    uint8_t data[MQTTSN_BUFFER_SIZE];
+} win_entry_t;
+
+static win_entry_t window[MQPUB_WINDOW_SIZE];
+static uint32_t next_seq;
+static uint16_t next_msgid;
+/* A PUBACK reported an error */
+static int win_error;
+
+static sock_udp_t sock;
+static uint8_t sock_open;
+/* DISCONNECT with a duration accepted -- session kept, not active */
+static uint8_t asleep;
+
+/* Room for the longest header -- 3-byte length, type, flags, topic and message ID */
+static uint8_t txbuf[MQTTSN_BUFFER_SIZE + 9];
+/* PUBLISH messages for subscriptions come in here too */
+static uint8_t rxbuf[MQTTSN_BUFFER_SIZE + 9];
+static size_t rxpos;            /* Start of message body in rxbuf */
+
+/* Subscriptions, linked through next */
+static emcute_sub_t *subs;
+
+mqpub_window_stats_t mqpub_window_stats;
+
+static uint16_t _msgid(void) {
+    if (++next_msgid == 0)
+        next_msgid = 1;
+    return next_msgid;
+}
+
+/*
+ * Write message header for a body of len bytes. Return header length.
+ */
+static size_t _hdr(uint8_t *buf, size_t len, uint8_t type) {
+    if (len + 2 > 0xff) {
+        len += 4;
+        buf[0] = 0x01;
+        buf[1] = len >> 8;
+        buf[2] = len & 0xff;
+        buf[3] = type;
+        return 4;
+    }
+    buf[0] = len + 2;
+    buf[1] = type;
+    return 2;
+}
+
+static int _send(const uint8_t *buf, size_t len) {
+    if (sock_udp_send(&sock, buf, len, NULL) < 0)
+        return EMCUTE_NOGW;
+    return EMCUTE_OK;
+}
+
+static int _send_publish(uint16_t topic_id, const void *data, size_t len, uint8_t flags, uint16_t msgid) {
+    size_t n = _hdr(txbuf, len + 5, PUBLISH);
+
+    txbuf[n++] = flags;
+    txbuf[n++] = topic_id >> 8;
+    txbuf[n++] = topic_id & 0xff;
+    txbuf[n++] = msgid >> 8;
+    txbuf[n++] = msgid & 0xff;
+    memcpy(&txbuf[n], data, len);
+    return _send(txbuf, n + len);
+}
+
+static uint16_t _rx_u16(size_t pos) {
+    return ((uint16_t) rxbuf[pos] << 8) | rxbuf[pos + 1];
+}
+
+static void _on_puback(void) {
+    uint16_t msgid = _rx_u16(rxpos + 2);
+    win_entry_t *e, *acked = NULL;
+    uint8_t oldest = 1;
+
+    for (e = window; e < &window[MQPUB_WINDOW_SIZE]; e++)
+        if (e->msgid == msgid)
+            acked = e;
+    if (acked == NULL)
+        /* Duplicate, or from an earlier session */
+        return;
+    for (e = window; e < &window[MQPUB_WINDOW_SIZE]; e++)
+        if (e->msgid != 0 && e->seq < acked->seq)
+            oldest = 0;
+    if (!oldest)
+        mqpub_window_stats.out_of_order++;
+    if (rxbuf[rxpos + 4] != RC_ACCEPTED) {
+        printf("mqpub_window: PUBACK %u rejected (%u)\n", msgid, rxbuf[rxpos + 4]);
+        win_error = EMCUTE_REJECT;
+        mqpub_window_stats.rejected++;
+    }
+    else {
+        mqpub_window_stats.acked++;
+        mqpub_window_stats.acked_bytes += acked->len;
+#ifdef MQPUB_LATENCY
+        /* Like emcute, from first PUBLISH, retransmissions included */
+        mqpub_lat_add(MQPUB_LAT_PUBLISH, xtimer_now_usec() - acked->first);
+#endif /* MQPUB_LATENCY */
+    }
+    acked->msgid = 0;
+    mqpub_window_stats.inflight--;
+}
+
+/*
+ * PUBLISH for a subscription. Pass it on, and acknowledge it if QoS 1.
+ */
+static void _on_publish(size_t n) {
+    uint8_t flags = rxbuf[rxpos];
+    uint16_t topic_id = _rx_u16(rxpos + 1);
+    uint16_t msgid = _rx_u16(rxpos + 3);
+    emcute_sub_t *sub;
+
+    for (sub = subs; sub != NULL; sub = sub->next) {
+        if (sub->topic.id == topic_id) {
+            sub->cb(&sub->topic, &rxbuf[rxpos + 5], n - rxpos - 5);
+            break;
+        }
+    }
+    if ((flags & EMCUTE_QOS_MASK) == EMCUTE_QOS_1) {
+        uint8_t ack[7] = { 7, PUBACK, topic_id >> 8, topic_id & 0xff, msgid >> 8, msgid & 0xff,
+                           sub != NULL ? RC_ACCEPTED : 0x02 /* Invalid topic ID */ };
+        _send(ack, sizeof(ack));
+    }
+}
+
+/*
+ * Receive a message and handle PUBACKs, PUBLISHes for subscriptions,
+ * and pings. Return message type, or a negative sock error.
+ */
+static int _recv(uint32_t timeout) {
+    ssize_t n = sock_udp_recv(&sock, rxbuf, sizeof(rxbuf), timeout, NULL);
+    size_t pos;
+    uint8_t type;
+
+    if (n == -ENOBUFS)
+        /* Too long -- nothing we wait for */
+        return 0;
+    if (n < 0)
+        return n;
+    pos = (rxbuf[0] == 0x01) ? 3 : 1;
+    if ((size_t) n < pos + 1)
+        return 0;
+    type = rxbuf[pos];
+    rxpos = pos + 1;
+    switch (type) {
+    case PUBACK:
+        if ((size_t) n >= rxpos + 5)
+            _on_puback();
+        break;
+    case PUBLISH:
+        if ((size_t) n >= rxpos + 5)
+            _on_publish(n);
+        break;
+    case PINGREQ:
+    {
+        uint8_t resp[2] = { 2, PINGRESP };
+        _send(resp, sizeof(resp));
+        break;
+    }
+    default:
+        break;
+    }
+    return type;
+}
+
+/*
+ * Time until next retransmission is due, in usec
+ */
+static uint32_t _next_retransmit(uint32_t now) {
+    win_entry_t *e;
+    uint32_t next = UINT32_MAX;
+
+    for (e = window; e < &window[MQPUB_WINDOW_SIZE]; e++) {
+        if (e->msgid != 0) {
+            uint32_t elapsed = now - e->sent;
+            uint32_t left = elapsed >= T_RETRY_USEC ? 0 : T_RETRY_USEC - elapsed;
+            if (left < next)
+                next = left;
+        }
+    }
+    return next;
+}
+
+/*
+ * Retransmit messages whose PUBACK is overdue
+ */
+static int _retransmit(uint32_t now) {
+    win_entry_t *e;
+
+    for (e = window; e < &window[MQPUB_WINDOW_SIZE]; e++) {
+        if (e->msgid != 0 && now - e->sent >= T_RETRY_USEC) {
+            if (e->retries >= WIN_N_RETRY)
+                return EMCUTE_TIMEOUT;
+            e->retries++;
+            e->sent = now;
+            mqpub_window_stats.retransmits++;
+            if (_send_publish(e->topic_id, e->data, e->len, e->flags | EMCUTE_DUP, e->msgid) != EMCUTE_OK)
+                return EMCUTE_NOGW;
+        }
+    }
+    return EMCUTE_OK;
+}
+
+/*
+ * Wait for a message of type, with message ID msgid (any if 0),
+ * while retransmitting messages in flight
+ */
+static int _wait_for(uint8_t type, uint16_t msgid, uint32_t timeout) {
+    uint32_t start = xtimer_now_usec();
+
+    while (1) {
+        uint32_t now = xtimer_now_usec();
+        uint32_t elapsed = now - start;
+        uint32_t t, r;
+        int res, err;
+
+        if (elapsed >= timeout)
+            return EMCUTE_TIMEOUT;
+        t = timeout - elapsed;
+        r = _next_retransmit(now);
+        res = _recv(r < t ? r : t);
+        if ((err = _retransmit(xtimer_now_usec())) != EMCUTE_OK)
+            return err;
+        /* SUBACK has flags before topic and message ID */
+        if (res == type && (msgid == 0 || _rx_u16(rxpos + (type == SUBACK ? 3 : 2)) == msgid))
+            return EMCUTE_OK;
+        if (res == DISCONNECT)
+            return EMCUTE_NOGW;
+        /* No wait when a retransmission is overdue -- nothing in yet */
+        if (res < 0 && res != -ETIMEDOUT && res != -EAGAIN)
+            return EMCUTE_NOGW;
+    }
+}
+
+/*
+ * Send msg, with retries, until a message of type comes back
+ */
+static int _request(const uint8_t *msg, size_t len, uint8_t type) {
+    unsigned i;
+
+    for (i = 0; i <= WIN_N_RETRY; i++) {
+        int res;
+
+        if ((res = _send(msg, len)) != EMCUTE_OK)
+            return res;
+        res = _wait_for(type, 0, T_RETRY_USEC);
+        if (res != EMCUTE_TIMEOUT)
+            return res;
+    }
+    return EMCUTE_TIMEOUT;
+}
+
+static void _clear(void) {
+    win_entry_t *e;
+
+    for (e = window; e < &window[MQPUB_WINDOW_SIZE]; e++)
+        e->msgid = 0;
+    mqpub_window_stats.inflight = 0;
+    win_error = EMCUTE_OK;
+}
+
+int mqpub_window_con(sock_udp_ep_t *remote, const char *cli_id, bool clean) {
+    sock_udp_ep_t local = SOCK_IPV6_EP_ANY;
+    size_t idlen = strlen(cli_id);
+    size_t n;
+    unsigned i;
+
+    if (sock_open)
+        sock_udp_close(&sock);
+    local.port = MQPUB_WINDOW_PORT;
+    if (sock_udp_create(&sock, &local, remote, 0) < 0) {
+        sock_open = 0;
+        return EMCUTE_NOGW;
+    }
+    sock_open = 1;
+    asleep = 0;
+    _clear();
+
+    n = _hdr(txbuf, idlen + 4, CONNECT);
+    txbuf[n++] = clean ? EMCUTE_CS : 0;
+    txbuf[n++] = PROTOCOL_ID;
+    txbuf[n++] = (WIN_KEEPALIVE >> 8) & 0xff;
+    txbuf[n++] = WIN_KEEPALIVE & 0xff;
+    memcpy(&txbuf[n], cli_id, idlen);
+    for (i = 0; i <= WIN_N_RETRY; i++) {
+        int res;
+
+        if ((res = _send(txbuf, n + idlen)) != EMCUTE_OK)
+            return res;
+        res = _wait_for(CONNACK, 0, T_RETRY_USEC);
+        if (res == EMCUTE_OK)
+            return rxbuf[rxpos] == RC_ACCEPTED ? EMCUTE_OK : EMCUTE_REJECT;
+        if (res != EMCUTE_TIMEOUT)
+            return res;
+    }
+    return EMCUTE_NOGW;
+}
+
+int mqpub_window_discon(void) {
+    uint8_t msg[2] = { 2, DISCONNECT };
+
+    if (!sock_open)
+        return EMCUTE_NOGW;
+    _clear();
+    if (_send(msg, sizeof(msg)) == EMCUTE_OK)
+        (void) _wait_for(DISCONNECT, 0, T_RETRY_USEC);
+    sock_udp_close(&sock);
+    sock_open = 0;
+    asleep = 0;
+    return EMCUTE_OK;
+}
+
+int mqpub_window_sleep(uint16_t duration) {
+    uint8_t msg[4] = { 4, DISCONNECT, duration >> 8, duration & 0xff };
+    int res;
+
+    if (!sock_open || asleep)
+        return EMCUTE_NOGW;
+    /* Nothing is retransmitted while asleep */
+    _clear();
+    res = _request(msg, sizeof(msg), DISCONNECT);
+    if (res == EMCUTE_OK)
+        asleep = 1;
+    return res;
+}
+
+int mqpub_window_ping(const char *cli_id) {
+    size_t idlen = strlen(cli_id);
+    size_t n;
+
+    if (!sock_open || !asleep)
+        return EMCUTE_NOGW;
+    if (idlen + 2 > sizeof(txbuf))
+        return EMCUTE_OVERFLOW;
+    n = _hdr(txbuf, idlen, PINGREQ);
+    memcpy(&txbuf[n], cli_id, idlen);
+    /* Buffered PUBLISHes are passed to the subscriptions while waiting */
+    return _request(txbuf, n + idlen, PINGRESP);
+}
+
+int mqpub_window_reg(emcute_topic_t *topic) {
+    size_t namelen = strlen(topic->name);
+    uint16_t msgid = _msgid();
+    size_t n;
+    unsigned i;
+
+    if (!sock_open || asleep)
+        return EMCUTE_NOGW;
+    if (namelen + 10 > sizeof(txbuf))
+        return EMCUTE_OVERFLOW;
+    for (i = 0; i <= WIN_N_RETRY; i++) {
+        int res;
+
+        /* Build it each time -- txbuf is also used for PUBLISH retransmissions */
+        n = _hdr(txbuf, namelen + 4, REGISTER);
+        txbuf[n++] = 0;         /* Topic ID */
+        txbuf[n++] = 0;
+        txbuf[n++] = msgid >> 8;
+        txbuf[n++] = msgid & 0xff;
+        memcpy(&txbuf[n], topic->name, namelen);
+        if ((res = _send(txbuf, n + namelen)) != EMCUTE_OK)
+            return res;
+        res = _wait_for(REGACK, msgid, T_RETRY_USEC);
+        if (res == EMCUTE_OK) {
+            if (rxbuf[rxpos + 4] != RC_ACCEPTED)
+                return EMCUTE_REJECT;
+            topic->id = _rx_u16(rxpos);
+            return EMCUTE_OK;
+        }
+        if (res != EMCUTE_TIMEOUT)
+            return res;
+    }
+    return EMCUTE_TIMEOUT;
+}
+
+int mqpub_window_sub(emcute_sub_t *sub, unsigned flags) {
+    size_t namelen = strlen(sub->topic.name);
+    uint16_t msgid = _msgid();
+    emcute_sub_t *s;
+    size_t n;
+    unsigned i;
+
+    if (!sock_open || asleep)
+        return EMCUTE_NOGW;
+    if (namelen + 7 > sizeof(txbuf))
+        return EMCUTE_OVERFLOW;
+    for (i = 0; i <= WIN_N_RETRY; i++) {
+        int res;
+
+        n = _hdr(txbuf, namelen + 3, SUBSCRIBE);
+        txbuf[n++] = flags & EMCUTE_QOS_MASK; /* Topic name */
+        txbuf[n++] = msgid >> 8;
+        txbuf[n++] = msgid & 0xff;
+        memcpy(&txbuf[n], sub->topic.name, namelen);
+        if ((res = _send(txbuf, n + namelen)) != EMCUTE_OK)
+            return res;
+        res = _wait_for(SUBACK, msgid, T_RETRY_USEC);
+        if (res == EMCUTE_OK) {
+            if (rxbuf[rxpos + 5] != RC_ACCEPTED)
+                return EMCUTE_REJECT;
+            sub->topic.id = _rx_u16(rxpos + 1);
+            /* Subscribed again in each session -- keep it only once */
+            for (s = subs; s != NULL && s != sub; s = s->next)
+                ;
+            if (s == NULL) {
+                sub->next = subs;
+                subs = sub;
+            }
+            return EMCUTE_OK;
+        }
+        if (res != EMCUTE_TIMEOUT)
+            return res;
+    }
+    return EMCUTE_TIMEOUT;
+}
+
+int mqpub_window_poll(uint32_t timeout) {
+    uint32_t start = xtimer_now_usec();
+
+    if (!sock_open)
+        return EMCUTE_NOGW;
+    while (1) {
+        uint32_t elapsed = xtimer_now_usec() - start;
+        int res = _recv(elapsed < timeout ? timeout - elapsed : 0);
+
+        if (res == -ETIMEDOUT || res == -EAGAIN)
+            return EMCUTE_OK;
+        if (res < 0 || res == DISCONNECT)
+            return EMCUTE_NOGW;
+    }
+}
+
+int mqpub_window_pub(emcute_topic_t *topic, const void *data, size_t len, unsigned flags, uint8_t prio) {
+    win_entry_t *e;
+
+    if (!sock_open || asleep)
+        return EMCUTE_NOGW;
+    if (len > MQTTSN_BUFFER_SIZE)
+        return EMCUTE_OVERFLOW;
+    flags &= ~EMCUTE_DUP;
+    if ((flags & EMCUTE_QOS_MASK) != EMCUTE_QOS_1) {
+        /* Fire and forget -- nothing to keep */
+        return _send_publish(topic->id, data, len, flags & ~EMCUTE_QOS_MASK, 0);
+    }
+    while (1) {
+        for (e = window; e < &window[MQPUB_WINDOW_SIZE]; e++)
+            if (e->msgid == 0)
+                break;
+        if (e < &window[MQPUB_WINDOW_SIZE])
+            break;
+        /* Window full -- wait for a PUBACK */
+        int res = _wait_for(PUBACK, 0, T_WAIT_USEC);
+        if (res != EMCUTE_OK)
+            return res;
+    }
+    e->name = topic->name;
+    e->topic_id = topic->id;
+    e->flags = flags;
+    e->retries = 0;
+    e->prio = prio;
+    e->msgid = _msgid();
+    e->seq = next_seq++;
+    e->len = len;
+    memcpy(e->data, data, len);
+    e->sent = e->first = xtimer_now_usec();
+    if (++mqpub_window_stats.inflight > mqpub_window_stats.maxinflight)
+        mqpub_window_stats.maxinflight = mqpub_window_stats.inflight;
+    return _send_publish(e->topic_id, e->data, e->len, e->flags, e->msgid);
+}
+
+int mqpub_window_flush(void) {
+    int res;
+
+    while (mqpub_window_stats.inflight > 0) {
+        if ((res = _wait_for(PUBACK, 0, T_WAIT_USEC)) != EMCUTE_OK)
+            return res;
+    }
+    res = win_error;
+    win_error = EMCUTE_OK;
+    return res;
+}
+
+void mqpub_window_drop(void (*fn)(const char *topicstr, const uint8_t *data, size_t len, uint8_t prio)) {
+    win_entry_t *e;
+
+    for (e = window; e < &window[MQPUB_WINDOW_SIZE]; e++) {
+        if (e->msgid != 0 && fn != NULL)
+            fn(e->name, e->data, e->len, e->prio);
+    }
+    _clear();
+}
+
+size_t mqpub_window_bytes(void) {
+    return sizeof(window) + sizeof(txbuf) + sizeof(rxbuf);
+}
+
+#endif /* MQPUB_WINDOW */
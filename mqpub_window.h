@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Windowed publishing. emcute waits for the PUBACK of each QoS 1
+ * PUBLISH before the next one can be sent. This is a minimal MQTT-SN
+ * client -- CONNECT, REGISTER, PUBLISH, SUBSCRIBE, DISCONNECT and the
+ * sleeping client's DISCONNECT and PINGREQ -- that keeps up to
+ * MQPUB_WINDOW_SIZE QoS 1 messages in flight.
+ * PUBACKs are matched on message ID, in any order, and only
+ * unacknowledged messages are retransmitted.
+ *
+ * The functions mirror emcute's, and return EMCUTE_* codes. There is
+ * no thread of its own, and no keep-alive: messages for subscriptions
+ * are received while waiting for the gateway, and with
+ * mqpub_window_poll() and mqpub_window_ping().
+ * Enabled with MQPUB_WINDOW.
+ */
+
+#ifndef MQPUB_WINDOW_H
+#define MQPUB_WINDOW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "net/emcute.h"
+#include "net/sock/udp.h"
+
+/* Max QoS 1 messages in flight. Each takes MQTTSN_BUFFER_SIZE bytes. */
+#ifndef MQPUB_WINDOW_SIZE
+#define MQPUB_WINDOW_SIZE 3
+#endif /* MQPUB_WINDOW_SIZE */
+
+/* Local UDP port -- emcute has its own */
+#ifndef MQPUB_WINDOW_PORT
+#define MQPUB_WINDOW_PORT (1884U)
+#endif /* MQPUB_WINDOW_PORT */
+
+typedef struct {
+    uint8_t inflight;           /* Messages waiting for PUBACK */
+    uint8_t maxinflight;        /* Max messages in flight */
+    uint32_t acked;             /* Messages acknowledged and accepted */
+    uint32_t acked_bytes;       /* Their payload bytes */
+    uint32_t rejected;          /* Messages acknowledged with an error */
+    uint32_t retransmits;       /* Retransmitted PUBLISH messages */
+    uint32_t out_of_order;      /* PUBACKs for other than the oldest message */
+} mqpub_window_stats_t;
+
+extern mqpub_window_stats_t mqpub_window_stats;
+
+int mqpub_window_con(sock_udp_ep_t *remote, const char *cli_id, bool clean);
+int mqpub_window_discon(void);
+/*
+ * Go to sleep for duration sec: DISCONNECT with the duration. The
+ * gateway keeps the session, and buffers messages for subscriptions.
+ * The socket stays open. mqpub_window_con() wakes the client up.
+ */
+int mqpub_window_sleep(uint16_t duration);
+/*
+ * Asleep -- awake for a moment: PINGREQ with the client ID. Messages
+ * the gateway has buffered are received until PINGRESP.
+ */
+int mqpub_window_ping(const char *cli_id);
+int mqpub_window_reg(emcute_topic_t *topic);
+/*
+ * Publish. A QoS 1 message is copied into the window, and the call
+ * returns when it has been sent -- waiting for a free place in the
+ * window if needed. QoS 0 messages are sent at once. prio is kept
+ * with the message, for mqpub_window_drop().
+ */
+int mqpub_window_pub(emcute_topic_t *topic, const void *data, size_t len, unsigned flags, uint8_t prio);
+/*
+ * Subscribe. PUBLISH messages for the topic are passed to sub->cb, in
+ * the publisher thread, when they are received.
+ */
+int mqpub_window_sub(emcute_sub_t *sub, unsigned flags);
+/*
+ * Receive messages for subscriptions, for timeout usec -- or those
+ * that have arrived already, if 0
+ */
+int mqpub_window_poll(uint32_t timeout);
+/*
+ * Wait until all messages in flight are acknowledged
+ */
+int mqpub_window_flush(void);
+/*
+ * Drop unacknowledged messages, after calling fn for each of them
+ */
+void mqpub_window_drop(void (*fn)(const char *topicstr, const uint8_t *data, size_t len, uint8_t prio));
+/*
+ * Size of window and message buffers
+ */
+size_t mqpub_window_bytes(void);
+
+#endif /* MQPUB_WINDOW_H */
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# Decode "mqtt_sn;trace" records from the publisher's event tracer
+# (MQPUB_TRACE). Reads JSON payloads, one per line, as printed by
+# mosquitto_sub, and prints the events in each trace record. Other
+# records are skipped.
+#
+# An event is its code (bit 7 set for the end of an operation), the
+# argument as a zigzag varint, and msec since the previous event as a
+# varint. The first event is at the "time" of the record.
+#
+#   mosquitto_sub -t 'KTH/avr-rss2/#' | ./mqtrace.py
+
+import argparse
+import json
+import sys
+
+EVENTS = ["cycle", "state", "con", "reg", "pub", "sub", "discon", "dns", "sim7020", "watchdog", "sleep", "ping"]
+END = 0x80
+
+def varint(data, pos):
+        v = 0
+        shift = 0
+        while True:
+                b = data[pos]
+                pos += 1
+                v |= (b & 0x7f) << shift
+                shift += 7
+                if not b & 0x80:
+                        return v, pos
+
+def decode(hexstr, time_ms):
+        data = bytes.fromhex(hexstr)
+        pos = 0
+        while pos < len(data):
+                ev = data[pos]
+                zz, pos = varint(data, pos + 1)
+                delta, pos = varint(data, pos)
+                time_ms += delta
+                arg = (zz >> 1) ^ -(zz & 1)
+                code = ev & ~END
+                name = EVENTS[code] if code < len(EVENTS) else f"ev{code}"
+                yield time_ms, delta, name, "end" if ev & END else "", arg
+
+def trace_records(obj):
+        if isinstance(obj, list):
+                for o in obj:
+                        yield from trace_records(o)
+        elif isinstance(obj, dict):
+                if obj.get("n") == "mqtt_sn;trace;":
+                        yield {v.get("n"): v.get("v", v.get("vs")) for v in obj.get("vj", [])}
+                elif "vj" in obj:
+                        yield from trace_records(obj["vj"])
+
+def main():
+        parser = argparse.ArgumentParser(description="Decode publisher event trace records")
+        parser.add_argument('file', nargs='?', type=argparse.FileType('r'), default=sys.stdin,
+                            help="JSON payloads, one per line (stdin)")
+        args = parser.parse_args()
+
+        for line in args.file:
+                try:
+                        obj = json.loads(line)
+                except ValueError:
+                        continue
+                for rec in trace_records(obj):
+                        print(f"seq {rec.get('seq', 0)}" +
+                              (f", {rec['lost']} lost" if rec.get('lost') else ""))
+                        for time_ms, delta, name, end, arg in decode(rec.get("ev", ""), rec.get("time", 0)):
+                                print(f"  {time_ms:10d} +{delta:6d}  {name:8s} {end:3s} {arg:6d}")
+
+if __name__ == '__main__':
+        main()
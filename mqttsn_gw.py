@@ -0,0 +1,445 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# MQTT-SN gateway stand-in, for testing and benchmarking the publisher
+# without a real gateway. Handles SEARCHGW, CONNECT, REGISTER, PUBLISH,
+# SUBSCRIBE, PINGREQ and DISCONNECT (no will, no QoS 2 delivery), with
+# fault injection: loss, delay, reordering, dropped PUBACKs and
+# CONGESTION return codes. Faults are drawn from a seeded random
+# generator, so runs are repeatable.
+#
+# Sleeping clients (DISCONNECT with a duration) keep their session, and
+# messages for their subscriptions are buffered until PINGREQ with the
+# client ID or CONNECT. --downlink sends a message to each subscribed
+# topic at an interval. PINGREQs without client ID and DISCONNECTs
+# without duration from a sleeping client are counted, since a sleeping
+# client should not send them.
+#
+# A publish cycle lasts from CONNECT to DISCONNECT, or, with a kept
+# session, until the client has been quiet for --cycle-gap seconds. For
+# each cycle, the duration, publishes, retransmissions and goodput
+# (payload bytes of new publishes per second) are printed, and a
+# summary on exit. --log writes every message to a CSV file.
+
+import argparse
+import heapq
+import random
+import select
+import signal
+import socket
+import struct
+import time
+
+ADVERTISE = 0x00
+SEARCHGW = 0x01
+GWINFO = 0x02
+CONNECT = 0x04
+CONNACK = 0x05
+REGISTER = 0x0a
+REGACK = 0x0b
+PUBLISH = 0x0c
+PUBACK = 0x0d
+SUBSCRIBE = 0x12
+SUBACK = 0x13
+UNSUBSCRIBE = 0x14
+UNSUBACK = 0x15
+PINGREQ = 0x16
+PINGRESP = 0x17
+DISCONNECT = 0x18
+
+NAMES = {
+        ADVERTISE: "ADVERTISE", SEARCHGW: "SEARCHGW", GWINFO: "GWINFO",
+        CONNECT: "CONNECT", CONNACK: "CONNACK", REGISTER: "REGISTER",
+        REGACK: "REGACK", PUBLISH: "PUBLISH", PUBACK: "PUBACK",
+        SUBSCRIBE: "SUBSCRIBE", SUBACK: "SUBACK", UNSUBSCRIBE: "UNSUBSCRIBE",
+        UNSUBACK: "UNSUBACK", PINGREQ: "PINGREQ", PINGRESP: "PINGRESP",
+        DISCONNECT: "DISCONNECT",
+}
+
+# Return codes
+RC_ACCEPTED = 0
+RC_CONGESTION = 1
+RC_INVALID_TOPIC = 2
+RC_NOT_SUPPORTED = 3
+
+# Flags
+FLAG_DUP = 0x80
+FLAG_QOS = 0x60
+FLAG_TOPIC_TYPE = 0x03
+TOPIC_NORMAL = 0x00
+TOPIC_PREDEF = 0x01
+TOPIC_SHORT = 0x02
+
+def qos(flags):
+        q = (flags & FLAG_QOS) >> 5
+        return -1 if q == 3 else q
+
+def pack(msgtype, body):
+        n = len(body) + 2
+        if n < 256:
+                return struct.pack('!BB', n, msgtype) + body
+        return struct.pack('!BHB', 1, n + 2, msgtype) + body
+
+def unpack(data):
+        if len(data) >= 4 and data[0] == 1:
+                n, hdr = struct.unpack('!H', data[1:3])[0], 3
+        elif len(data) >= 2:
+                n, hdr = data[0], 1
+        else:
+                return None, None
+        if n != len(data):
+                return None, None
+        return data[hdr], data[hdr + 1:]
+
+def percentile(values, p):
+        values = sorted(values)
+        return values[min(len(values) - 1, int(p * len(values)))]
+
+class Cycle:
+        def __init__(self, start):
+                self.start = start
+                self.last = start
+                self.publishes = 0
+                self.retrans = 0
+                self.payload = 0
+                self.connects = 0
+
+class Client:
+        def __init__(self, addr):
+                self.addr = addr
+                self.clientid = None
+                self.connected = False
+                self.topics = {}        # name -> id
+                self.names = {}         # id -> name
+                self.seen = set()       # (type, msgid) in this session
+                self.cycle = None
+                self.subs = {}          # topic id -> qos
+                self.duration = 0       # Sleep duration, s
+                self.asleep = None      # Sleep expires then, or None
+                self.buffered = []      # (topic id, payload) while asleep
+
+        def topicid(self, name):
+                if name not in self.topics:
+                        tid = len(self.topics) + 1
+                        self.topics[name] = tid
+                        self.names[tid] = name
+                return self.topics[name]
+
+class Gateway:
+        def __init__(self, sock, args):
+                self.sock = sock
+                self.args = args
+                self.rand = random.Random(args.seed)
+                self.clients = {}
+                self.pending = []       # (time, seq, data, addr)
+                self.seq = 0
+                self.start = time.monotonic()
+                self.cycles = []
+                self.counts = {}
+                self.msgid = 0
+                self.next_downlink = self.now() + args.downlink if args.downlink else None
+                self.log = open(args.log, 'w', buffering=1) if args.log else None
+                if self.log:
+                        self.log.write("time,client,dir,type,msgid,len,fate\n")
+
+        def now(self):
+                return time.monotonic() - self.start
+
+        def chance(self, p):
+                return p > 0 and self.rand.random() < p
+
+        def logmsg(self, addr, direction, data, fate):
+                if not self.log:
+                        return
+                msgtype, body = unpack(data)
+                msgid = ""
+                if msgtype in (REGISTER, REGACK, PUBLISH, PUBACK) and len(body) >= 4:
+                        msgid = struct.unpack('!H', body[2:4])[0]
+                elif msgtype == SUBSCRIBE and len(body) >= 3:
+                        msgid = struct.unpack('!H', body[1:3])[0]
+                elif msgtype == SUBACK and len(body) >= 5:
+                        msgid = struct.unpack('!H', body[3:5])[0]
+                self.log.write(f"{self.now():.6f},{addr[0]}:{addr[1]},{direction},"
+                               f"{NAMES.get(msgtype, msgtype)},{msgid},{len(data)},{fate}\n")
+
+        def send(self, client, msgtype, body):
+                data = pack(msgtype, body)
+                if self.chance(self.args.loss):
+                        self.logmsg(client.addr, "out", data, "lost")
+                        return
+                delay = self.args.delay + self.rand.uniform(0, self.args.jitter)
+                if self.chance(self.args.reorder):
+                        # Held back, so that later messages overtake it
+                        delay += self.args.reorder_delay
+                self.logmsg(client.addr, "out", data, f"delay {delay:.0f}")
+                self.seq += 1
+                heapq.heappush(self.pending, (time.monotonic() + delay / 1000, self.seq, data, client.addr))
+
+        def flush(self):
+                now = time.monotonic()
+                while self.pending and self.pending[0][0] <= now:
+                        _, _, data, addr = heapq.heappop(self.pending)
+                        self.sock.sendto(data, addr)
+
+        def timeout(self):
+                t = 1.0
+                if self.pending:
+                        t = min(t, max(0, self.pending[0][0] - time.monotonic()))
+                return t
+
+        def count(self, what):
+                self.counts[what] = self.counts.get(what, 0) + 1
+
+        def publish(self, client, tid, payload):
+                self.msgid = self.msgid % 0xffff + 1
+                flags = (1 << 5) if client.subs[tid] > 0 else 0
+                self.send(client, PUBLISH, struct.pack('!BHH', flags, tid, self.msgid) + payload)
+
+        def deliver(self, client):
+                for tid, payload in client.buffered:
+                        if tid in client.subs:
+                                self.publish(client, tid, payload)
+                                self.count("buffered delivered")
+                client.buffered = []
+
+        def downlink(self):
+                if self.next_downlink is None or self.now() < self.next_downlink:
+                        return
+                self.next_downlink += self.args.downlink
+                for client in self.clients.values():
+                        for tid in client.subs:
+                                payload = f"downlink {self.now():.0f}".encode()
+                                if client.asleep is not None:
+                                        client.buffered.append((tid, payload))
+                                        self.count("downlink buffered")
+                                elif client.connected:
+                                        self.publish(client, tid, payload)
+                                        self.count("downlink sent")
+
+        def wake(self, client):
+                client.asleep = None
+                self.deliver(client)
+
+        def congested(self):
+                return self.chance(self.args.congestion)
+
+        def begin_cycle(self, client):
+                if client.cycle is None:
+                        client.cycle = Cycle(self.now())
+
+        def end_cycle(self, client):
+                c = client.cycle
+                if c is None:
+                        return
+                client.cycle = None
+                duration = c.last - c.start
+                goodput = c.payload / duration if duration > 0 else 0
+                self.cycles.append((duration, c.publishes, c.retrans, c.payload, goodput))
+                print(f"{c.start:9.3f} {client.clientid}: cycle {duration:.3f} s, "
+                      f"{c.publishes} publishes, {c.retrans} retransmissions, "
+                      f"{c.payload} bytes, {goodput:.0f} bytes/s")
+
+        def check_idle(self):
+                now = self.now()
+                for client in self.clients.values():
+                        if client.cycle and now - client.cycle.last > self.args.cycle_gap:
+                                self.end_cycle(client)
+                        if client.asleep is not None and now > client.asleep:
+                                # Slept too long -- session is lost
+                                print(f"{now:9.3f} {client.clientid}: sleep expired")
+                                self.count("sleep expired")
+                                client.asleep = None
+                                client.topics = {}
+                                client.names = {}
+                                client.subs = {}
+                                client.buffered = []
+
+        def receive(self, data, addr):
+                msgtype, body = unpack(data)
+                if msgtype is None:
+                        return
+                if self.chance(self.args.loss):
+                        self.logmsg(addr, "in", data, "lost")
+                        return
+                self.logmsg(addr, "in", data, "ok")
+                client = self.clients.setdefault(addr, Client(addr))
+                handler = getattr(self, "on_" + NAMES.get(msgtype, "").lower(), None)
+                if handler is None:
+                        return
+                if client.cycle:
+                        client.cycle.last = self.now()
+                handler(client, body)
+
+        def on_searchgw(self, client, body):
+                self.send(client, GWINFO, struct.pack('!B', self.args.gwid))
+
+        def on_connect(self, client, body):
+                flags, _, duration = struct.unpack('!BBH', body[:4])
+                self.begin_cycle(client)
+                client.cycle.connects += 1
+                if client.cycle.connects > 1:
+                        # No CONNACK seen by client
+                        client.cycle.retrans += 1
+                if self.congested():
+                        self.send(client, CONNACK, struct.pack('!B', RC_CONGESTION))
+                        return
+                client.clientid = body[4:].decode(errors='replace')
+                if flags & 0x04:
+                        # Clean session
+                        client.topics = {}
+                        client.names = {}
+                        client.subs = {}
+                        client.asleep = None
+                        client.buffered = []
+                client.seen = set()
+                client.connected = True
+                self.send(client, CONNACK, struct.pack('!B', RC_ACCEPTED))
+                if client.asleep is not None:
+                        self.count("wake")
+                        self.wake(client)
+
+        def on_register(self, client, body):
+                _, msgid = struct.unpack('!HH', body[:4])
+                name = body[4:].decode(errors='replace')
+                self.begin_cycle(client)
+                if ('reg', msgid, name) in client.seen:
+                        client.cycle.retrans += 1
+                if self.congested():
+                        self.send(client, REGACK, struct.pack('!HHB', 0, msgid, RC_CONGESTION))
+                        return
+                client.seen.add(('reg', msgid, name))
+                self.send(client, REGACK, struct.pack('!HHB', client.topicid(name), msgid, RC_ACCEPTED))
+
+        def on_publish(self, client, body):
+                flags, tid, msgid = struct.unpack('!BHH', body[:5])
+                payload = body[5:]
+                q = qos(flags)
+                self.begin_cycle(client)
+                c = client.cycle
+                if q == -1:
+                        pass
+                elif not client.connected:
+                        return
+                elif q > 0 and (flags & FLAG_DUP or ('pub', msgid) in client.seen):
+                        c.retrans += 1
+                if q > 0 and self.congested():
+                        self.send(client, PUBACK, struct.pack('!HHB', tid, msgid, RC_CONGESTION))
+                        return
+                topictype = flags & FLAG_TOPIC_TYPE
+                if topictype == TOPIC_NORMAL and tid not in client.names:
+                        if q > 0:
+                                self.send(client, PUBACK, struct.pack('!HHB', tid, msgid, RC_INVALID_TOPIC))
+                        return
+                if q <= 0 or ('pub', msgid) not in client.seen:
+                        c.publishes += 1
+                        c.payload += len(payload)
+                        if self.args.verbose:
+                                topic = client.names.get(tid, tid)
+                                print(f"{self.now():9.3f} {client.clientid}: {topic} ({len(payload)} bytes, qos {q})")
+                if q > 0:
+                        client.seen.add(('pub', msgid))
+                        if self.chance(self.args.drop_puback):
+                                return
+                        self.send(client, PUBACK, struct.pack('!HHB', tid, msgid, RC_ACCEPTED))
+
+        def on_subscribe(self, client, body):
+                flags, msgid = struct.unpack('!BH', body[:3])
+                if flags & FLAG_TOPIC_TYPE == TOPIC_NORMAL:
+                        tid = client.topicid(body[3:].decode(errors='replace'))
+                else:
+                        tid = struct.unpack('!H', body[3:5])[0]
+                rc = RC_CONGESTION if self.congested() else RC_ACCEPTED
+                if rc == RC_ACCEPTED:
+                        client.subs[tid] = qos(flags)
+                self.send(client, SUBACK, struct.pack('!BHHB', flags & FLAG_QOS, tid, msgid, rc))
+
+        def on_unsubscribe(self, client, body):
+                _, msgid = struct.unpack('!BH', body[:3])
+                self.send(client, UNSUBACK, struct.pack('!H', msgid))
+
+        def on_pingreq(self, client, body):
+                if client.asleep is not None:
+                        if not body:
+                                # Keep-alive -- a sleeping client should not send it
+                                self.count("keep-alive while asleep")
+                        else:
+                                # Awake until PINGRESP, then asleep again
+                                self.count("ping")
+                                self.deliver(client)
+                                client.asleep = self.now() + client.duration
+                self.send(client, PINGRESP, b'')
+
+        def on_disconnect(self, client, body):
+                client.connected = False
+                if len(body) >= 2:
+                        client.duration = struct.unpack('!H', body[:2])[0]
+                        client.asleep = self.now() + client.duration
+                        self.count("sleep")
+                        if self.args.verbose:
+                                print(f"{self.now():9.3f} {client.clientid}: asleep for {client.duration} s")
+                else:
+                        if client.asleep is not None:
+                                self.count("disconnect while asleep")
+                        client.asleep = None
+                        self.count("disconnect")
+                self.send(client, DISCONNECT, b'')
+                self.end_cycle(client)
+
+        def summary(self):
+                if self.counts:
+                        print(", ".join(f"{n} {what}" for what, n in sorted(self.counts.items())))
+                if not self.cycles:
+                        print("No cycles")
+                        return
+                durations = [c[0] for c in self.cycles]
+                print(f"{len(self.cycles)} cycles: duration median {percentile(durations, 0.5):.3f} s, "
+                      f"p90 {percentile(durations, 0.9):.3f} s, max {max(durations):.3f} s")
+                print(f"  {sum(c[1] for c in self.cycles)} publishes, "
+                      f"{sum(c[2] for c in self.cycles)} retransmissions, "
+                      f"{sum(c[3] for c in self.cycles)} bytes, "
+                      f"goodput median {percentile([c[4] for c in self.cycles], 0.5):.0f} bytes/s")
+
+def main():
+        parser = argparse.ArgumentParser(description="MQTT-SN gateway stand-in with fault injection")
+        parser.add_argument('port', type=int, nargs='?', default=10000, help="UDP port (10000)")
+        parser.add_argument('--loss', type=float, default=0, help="loss probability, each direction")
+        parser.add_argument('--delay', type=float, default=0, help="delay of messages from gateway, ms")
+        parser.add_argument('--jitter', type=float, default=0, help="random extra delay, up to ms")
+        parser.add_argument('--reorder', type=float, default=0, help="probability that a message is held back")
+        parser.add_argument('--reorder-delay', type=float, default=500, help="hold back time, ms (500)")
+        parser.add_argument('--drop-puback', type=float, default=0, help="probability that PUBACK is not sent")
+        parser.add_argument('--congestion', type=float, default=0, help="probability of CONGESTION return code")
+        parser.add_argument('--cycle-gap', type=float, default=5, help="quiet time that ends a cycle, s (5)")
+        parser.add_argument('--downlink', type=float, default=0, help="send to subscribed topics every s (off)")
+        parser.add_argument('--gwid', type=int, default=1, help="gateway id in GWINFO (1)")
+        parser.add_argument('--seed', type=int, default=1, help="random seed (1)")
+        parser.add_argument('--log', help="CSV file for all messages")
+        parser.add_argument('-v', '--verbose', action='store_true', help="print each publish")
+        args = parser.parse_args()
+
+        sock = socket.socket(socket.AF_INET6, socket.SOCK_DGRAM)
+        sock.setsockopt(socket.IPPROTO_IPV6, socket.IPV6_V6ONLY, 0)
+        sock.bind(('::', args.port))
+        print(f"Listening on [::]:{args.port}")
+
+        gw = Gateway(sock, args)
+        signal.signal(signal.SIGTERM, signal.default_int_handler)
+        try:
+                while True:
+                        r, _, _ = select.select([sock], [], [], gw.timeout())
+                        if r:
+                                data, addr = sock.recvfrom(2048)
+                                gw.receive(data, addr)
+                        gw.downlink()
+                        gw.flush()
+                        gw.check_idle()
+        except KeyboardInterrupt:
+                pass
+        for client in gw.clients.values():
+                gw.end_cycle(client)
+        gw.summary()
+        if gw.log:
+                gw.log.close()
+
+if __name__ == '__main__':
+        main()
@@ -36,6 +36,39 @@
 
 #include "dns_resolve.h"
 
+#include "report_ring.h"
+#ifdef REPORT_QUEUE
+#include "report_queue.h"
+#endif /* REPORT_QUEUE */
+#ifdef MQPUB_WINDOW
+#include "mqpub_window.h"
+/* Topics in flight must not be evicted from the registry -- room for
+ * them and the predefined topic */
+#if MQTTSN_MAX_TOPICS <= MQPUB_WINDOW_SIZE + 1
+#error "MQTTSN_MAX_TOPICS must be larger than MQPUB_WINDOW_SIZE + 1"
+#endif
+#endif /* MQPUB_WINDOW */
+#include "mqpub_gateway.h"
+#ifdef MQPUB_DISCOVERY
+#include "mqpub_discovery.h"
+#endif /* MQPUB_DISCOVERY */
+#ifdef MQPUB_TICKLESS
+#include "mqpub_events.h"
+#endif /* MQPUB_TICKLESS */
+#ifdef MQPUB_PMTU
+#include "mqpub_pmtu.h"
+#endif /* MQPUB_PMTU */
+#ifdef MQPUB_LATENCY
+#include "mqpub_latency.h"
+#endif /* MQPUB_LATENCY */
+#ifdef MQPUB_AIRTIME
+#include "mqpub_airtime.h"
+#endif /* MQPUB_AIRTIME */
+#ifdef MEM_STATS
+#include "mem_stats.h"
+#endif /* MEM_STATS */
+#include "mqpub_trace.h"
+
 #ifdef MODULE_SIM7020
 #include "net/sim7020.h"
 #endif /* MODULE_SIM7020 */
@@ -55,8 +88,12 @@
 
 /* State machine interval in secs */
 #define MQPUB_STATE_INTERVAL 2
+/* Time to stay connected for subscriptions, in secs */
+#define LINGER_SEC 6
 /* Interval between DNS lookup attempts */
 #define MQPUB_RESOLVE_INTERVAL 30
+/* Connect attempts in a publish cycle, before reports are queued or kept for later */
+#define MQPUB_CON_ATTEMPTS 3
 
 mqttsn_stats_t mqttsn_stats;
 
@@ -102,41 +139,30 @@ int get_nodeid(char *buf, size_t size) {
     return n;
 }
 
-static mqpub_topic_t mqpub_topics[MQTTSN_MAX_TOPICS];
-
-static inline void _reset_topic(mqpub_topic_t *topic) {
-    topic->name = NULL;
-}
-
-static void _init_topics(void) {
-    mqpub_topic_t *topic, *last;
-
-    last = &mqpub_topics[MQTTSN_MAX_TOPICS-1];
-    for (topic = mqpub_topics; topic < last; topic++)
-        _reset_topic(topic);
-}
-
-static mqpub_topic_t *_alloc_topic(const char *topicstr) {
-    mqpub_topic_t *topic, *last;
+/*
+ * Publish to topicstr with a topic ID that the gateway knows in
+ * advance, without registering it
+ */
+int mqpub_topic_predef(const char *topicstr, uint16_t id) {
+    mqpub_topic_t *tp;
 
-    last = &mqpub_topics[MQTTSN_MAX_TOPICS-1];
-    for (topic = mqpub_topics; topic < last; topic++)
-        if (topic->name == NULL) {
-            topic->name = topicstr;
-            return topic;
-        }
-    return NULL;
+    if ((tp = mqpub_topic_intern(topicstr)) == NULL)
+        return ENOMEM;
+    tp->topic.id = id;
+    tp->flags = EMCUTE_TIT_PREDEF;
+    return 0;
 }
 
-static mqpub_topic_t *_lookup_topic(const char *topicstr) {
-    mqpub_topic_t *topic, *last;
-
-    last = &mqpub_topics[MQTTSN_MAX_TOPICS-1];
-    for (topic = mqpub_topics; topic < last; topic++)
-        if (topic->name != NULL && 
-            strncmp(topic->name, topicstr, sizeof(topic->name)) == 0)
-            return topic;
-    return NULL;
+/*
+ * A two-character topic name is sent as a short topic ID, in place
+ * of a registered one
+ */
+static int _topic_short(mqpub_topic_t *topic, const char *topicstr) {
+    if (topicstr[0] == '\0' || topicstr[1] == '\0' || topicstr[2] != '\0')
+        return 0;
+    topic->topic.id = ((uint16_t) topicstr[0] << 8) | (uint8_t) topicstr[1];
+    topic->flags = EMCUTE_TIT_SHORT;
+    return 1;
 }
 
 
@@ -153,9 +179,21 @@ size_t mqpub_init_topic(char *topic, size_t topiclen, char *nodeid, char *suffix
 }
 
 static void _init_default_topicstr(void) {
+#ifdef MQPUB_SHORT_TOPIC
+    /* Two-character topic name, sent as short topic ID */
+    strlcpy(default_topicstr, MQPUB_SHORT_TOPIC, sizeof(default_topicstr));
+#else
     char nodeidstr[20];
     (void) get_nodeid(nodeidstr, sizeof(nodeidstr));
-    mqpub_init_topic(default_topicstr, sizeof(default_topicstr), nodeidstr, "/sensors");
+    mqpub_init_topic(default_topicstr, sizeof(default_topicstr), nodeidstr, MQPUB_SENSOR_TOPIC);
+#endif /* MQPUB_SHORT_TOPIC */
+#ifdef MQPUB_PREDEF_TOPIC_ID
+    /* Topic ID configured in the gateway for this node */
+    mqpub_topic_predef(default_topicstr, MQPUB_PREDEF_TOPIC_ID);
+#endif /* MQPUB_PREDEF_TOPIC_ID */
+#ifdef MQPUB_SENML_CBOR
+    report_set_topic_enc(default_topicstr, REPORT_ENC_CBOR);
+#endif /* MQPUB_SENML_CBOR */
 }
 
 size_t mqpub_init_basename(char *basename, size_t basenamelen, char *nodeid) {
@@ -173,26 +211,97 @@ static void _init_default_basename(void) {
     (void) mqpub_init_basename(default_basename, sizeof(default_basename), nodeidstr);
 }
 
+#ifdef MQPUB_TOPIC_CACHE
+/* Registered topic IDs can be used in next session */
+static uint8_t topics_valid;
+/* Gateway they were registered with -- IDs are per gateway */
+static sock_udp_ep_t topics_gw;
+#endif /* MQPUB_TOPIC_CACHE */
+
 void mqpub_init(void) {
-    _init_topics();
+#ifdef MQPUB_TOPIC_CACHE
+    if (topics_valid)
+        return;
+    topics_valid = 1;
+#endif /* MQPUB_TOPIC_CACHE */
+    mqpub_topics_session();
 }
 
-uint8_t publish_buffer[MQTTSN_BUFFER_SIZE];
+#ifdef MQPUB_WINDOW
+/* Contents of QoS 1 messages in the window, committed when all are acknowledged */
+static report_commit_t window_commit;
+/* PUBACKs counted so far */
+static uint32_t window_acked, window_acked_bytes, window_rejected;
+
+/*
+ * Count messages in the window that have been acknowledged since
+ * last time
+ */
+static void _window_count(void) {
+    mqttsn_stats.publish_ok += mqpub_window_stats.acked - window_acked;
+    mqttsn_stats.publish_fail += mqpub_window_stats.rejected - window_rejected;
+#ifdef MQPUB_AIRTIME
+    mqpub_airtime_acked(mqpub_window_stats.acked_bytes - window_acked_bytes);
+#endif /* MQPUB_AIRTIME */
+    window_acked = mqpub_window_stats.acked;
+    window_acked_bytes = mqpub_window_stats.acked_bytes;
+    window_rejected = mqpub_window_stats.rejected;
+}
+#endif /* MQPUB_WINDOW */
 
 int mqpub_pub(mqpub_topic_t *topic, void *data, size_t len) {
-    unsigned flags = EMCUTE_QOS_1;
+    return mqpub_pub_qos(topic, data, len, REPORT_QOS_1);
+}
+
+/*
+ * Publish with QoS 0 or 1. QoS -1 is published as QoS 0, since we
+ * are connected anyway. prio is the report priority, for queueing
+ * the payload if it is lost in the window.
+ */
+static int _pub_prio(mqpub_topic_t *topic, void *data, size_t len, int qos, uint8_t prio) {
+    unsigned flags = (qos == REPORT_QOS_1 ? EMCUTE_QOS_1 : EMCUTE_QOS_0) | (topic->flags & EMCUTE_TIT_MASK);
     int errno;
     
-    printf("mqpub: publish  %d to %s: \"%s\"\n", len, topic->name, (char *) data);
+    /* JSON payloads start with a bracket, CBOR with an array byte */
+    if (len > 0 && ((char *) data)[0] == '[')
+        printf("mqpub: publish  %d to %s: \"%s\"\n", len, topic->topic.name, (char *) data);
+    else
+        printf("mqpub: publish  %d to %s\n", len, topic->topic.name);
 
     LEDON;
-    if ((errno = emcute_pub((emcute_topic_t *) topic, data, len, flags)) != EMCUTE_OK) {
+#ifdef MQPUB_LATENCY
+    uint32_t start = xtimer_now_usec();
+#endif /* MQPUB_LATENCY */
+    MQPUB_TRACE_EV(MQPUB_TR_PUB, len);
+#ifdef MQPUB_WINDOW
+    errno = mqpub_window_pub(&topic->topic, data, len, flags, prio);
+#else
+    (void) prio;
+    errno = emcute_pub(&topic->topic, data, len, flags);
+#endif /* MQPUB_WINDOW */
+    MQPUB_TRACE_EV(MQPUB_TR_PUB | MQPUB_TR_END, errno);
+    if (errno != EMCUTE_OK) {
         printf("\n\nerror: unable to publish data to topic '%s [%i]' (error %d)\n",
-               topic->name, (int)topic->id, errno);
+               topic->topic.name, (int)topic->topic.id, errno);
         mqttsn_stats.publish_fail += 1;
     }
-    else {
+#ifdef MQPUB_WINDOW
+    else if (qos == REPORT_QOS_1) {
+        /* Counted when acknowledged -- maybe some were while waiting for room.
+         * PUBLISH latency is added by mqpub_window as PUBACKs come in. */
+        _window_count();
+    }
+#endif /* MQPUB_WINDOW */
+    else if (qos == REPORT_QOS_1) {
         mqttsn_stats.publish_ok += 1;
+#ifdef MQPUB_LATENCY
+        /* emcute_pub() returns when PUBACK is in */
+        mqpub_lat_add(MQPUB_LAT_PUBLISH, xtimer_now_usec() - start);
+#endif /* MQPUB_LATENCY */
+    }
+    else {
+        /* Sent, but not acknowledged */
+        mqttsn_stats.publish_sent += 1;
     }
     LEDOFF;
 #ifdef APP_WATCHDOG
@@ -201,31 +310,72 @@ int mqpub_pub(mqpub_topic_t *topic, void *data, size_t len) {
     return errno;
 }
 
+int mqpub_pub_qos(mqpub_topic_t *topic, void *data, size_t len, int qos) {
+    return _pub_prio(topic, data, len, qos, REPORT_PRIO_NONE);
+}
+
 static int _resolve_v6addr(char *host, ipv6_addr_t *result) {
     return dns_resolve_inetaddr(host, result);
 }
 
-static char mqttsn_gateway_host[] = MQTTSN_GATEWAY_HOST;
+
+#ifdef MQPUB_ADAPTIVE_INTERVAL
+/* Time spent connecting since last interval update */
+static uint32_t con_usec;
+#endif /* MQPUB_ADAPTIVE_INTERVAL */
 
 int mqpub_con(char *host, uint16_t port) {
     sock_udp_ep_t gw = { .family = AF_INET6, .port = port};
     int errno;
     
     /* parse address */
-    if ((errno = _resolve_v6addr(mqttsn_gateway_host, (ipv6_addr_t *) &gw.addr.ipv6)) < 0)
+    if ((errno = _resolve_v6addr(host, (ipv6_addr_t *) &gw.addr.ipv6)) < 0)
         return errno;
     printf("mqpub: Connect to [");
     ipv6_addr_print((ipv6_addr_t *) &gw.addr.ipv6);
     printf("]:%d\n", gw.port);
     LEDON;
-    if ((errno = emcute_con(&gw, true, NULL, NULL, 0, 0)) != EMCUTE_OK) {
+#if defined(MQPUB_ADAPTIVE_INTERVAL) || defined(MQPUB_LATENCY)
+    uint32_t start = xtimer_now_usec();
+#endif /* MQPUB_ADAPTIVE_INTERVAL || MQPUB_LATENCY */
+#if defined(MQPUB_TOPIC_CACHE) || defined(MQPUB_KEEP_SESSION)
+    /* Ask gateway to keep the session, with topic registrations */
+    bool clean = false;
+#else
+    bool clean = true;
+#endif /* MQPUB_TOPIC_CACHE || MQPUB_KEEP_SESSION */
+    MQPUB_TRACE_EV(MQPUB_TR_CON, port);
+#ifdef MQPUB_WINDOW
+    char cli_id[24];
+
+    client_id(cli_id, sizeof(cli_id), NULL);
+    errno = mqpub_window_con(&gw, cli_id, clean);
+#else
+    errno = emcute_con(&gw, clean, NULL, NULL, 0, 0);
+#endif /* MQPUB_WINDOW */
+    MQPUB_TRACE_EV(MQPUB_TR_CON | MQPUB_TR_END, errno);
+    if (errno != EMCUTE_OK) {
         printf("error: unable to connect to gateway [%s]:%d (error %d)\n", host, port, errno);
         mqttsn_stats.connect_fail += 1;
     }
     else {
         printf("MQTT-SN: Connect to gateway [%s]:%d\n", host, port);
         mqttsn_stats.connect_ok += 1;
+#ifdef MQPUB_TOPIC_CACHE
+        /* Another gateway than last time -- its topic IDs may name other topics */
+        if (topics_gw.port != gw.port ||
+            !ipv6_addr_equal((ipv6_addr_t *) &topics_gw.addr.ipv6, (ipv6_addr_t *) &gw.addr.ipv6)) {
+            mqpub_topics_session();
+            topics_gw = gw;
+        }
+#endif /* MQPUB_TOPIC_CACHE */
+#ifdef MQPUB_LATENCY
+        mqpub_lat_add(MQPUB_LAT_CONNECT, xtimer_now_usec() - start);
+#endif /* MQPUB_LATENCY */
     }
+#ifdef MQPUB_ADAPTIVE_INTERVAL
+    con_usec += xtimer_now_usec() - start;
+#endif /* MQPUB_ADAPTIVE_INTERVAL */
     LEDOFF;
 #ifdef APP_WATCHDOG
     app_watchdog_update(errno == EMCUTE_OK);
@@ -233,16 +383,87 @@ int mqpub_con(char *host, uint16_t port) {
     return errno;
 }
 
+#ifdef MQPUB_QOS_NOCONN
+/* PUBLISH message with 3-byte length field, and payload */
+static uint8_t noconn_buf[MQTTSN_BUFFER_SIZE + 9];
+
+/*
+ * Publish with QoS -1 -- send PUBLISH to the gateway without
+ * connection. emcute needs a connection for publishing, so the
+ * message is built here, and sent from a socket of its own. The
+ * topic must have a predefined or short topic ID.
+ */
+int mqpub_pub_noconn(mqpub_topic_t *topic, void *data, size_t len) {
+    mqpub_gw_t *cur = mqpub_gw_current();
+    sock_udp_ep_t gw = { .family = AF_INET6, .port = cur->port };
+    sock_udp_t sock;
+    size_t msglen = len + 7;
+    size_t n = 0;
+    int res;
+
+    if (len > MQTTSN_BUFFER_SIZE)
+        return -ENOMEM;
+    if ((res = _resolve_v6addr(cur->host, (ipv6_addr_t *) &gw.addr.ipv6)) < 0)
+        return res;
+    if (msglen > 0xff) {
+        msglen += 2;
+        noconn_buf[n++] = 0x01;
+        noconn_buf[n++] = msglen >> 8;
+    }
+    noconn_buf[n++] = msglen & 0xff;
+    noconn_buf[n++] = 0x0c;     /* PUBLISH */
+    noconn_buf[n++] = EMCUTE_QOS_MASK | (topic->flags & EMCUTE_TIT_MASK); /* QoS -1 */
+    noconn_buf[n++] = topic->topic.id >> 8;
+    noconn_buf[n++] = topic->topic.id & 0xff;
+    noconn_buf[n++] = 0;        /* Message ID */
+    noconn_buf[n++] = 0;
+    memcpy(&noconn_buf[n], data, len);
+
+    printf("mqpub: publish  %d to %s without connection\n", len, topic->topic.name);
+    LEDON;
+    MQPUB_TRACE_EV(MQPUB_TR_PUB, len);
+    if ((res = sock_udp_create(&sock, NULL, &gw, 0)) == 0) {
+        res = sock_udp_send(&sock, noconn_buf, n + len, NULL);
+        sock_udp_close(&sock);
+    }
+    MQPUB_TRACE_EV(MQPUB_TR_PUB | MQPUB_TR_END, res < 0 ? res : 0);
+    LEDOFF;
+    if (res < 0) {
+        printf("error: unable to publish without connection (error %d)\n", res);
+        mqttsn_stats.publish_fail += 1;
+        return res;
+    }
+    mqttsn_stats.publish_noconn += 1;
+    return 0;
+}
+#endif /* MQPUB_QOS_NOCONN */
+
 int mqpub_reg(mqpub_topic_t *topic, char *topicstr) {
     int errno;
-    topic->name = topicstr;
-    if ((errno = emcute_reg((emcute_topic_t *) topic)) != EMCUTE_OK) {
+    topic->topic.name = topicstr;
+    topic->flags = EMCUTE_TIT_NORMAL;
+    if (_topic_short(topic, topicstr))
+        return EMCUTE_OK;
+#ifdef MQPUB_LATENCY
+    uint32_t start = xtimer_now_usec();
+#endif /* MQPUB_LATENCY */
+    MQPUB_TRACE_EV(MQPUB_TR_REG, 0);
+#ifdef MQPUB_WINDOW
+    errno = mqpub_window_reg(&topic->topic);
+#else
+    errno = emcute_reg(&topic->topic);
+#endif /* MQPUB_WINDOW */
+    MQPUB_TRACE_EV(MQPUB_TR_REG | MQPUB_TR_END, errno);
+    if (errno != EMCUTE_OK) {
         mqttsn_stats.register_fail += 1;
         printf("error: unable to obtain topic ID for \"%s\" (error %d)\n", topicstr, errno);
     }
     else {
-        printf("Register topic %d for \"%s\"\n", (int)topic->id, topicstr);
+        printf("Register topic %d for \"%s\"\n", (int)topic->topic.id, topicstr);
         mqttsn_stats.register_ok += 1;
+#ifdef MQPUB_LATENCY
+        mqpub_lat_add(MQPUB_LAT_REGISTER, xtimer_now_usec() - start);
+#endif /* MQPUB_LATENCY */
     }
 #ifdef APP_WATCHDOG
     app_watchdog_update(errno == EMCUTE_OK);
@@ -253,22 +474,38 @@ int mqpub_reg(mqpub_topic_t *topic, char *topicstr) {
 mqpub_topic_t *mqpub_reg_topic(char *topicstr) {
     mqpub_topic_t *tp;
     int errno;
-    if ((tp = _lookup_topic(topicstr)) != NULL)
-        return tp;
-    if ((tp = _alloc_topic(topicstr)) == NULL) {
+    if ((tp = mqpub_topic_intern(topicstr)) == NULL) {
+        printf("error: no room for topic \"%s\"\n", topicstr);
         return NULL;
     }
-    printf("mqpub: register %s\n", tp->name);
+    if (mqpub_topic_valid(tp))
+        return tp;
+    if (_topic_short(tp, topicstr))
+        return tp;
+    printf("mqpub: register %s\n", tp->topic.name);
     LEDON;
-    if ((errno = emcute_reg((emcute_topic_t *) tp)) != EMCUTE_OK) {
+#ifdef MQPUB_LATENCY
+    uint32_t start = xtimer_now_usec();
+#endif /* MQPUB_LATENCY */
+    MQPUB_TRACE_EV(MQPUB_TR_REG, 0);
+#ifdef MQPUB_WINDOW
+    errno = mqpub_window_reg(&tp->topic);
+#else
+    errno = emcute_reg(&tp->topic);
+#endif /* MQPUB_WINDOW */
+    MQPUB_TRACE_EV(MQPUB_TR_REG | MQPUB_TR_END, errno);
+    if (errno != EMCUTE_OK) {
         mqttsn_stats.register_fail += 1;
-        printf("error: unable to obtain topic ID for \"%s\" (error %d)\n", tp->name, errno);
-        _reset_topic(tp);
+        printf("error: unable to obtain topic ID for \"%s\" (error %d)\n", tp->topic.name, errno);
         tp = NULL;
     }
     else {
-        printf("Register topic %d for \"%s\"\n", (int)tp->id, tp->name);
+        printf("Register topic %d for \"%s\"\n", (int)tp->topic.id, tp->topic.name);
         mqttsn_stats.register_ok += 1;
+#ifdef MQPUB_LATENCY
+        mqpub_lat_add(MQPUB_LAT_REGISTER, xtimer_now_usec() - start);
+#endif /* MQPUB_LATENCY */
+        mqpub_topic_registered(tp);
     }
     LEDOFF;
 #ifdef APP_WATCHDOG
@@ -294,9 +531,66 @@ int mqpub_start_subscription(char *topic, emcute_cb_t cb) {
 }
 
 
+#ifdef MQPUB_WINDOW
+/*
+ * Message in the window was not acknowledged
+ */
+static void _window_lost(const char *topicstr, const uint8_t *data, size_t len, uint8_t prio) {
+    mqttsn_stats.publish_fail += 1;
+#ifdef REPORT_QUEUE
+    /* Queue payload, and publish it after reconnect. Only QoS 1 is kept in the window. */
+    if (report_queue_put(topicstr, data, len, prio, REPORT_QOS_1) == 0)
+        return;
+#else
+    (void) topicstr;
+    (void) data;
+    (void) len;
+    (void) prio;
+#endif /* REPORT_QUEUE */
+    /* Delta counters in the payload were not committed, and are sent again */
+}
+
+/*
+ * Wait for PUBACKs of all messages in the window. If some are
+ * not acknowledged, they are dropped or queued, as for a failed
+ * publish.
+ */
+static int _flush_window(void) {
+    int res = mqpub_window_flush();
+
+    _window_count();
+    if (res == EMCUTE_OK) {
+        report_commit(&window_commit, 1);
+    }
+    else {
+        printf("mqpub: window flush failed (error %d)\n", res);
+        report_commit_clear(&window_commit);
+    }
+    mqpub_window_drop(_window_lost);
+    return res;
+}
+#endif /* MQPUB_WINDOW */
+
 int mqpub_discon(void) {
     LEDON;
+#ifdef MQPUB_WINDOW
+    /* Do not leave messages unacknowledged */
+    _flush_window();
+#endif /* MQPUB_WINDOW */
+#ifdef MQPUB_LATENCY
+    uint32_t start = xtimer_now_usec();
+#endif /* MQPUB_LATENCY */
+    MQPUB_TRACE_EV(MQPUB_TR_DISCON, 0);
+#ifdef MQPUB_WINDOW
+    int errno = mqpub_window_discon();
+#else
     int errno = emcute_discon();
+#endif /* MQPUB_WINDOW */
+    MQPUB_TRACE_EV(MQPUB_TR_DISCON | MQPUB_TR_END, errno);
+#ifdef MQPUB_LATENCY
+    if (errno == EMCUTE_OK)
+        mqpub_lat_add(MQPUB_LAT_DISCONNECT, xtimer_now_usec() - start);
+#endif /* MQPUB_LATENCY */
     LEDOFF;
 #ifdef APP_WATCHDOG
     app_watchdog_update(errno == 0);
@@ -305,6 +599,16 @@ int mqpub_discon(void) {
 }
 
 int mqpub_reset(void) {
+#ifdef MQPUB_WINDOW
+    /* Messages still in flight are lost with the connection */
+    _window_count();
+    mqpub_window_drop(_window_lost);
+    report_commit_clear(&window_commit);
+#endif /* MQPUB_WINDOW */
+#ifdef MQPUB_TOPIC_CACHE
+    /* Gateway may have lost the session -- register topics again */
+    topics_valid = 0;
+#endif /* MQPUB_TOPIC_CACHE */
     LEDON;
     int errno = mqpub_discon();
     LEDOFF;
@@ -325,7 +629,7 @@ int mqpub_pubtopic(char *topicstr, uint8_t *data, size_t datalen) {
     int res;
     mqpub_topic_t topic;
 
-    res = mqpub_con(MQTTSN_GATEWAY_HOST, MQTTSN_GATEWAY_PORT);
+    res = mqpub_con(mqpub_gw_current()->host, mqpub_gw_current()->port);
     printf("*con %d\n", res);
     if (res != 0)
         return res;
@@ -341,6 +645,14 @@ int mqpub_pubtopic(char *topicstr, uint8_t *data, size_t datalen) {
 
 #ifdef MQTTSN_PUBLISHER_THREAD
 
+#ifdef MQPUB_TICKLESS
+static void _async_handler(mqpub_event_t *ev);
+static mqpub_event_t async_ev = MQPUB_EVENT_INIT(_async_handler);
+
+void mqpub_report_ready(void) {
+    mqpub_event_post(&async_ev);
+}
+#else
 enum {
   MSG_EVT_ASYNC,
   MSG_EVT_PERIODIC,
@@ -362,63 +674,646 @@ void mqpub_report_ready(void) {
     mbox_t *mbox = &evt_mbox;
     mbox_put(mbox, &msg);
 }
+#endif /* MQPUB_TICKLESS */
 
 static mqttsn_state_t state = MQTTSN_NOT_CONNECTED;
 
-static void _publish_all(int subscribe) {
+/* Reports for publish cycle are being built */
+static uint8_t pub_cycle;
+#ifdef MQPUB_LATENCY
+/* Start of publish cycle, usec */
+static uint32_t cycle_start;
+#endif /* MQPUB_LATENCY */
+
+/*
+ * All reports of the publish cycle are published
+ */
+static void _cycle_done(void) {
+    pub_cycle = 0;
+    MQPUB_TRACE_EV(MQPUB_TR_CYCLE | MQPUB_TR_END, 0);
+#ifdef MQPUB_LATENCY
+    mqpub_lat_add(MQPUB_LAT_CYCLE, xtimer_now_usec() - cycle_start);
+#endif /* MQPUB_LATENCY */
+}
+
+/*
+ * Payload being published. It is kept if it could not be published,
+ * and published first after connect.
+ */
+static report_slot_t *slot;
+#ifndef MQPUB_PIPELINE
+static report_slot_t pub_slot;
+#endif /* MQPUB_PIPELINE */
+
+/*
+ * Get next payload of the publish cycle
+ */
+static report_slot_t *_next_slot(void) {
+#ifdef MQPUB_PIPELINE
+    return report_ring_get();
+#else
+    report_slot_t *s = &pub_slot;
+    char *basename = default_basename;
+
+    s->topic = default_topicstr;
+    report_lock();
+    report_commit_init(&s->commit);
+#ifdef MQPUB_PMTU
+    report_ctx.limit = mqpub_pmtu_limit();
+#endif /* MQPUB_PMTU */
+    s->len = makereport(s->buf, sizeof(s->buf), &s->last, &s->topic, &basename);
+    s->enc = report_ctx.enc;
+    s->prio = report_ctx.prio;
+    s->qos = report_ctx.qos;
+    report_unlock();
+    return s;
+#endif /* MQPUB_PIPELINE */
+}
+
+static void _release_slot(report_slot_t *s) {
+#ifdef MQPUB_PIPELINE
+    report_ring_release(s);
+#else
+    (void) s;
+#endif /* MQPUB_PIPELINE */
+}
+
+size_t mqpub_buffer_bytes(void) {
+    size_t bytes;
+
+#ifdef MQPUB_PIPELINE
+    bytes = report_ring_bytes();
+#else
+    bytes = sizeof(pub_slot);
+#endif /* MQPUB_PIPELINE */
+#ifdef MQPUB_QOS_NOCONN
+    bytes += sizeof(noconn_buf);
+#endif /* MQPUB_QOS_NOCONN */
+#ifdef MQPUB_PMTU
+    /* Probe payload in _probe_pmtu() */
+    bytes += MQTTSN_BUFFER_SIZE;
+#endif /* MQPUB_PMTU */
+#ifdef MQPUB_WINDOW
+    bytes += mqpub_window_bytes();
+#endif /* MQPUB_WINDOW */
+    return bytes;
+}
+
+static int _publish_slot(report_slot_t *s) {
+    mqpub_topic_t *tp;
+    int res;
+
+    if ((tp = mqpub_reg_topic(s->topic)) == NULL)
+        return -1;
+    res = _pub_prio(tp, s->buf, s->len, s->qos, s->prio);
+#ifdef MQPUB_PMTU
+    if (s->qos == REPORT_QOS_1)
+        mqpub_pmtu_publish_result(s->len, res == 0);
+#endif /* MQPUB_PMTU */
+#ifdef MQPUB_AIRTIME
+    if (res == 0) {
+        mqpub_airtime_sent(s->len);
+#ifndef MQPUB_WINDOW
+        /* With a window, counted when the PUBACK is in */
+        if (s->qos == REPORT_QOS_1)
+            mqpub_airtime_acked(s->len);
+#endif /* MQPUB_WINDOW */
+    }
+#endif /* MQPUB_AIRTIME */
+    if (res == 0) {
+#ifdef MQPUB_WINDOW
+        if (s->qos == REPORT_QOS_1)
+            /* Committed when the window is flushed */
+            report_commit_add(&window_commit, &s->commit);
+        else
+#endif /* MQPUB_WINDOW */
+            report_commit(&s->commit, s->qos == REPORT_QOS_1);
+    }
+    return res;
+}
+
+#ifdef MQPUB_PMTU
+/*
+ * Search for payload size limit, with probe publishes. Probes are not
+ * reports, and a lost probe is not a failed connection -- it only
+ * tells that the size is too large.
+ */
+static void _probe_pmtu(void) {
+    static char probe_topicstr[MQPUB_TOPIC_LENGTH];
+    static uint8_t buf[MQTTSN_BUFFER_SIZE];
+    mqpub_topic_t *tp;
+    size_t len;
+    uint8_t n;
+
+    if (probe_topicstr[0] == '\0') {
+        char nodeidstr[20];
+
+        (void) get_nodeid(nodeidstr, sizeof(nodeidstr));
+        mqpub_init_topic(probe_topicstr, sizeof(probe_topicstr), nodeidstr, MQPUB_PMTU_TOPIC);
+    }
+    for (n = 0; n < MQPUB_PMTU_PROBES && (len = mqpub_pmtu_probe_size()) > 0; n++) {
+        uint32_t start;
+        int res;
+
+        if ((tp = mqpub_reg_topic(probe_topicstr)) == NULL)
+            return;
+        mqpub_pmtu_probe_fill(buf, len);
+        start = xtimer_now_usec();
+        res = mqpub_pub(tp, buf, len);
+        mqpub_pmtu_probe_result(len, res == 0, xtimer_now_usec() - start);
+        if (res != 0 && len <= MQPUB_PMTU_BASE)
+            /* Not even a small one gets through */
+            return;
+    }
+}
+#endif /* MQPUB_PMTU */
+
+#ifdef REPORT_QUEUE
+/*
+ * Keep payload for publishing after reconnect. Its counters are
+ * committed -- the queue delivers them. If older payloads had to be
+ * dropped, counters are resent in a full snapshot.
+ */
+static void _enqueue(report_slot_t *s) {
+    if (report_queue_put(s->topic, s->buf, s->len, s->prio, s->qos) != 0)
+        report_delta_snapshot();
+    report_commit(&s->commit, 1);
+}
+
+/*
+ * Gateway is unreachable -- build the reports of this publish cycle
+ * into the queue
+ */
+static void _enqueue_all(void) {
+    while (pub_cycle) {
+        if (slot == NULL)
+            slot = _next_slot();
+        if (slot->len > 0)
+            _enqueue(slot);
+        if (slot->last)
+            pub_cycle = 0;
+        _release_slot(slot);
+        slot = NULL;
+    }
+}
+
+/*
+ * Publish queued payloads, oldest first, up to a batch per call
+ */
+static int _drain_queue(void) {
+    const char *topicstr;
+    const uint8_t *data;
+    size_t len;
+    uint8_t prio;
+    int8_t qos;
+    unsigned n = 0;
+    uint32_t start = xtimer_now_usec();
+
+    while (n < REPORT_QUEUE_BATCH && report_queue_peek(&topicstr, &data, &len, &prio, &qos)) {
+        mqpub_topic_t *tp;
+
+        /* The registry keeps a copy of the topic string, and makes
+         * room for it -- the payload stays queued if it cannot */
+        if ((tp = mqpub_reg_topic((char *) topicstr)) == NULL ||
+            _pub_prio(tp, (void *) data, len, qos, prio) != 0)
+            return -1;
+#ifdef MQPUB_AIRTIME
+        mqpub_airtime_sent(len);
+#ifndef MQPUB_WINDOW
+        if (qos == REPORT_QOS_1)
+            mqpub_airtime_acked(len);
+#endif /* MQPUB_WINDOW */
+#endif /* MQPUB_AIRTIME */
+        report_queue_pop();
+        n++;
+    }
+    if (n > 0)
+        report_queue_drained(n, xtimer_now_usec() - start);
+    return 0;
+}
+#endif /* REPORT_QUEUE */
+
+static int _subscribe_all(void) {
+    emcute_sub_t **sub;
+    int res;
+
+    for (sub = &subscriptions[0]; sub <= &subscriptions[MQTTSN_MAX_SUBSCRIPTIONS-1]; sub++) {
+        if (*sub) {
+            MQPUB_TRACE_EV(MQPUB_TR_SUB, 0);
+#ifdef MQPUB_WINDOW
+            res = mqpub_window_sub(*sub, EMCUTE_QOS_1);
+#else
+            res = emcute_sub(*sub, EMCUTE_QOS_1);
+#endif /* MQPUB_WINDOW */
+            MQPUB_TRACE_EV(MQPUB_TR_SUB | MQPUB_TR_END, res);
+            if (res < 0)
+                return res;
+        }
+    }
+    return 0;
+}
+
+#ifdef MQPUB_KEEP_SESSION
+/* Subscriptions done in this session */
+static uint8_t session_subscribed;
+/* Gateway last heard that we sleep, sec */
+static uint32_t asleep_since;
+
+static inline uint32_t _now_sec(void) {
+    return (uint32_t) (xtimer_now_usec64() / US_PER_SEC);
+}
+
+/*
+ * Go to sleep: DISCONNECT with a duration. The gateway keeps the
+ * session, and buffers messages for the subscriptions until we wake
+ * up. The window client has no keep-alive, so nothing is sent until
+ * the next cycle or ping.
+ */
+static int _sleep(void) {
+    int res;
+
+    MQPUB_TRACE_EV(MQPUB_TR_SLEEP, MQPUB_SLEEP_SEC);
+    res = mqpub_window_sleep(MQPUB_SLEEP_SEC);
+    MQPUB_TRACE_EV(MQPUB_TR_SLEEP | MQPUB_TR_END, res);
+    if (res == EMCUTE_OK) {
+        printf("mqpub: asleep for %u sec\n", MQPUB_SLEEP_SEC);
+        asleep_since = _now_sec();
+    }
+#ifdef APP_WATCHDOG
+    app_watchdog_update(res == EMCUTE_OK);
+#endif /* APP_WATCHDOG */
+    return res;
+}
+
+/*
+ * Awake for a moment: PINGREQ with the client ID. The gateway sends
+ * the messages it has buffered -- the window client passes them to
+ * the subscriptions -- and then PINGRESP, and we are asleep again.
+ */
+static int _ping(void) {
+    char cli_id[24];
+    int res;
+
+    client_id(cli_id, sizeof(cli_id), NULL);
+    MQPUB_TRACE_EV(MQPUB_TR_PING, 0);
+    res = mqpub_window_ping(cli_id);
+    MQPUB_TRACE_EV(MQPUB_TR_PING | MQPUB_TR_END, res);
+    if (res == EMCUTE_OK)
+        asleep_since = _now_sec();
+#ifdef APP_WATCHDOG
+    app_watchdog_update(res == EMCUTE_OK);
+#endif /* APP_WATCHDOG */
+    return res;
+}
+
+/*
+ * Asleep, and no publish cycle for MQPUB_SLEEP_POLL_SEC -- wake up
+ * for buffered messages, and so that the gateway does not give up on
+ * us. If it does not answer, the session may be lost, and the next
+ * cycle starts with a new connect.
+ */
+static void _sleep_poll(void) {
+    if (state != MQTTSN_IDLE || _now_sec() - asleep_since < MQPUB_SLEEP_POLL_SEC)
+        return;
+    if (_ping() != EMCUTE_OK)
+        state = MQTTSN_NOT_CONNECTED;
+}
+#endif /* MQPUB_KEEP_SESSION */
+
+#ifdef MQPUB_QOS_NOCONN
+/*
+ * Topic for publishing without connection -- it must not need
+ * registration
+ */
+static mqpub_topic_t *_noconn_topic(char *topicstr, mqpub_topic_t *tmp) {
+    mqpub_topic_t *tp = mqpub_topic_lookup(topicstr);
+
+    if (tp != NULL && (tp->flags & EMCUTE_TIT_MASK) != EMCUTE_TIT_NORMAL)
+        return tp;
+    tmp->topic.name = topicstr;
+    if (_topic_short(tmp, topicstr))
+        return tmp;
+    return NULL;
+}
+
+/*
+ * Publish QoS -1 payloads of the publish cycle without connection.
+ * Return 1 if the cycle is done, or 0 at the first payload that
+ * needs a connection -- it is kept for publishing after connect.
+ */
+static int _publish_noconn(void) {
+    uint8_t finished;
+
+    do {
+        mqpub_topic_t *tp, topic;
+
+        if (slot == NULL)
+            slot = _next_slot();
+        if (slot->len > 0) {
+            if (slot->qos != REPORT_QOS_NOCONN ||
+                (tp = _noconn_topic(slot->topic, &topic)) == NULL ||
+                mqpub_pub_noconn(tp, slot->buf, slot->len) != 0)
+                return 0;
+#ifdef MQPUB_AIRTIME
+            mqpub_airtime_sent(slot->len);
+#endif /* MQPUB_AIRTIME */
+            /* Not acknowledged -- counters are sent again until they are */
+            report_commit(&slot->commit, 0);
+        }
+        finished = slot->last;
+        _release_slot(slot);
+        slot = NULL;
+    } while (!finished);
+    _cycle_done();
+    return 1;
+}
+
+static int _have_subscriptions(void) {
+    emcute_sub_t **sub;
+
+    for (sub = &subscriptions[0]; sub <= &subscriptions[MQTTSN_MAX_SUBSCRIPTIONS-1]; sub++)
+        if (*sub)
+            return 1;
+    return 0;
+}
+#endif /* MQPUB_QOS_NOCONN */
+
+#if defined(MQPUB_TICKLESS) && defined(MQPUB_KEEP_SESSION)
+/*
+ * Time to wake up, if there has been no publish cycle
+ */
+static void _poll_handler(mqpub_event_t *ev) {
+    _sleep_poll();
+    if (state == MQTTSN_IDLE)
+        mqpub_event_in(ev, (asleep_since + MQPUB_SLEEP_POLL_SEC - _now_sec()) * MS_PER_SEC);
+}
+
+static mqpub_event_t poll_ev = MQPUB_EVENT_INIT(_poll_handler);
+#endif /* MQPUB_TICKLESS && MQPUB_KEEP_SESSION */
+
+#if defined(MQPUB_TICKLESS) && !defined(MQPUB_KEEP_SESSION)
+/*
+ * Linger time is over
+ */
+static void _linger_handler(mqpub_event_t *ev) {
+    (void) ev;
+    if (state == MQTTSN_LINGER) {
+#ifdef MQPUB_WINDOW
+        /* Nobody else reads the socket -- take what came for subscriptions */
+        mqpub_window_poll(0);
+#endif /* MQPUB_WINDOW */
+        mqpub_discon();
+        state = MQTTSN_DISCONNECTED;
+    }
+}
+
+static mqpub_event_t linger_ev = MQPUB_EVENT_INIT(_linger_handler);
+#endif /* MQPUB_TICKLESS && !MQPUB_KEEP_SESSION */
+
+/*
+ * Connection to gateway failed -- back off from it, and disconnect
+ */
+/* Connection lost or connect failed -- next connect is a reconnect */
+static uint8_t reconnect;
+
+static void _gw_failed(void) {
+    reconnect = 1;
+    mqpub_gw_result(mqpub_gw_current(), 0, 0);
+    mqpub_reset();
+#ifdef MQPUB_TRACE
+    /* Publish what led up to it, when connected again */
+    mqpub_trace_publish();
+#endif /* MQPUB_TRACE */
+}
+
+/*
+ * Connect and publish. A new publish cycle is started if cycle is
+ * set and none is in progress. Else only a cycle left from a failed
+ * connect, and queued payloads, are published -- for retries, that
+ * must not add reports while the gateway is unreachable.
+ */
+static void _publish(int subscribe, int cycle) {
+#if !defined(MQPUB_KEEP_SESSION) && !defined(MQPUB_TICKLESS)
     uint32_t linger = 0;
+#endif /* !MQPUB_KEEP_SESSION && !MQPUB_TICKLESS */
+    uint8_t attempts = 0;
+    if (!pub_cycle && cycle) {
+#ifdef MQPUB_PIPELINE
+        /* Start building reports while connecting */
+        report_ring_cycle();
+#else
+        report_delta_cycle();
+#endif /* MQPUB_PIPELINE */
+        pub_cycle = 1;
+        MQPUB_TRACE_EV(MQPUB_TR_CYCLE, 0);
+#ifdef MQPUB_LATENCY
+        cycle_start = xtimer_now_usec();
+#endif /* MQPUB_LATENCY */
+#ifdef MQPUB_AIRTIME
+        mqpub_airtime_start();
+#endif /* MQPUB_AIRTIME */
+    }
+#ifdef MQPUB_AIRTIME
+    mqpub_airtime_resume();
+#endif /* MQPUB_AIRTIME */
 again:
     while (1) {
+        MQPUB_TRACE_EV(MQPUB_TR_STATE, state);
         switch (state) {
         case MQTTSN_NOT_CONNECTED:
+#ifdef MQPUB_QOS_NOCONN
+            /* Connect only if there is something that needs it */
+            if (pub_cycle && _publish_noconn() &&
+#ifdef REPORT_QUEUE
+                report_queue_depth() == 0 &&
+#endif /* REPORT_QUEUE */
+                !(subscribe && _have_subscriptions()))
+                return;
+#endif /* MQPUB_QOS_NOCONN */
             mqpub_init();
-            int res = mqpub_con(MQTTSN_GATEWAY_HOST, MQTTSN_GATEWAY_PORT);
-            //printf("mqpub_connect: %d\n", res);
-            if (res != 0)
-                break;
+            {
+                mqpub_gw_t *gw;
+                uint32_t wait, start;
+                int res;
+
+#ifdef MQPUB_DISCOVERY
+                mqpub_discovery_poll();
+                if (attempts > 0 && attempts < MQPUB_CON_ATTEMPTS)
+                    /* Look for other gateways */
+                    mqpub_discovery_search();
+#endif /* MQPUB_DISCOVERY */
+                gw = mqpub_gw_select(&wait);
+#ifdef MQPUB_DISCOVERY
+                if (gw == NULL && mqpub_discovery_search() > 0)
+                    gw = mqpub_gw_select(&wait);
+#endif /* MQPUB_DISCOVERY */
+                if (attempts >= MQPUB_CON_ATTEMPTS ||
+                    (gw == NULL && wait > MQPUB_STATE_INTERVAL * US_PER_SEC)) {
+                    /* Give up for now. The thread retries when a gateway
+                     * is no longer backed off.
+                     */
+#ifdef REPORT_QUEUE
+                    /* Keep reports until gateway is back */
+                    _enqueue_all();
+#endif /* REPORT_QUEUE */
+                    return;
+                }
+                if (gw == NULL) {
+#ifdef MQPUB_AIRTIME
+                    mqpub_airtime_pause();
+#endif /* MQPUB_AIRTIME */
+                    xtimer_usleep(wait);
+#ifdef MQPUB_AIRTIME
+                    mqpub_airtime_resume();
+#endif /* MQPUB_AIRTIME */
+                    continue;
+                }
+                start = xtimer_now_usec();
+                res = mqpub_con(gw->host, gw->port);
+                mqpub_gw_result(gw, res == 0, xtimer_now_usec() - start);
+                if (res != 0) {
+                    attempts++;
+                    reconnect = 1;
+                    continue;
+                }
+            }
+            if (reconnect) {
+                /* Gateway or broker may have missed reports -- send all counters */
+                report_delta_snapshot();
+                reconnect = 0;
+            }
             state = MQTTSN_CONNECTED;
+#ifdef MQPUB_KEEP_SESSION
+            /* New session -- topics were cleared by mqpub_init() */
+            session_subscribed = 0;
+#endif /* MQPUB_KEEP_SESSION */
+            /* fall through */
+        case MQTTSN_IDLE:
+#ifdef MQPUB_KEEP_SESSION
+            /* Asleep, with the session kept from last cycle -- topics
+             * are still registered. CONNECT makes us active again,
+             * and the gateway sends what it has buffered. If it has
+             * forgotten us, the publish fails, and we start over with
+             * a new connect.
+             */
+            if (state == MQTTSN_IDLE) {
+                mqpub_gw_t *gw = mqpub_gw_current();
+                uint32_t start;
+                int res;
+
+                if (mqpub_gw_reprobe_due()) {
+                    /* Leave session, and try the preferred gateway */
+                    state = MQTTSN_NOT_CONNECTED;
+                    continue;
+                }
+                start = xtimer_now_usec();
+                res = mqpub_con(gw->host, gw->port);
+                mqpub_gw_result(gw, res == 0, xtimer_now_usec() - start);
+                if (res != 0) {
+                    attempts++;
+                    reconnect = 1;
+                    state = MQTTSN_NOT_CONNECTED;
+                    continue;
+                }
+                mqttsn_stats.resume += 1;
+            }
+#endif /* MQPUB_KEEP_SESSION */
             /* fall through */
         case MQTTSN_CONNECTED:
             /* Now we check for each publish if the topic needs
              * registration, so nothing to do here anymore.
              */
+#ifdef MQPUB_PMTU
+            /* Before the reports, so that they can use the limit */
+            _probe_pmtu();
+#endif /* MQPUB_PMTU */
             state = MQTTSN_PUBLISHING;
             /* fall through */
         case MQTTSN_PUBLISHING:
         {
-            static uint8_t finished;
-            do {
-                size_t publen;
-                mqpub_topic_t *tp;
-                char *topicstr = default_topicstr;
-                char *basename = default_basename;
-
-                publen = makereport(publish_buffer, sizeof(publish_buffer), &finished, &topicstr, &basename);
-                if ((tp = mqpub_reg_topic(topicstr)) == NULL) {
-                    mqpub_reset();
+#ifdef REPORT_QUEUE
+            if (_drain_queue() != 0) {
+                _gw_failed();
+                state = MQTTSN_NOT_CONNECTED;
+                goto again;
+            }
+#endif /* REPORT_QUEUE */
+            /* The cycle may be done already, without connection */
+            while (pub_cycle) {
+                uint8_t finished;
+
+                /* Slot may be left from a failed publish */
+                if (slot == NULL)
+                    slot = _next_slot();
+                finished = slot->last;
+                if (slot->len > 0 && _publish_slot(slot) != 0) {
+#ifdef REPORT_QUEUE
+                    /* Queue payload, and publish it after reconnect */
+                    _enqueue(slot);
+                    _release_slot(slot);
+                    slot = NULL;
+#else
+                    /* Keep slot, and publish it after reconnect. Its
+                     * counters are committed then.
+                     */
+#endif /* REPORT_QUEUE */
+                    _gw_failed();
                     state = MQTTSN_NOT_CONNECTED;
                     goto again;
                 }
-                if (mqpub_pub(tp, publish_buffer, publen) != 0) {
-                    mqpub_reset();
+                _release_slot(slot);
+                slot = NULL;
+                if (finished)
+                    _cycle_done();
+            }
+#ifdef MQPUB_WINDOW
+            if (_flush_window() != 0) {
+                _gw_failed();
+                state = MQTTSN_NOT_CONNECTED;
+                goto again;
+            }
+#endif /* MQPUB_WINDOW */
+#ifdef MQPUB_AIRTIME
+            /* Reports delivered -- subscriptions and linger are not part of it */
+            if (!pub_cycle)
+                mqpub_airtime_end();
+#endif /* MQPUB_AIRTIME */
+#ifdef MQPUB_KEEP_SESSION
+            /* Keep the session until next cycle. Subscriptions last for the session */
+            if (subscribe && !session_subscribed) {
+                if (_subscribe_all() != 0) {
+                    _gw_failed();
                     state = MQTTSN_NOT_CONNECTED;
-                    goto again;
+                    return;
                 }
-
-            } while (!finished);
+                session_subscribed = 1;
+            }
+            if (_sleep() != EMCUTE_OK) {
+                /* Gateway does not let us sleep -- end the session */
+                mqpub_discon();
+                state = MQTTSN_DISCONNECTED;
+                return;
+            }
+            state = MQTTSN_IDLE;
+#ifdef MQPUB_TICKLESS
+            mqpub_event_in(&poll_ev, MQPUB_SLEEP_POLL_SEC * MS_PER_SEC);
+#endif /* MQPUB_TICKLESS */
+            return;
+#else
             if (subscribe) {
-                emcute_sub_t **sub;
-                for (sub = &subscriptions[0]; sub <= &subscriptions[MQTTSN_MAX_SUBSCRIPTIONS-1]; sub++) {
-                    if (*sub) {
-                        if ((res = emcute_sub(*sub, EMCUTE_QOS_1)) < 0) {
-                            mqpub_reset();
-                            state = MQTTSN_NOT_CONNECTED;
-                            return;
-                        }
-                    }
+                if (_subscribe_all() != 0) {
+                    _gw_failed();
+                    state = MQTTSN_NOT_CONNECTED;
+                    return;
                 }
-                linger = xtimer_now_usec();
                 state = MQTTSN_LINGER;
+#ifdef MQPUB_TICKLESS
+                /* Disconnect when linger time is over, without polling */
+                mqpub_event_in(&linger_ev, LINGER_SEC * MS_PER_SEC);
+                return;
+#else
+                linger = xtimer_now_usec();
+#endif /* MQPUB_TICKLESS */
             }
             else {
                 mqpub_discon();
@@ -426,9 +1321,17 @@ again:
                 return;
             }
             break;
+#endif /* MQPUB_KEEP_SESSION */
         }
-#define LINGER_SEC 6
+#ifndef MQPUB_KEEP_SESSION
         case MQTTSN_LINGER:
+#ifdef MQPUB_TICKLESS
+            /* New cycle before linger time is over -- end it now */
+            mqpub_event_cancel(&linger_ev);
+            mqpub_discon();
+            state = MQTTSN_DISCONNECTED;
+            continue;
+#else
         {
             uint32_t now = xtimer_now_usec();
             if ((now - linger)/US_PER_SEC >= LINGER_SEC) {
@@ -436,8 +1339,15 @@ again:
                 state = MQTTSN_DISCONNECTED;
                 return;
             }
+#ifdef MQPUB_WINDOW
+            /* Nobody else reads the socket -- receive for subscriptions while lingering */
+            mqpub_window_poll(MQPUB_STATE_INTERVAL * US_PER_SEC);
+            continue;
+#endif /* MQPUB_WINDOW */
         }
         break;
+#endif /* MQPUB_TICKLESS */
+#endif /* MQPUB_KEEP_SESSION */
         case MQTTSN_DISCONNECTED:
             state = MQTTSN_NOT_CONNECTED;
             continue;
@@ -447,11 +1357,245 @@ again:
         /* End up here if not successful. 
          * Wait a while and try again.
          */
+#ifdef MQPUB_AIRTIME
+        mqpub_airtime_pause();
+#endif /* MQPUB_AIRTIME */
         xtimer_sleep(MQPUB_STATE_INTERVAL);
+#ifdef MQPUB_AIRTIME
+        mqpub_airtime_resume();
+#endif /* MQPUB_AIRTIME */
+    }
+}
+
+static void _publish_all(int subscribe, int cycle) {
+    _publish(subscribe, cycle);
+#ifdef MQPUB_AIRTIME
+    /* The attempt is over. A cycle that ended without connection, or
+     * in the queue, ends here.
+     */
+    if (pub_cycle)
+        mqpub_airtime_pause();
+    else
+        mqpub_airtime_end();
+#endif /* MQPUB_AIRTIME */
+}
+
+
+#ifdef MQPUB_ADAPTIVE_INTERVAL
+#ifdef MODULE_GNRC_RPL
+uint32_t rpl_topology_sig(void);
+#endif /* MODULE_GNRC_RPL */
+
+static uint32_t publish_interval = MQTTSN_PUBLISH_INTERVAL;
+static uint8_t interval_reasons;
+
+/*
+ * Link is costly if connects often fail, or take long
+ */
+static int _link_costly(void) {
+    static uint32_t last_ok, last_fail;
+    uint32_t fails = mqttsn_stats.connect_fail - last_fail;
+    uint32_t attempts = fails + (mqttsn_stats.connect_ok - last_ok);
+    int costly = 0;
+
+    if (attempts > 0 &&
+        (fails * 2 >= attempts || con_usec / attempts >= MQPUB_INTERVAL_COSTLY_MS * US_PER_MS))
+        costly = 1;
+    last_ok = mqttsn_stats.connect_ok;
+    last_fail = mqttsn_stats.connect_fail;
+    con_usec = 0;
+#ifdef MODULE_SIM7020
+    {
+        extern uint32_t sim7020_activation_usecs;
+        static uint32_t last_act, last_act_fail;
+        sim7020_netstats_t *ns = sim7020_get_netstats();
+        uint32_t act_fails = ns->activation_fail_count - last_act_fail;
+        uint32_t acts = act_fails + (ns->activation_count - last_act);
+
+        if (acts > 0 && act_fails * 2 >= acts)
+            costly = 1;
+        if (sim7020_active() && sim7020_activation_usecs >= MQPUB_INTERVAL_COSTLY_MS * US_PER_MS)
+            costly = 1;
+        last_act = ns->activation_count;
+        last_act_fail = ns->activation_fail_count;
+    }
+#endif /* MODULE_SIM7020 */
+    return costly;
+}
+
+/*
+ * Adapt publish interval after a periodic publish. A topology
+ * change halves the interval, and a busy cycle shortens it by a
+ * quarter. A quiet cycle, or a costly link, lengthens it by a
+ * quarter. On a costly link, the interval is not shortened below
+ * MQTTSN_PUBLISH_INTERVAL.
+ */
+static void _interval_update(void) {
+    uint32_t interval = publish_interval;
+    uint32_t min = MQPUB_INTERVAL_MIN;
+    uint8_t reasons = 0;
+
+    if (_link_costly()) {
+        reasons |= MQPUB_INTERVAL_R_COSTLY;
+        min = MQTTSN_PUBLISH_INTERVAL;
+    }
+#ifdef MODULE_GNRC_RPL
+    {
+        static uint32_t last_sig;
+        uint32_t sig = rpl_topology_sig();
+
+        if (last_sig != 0 && sig != last_sig)
+            reasons |= MQPUB_INTERVAL_R_TOPOLOGY;
+        last_sig = sig;
+    }
+#endif /* MODULE_GNRC_RPL */
+#ifdef REPORT_DELTA
+    {
+        static uint32_t last_changed;
+        uint32_t changed = report_stats.changed - last_changed;
+
+        if (changed >= MQPUB_INTERVAL_BUSY)
+            reasons |= MQPUB_INTERVAL_R_BUSY;
+        else if (changed <= MQPUB_INTERVAL_QUIET)
+            reasons |= MQPUB_INTERVAL_R_QUIET;
+        last_changed = report_stats.changed;
     }
+#endif /* REPORT_DELTA */
+    if (reasons & MQPUB_INTERVAL_R_TOPOLOGY)
+        interval /= 2;
+    else if (reasons & MQPUB_INTERVAL_R_BUSY)
+        interval -= interval/4;
+    else if (reasons & (MQPUB_INTERVAL_R_QUIET|MQPUB_INTERVAL_R_COSTLY))
+        interval += interval/4;
+    if (interval < min) {
+        interval = min;
+        reasons |= MQPUB_INTERVAL_R_BOUND;
+    }
+    else if (interval > MQPUB_INTERVAL_MAX) {
+        interval = MQPUB_INTERVAL_MAX;
+        reasons |= MQPUB_INTERVAL_R_BOUND;
+    }
+    if (interval != publish_interval)
+        printf("mqpub: publish interval %" PRIu32 " sec (reasons 0x%02x)\n", interval, reasons);
+    publish_interval = interval;
+    interval_reasons = reasons;
 }
+#else
+#define publish_interval MQTTSN_PUBLISH_INTERVAL
+#endif /* MQPUB_ADAPTIVE_INTERVAL */
 
+#define MQPUB_THREAD_MAX_INTERVAL_SEC 60
 
+#ifdef MODULE_SIM7020
+/*
+ * Modem is active -- trace when it changes
+ */
+static int _sim7020_active(void) {
+    static int8_t last = -1;
+    int active = sim7020_active();
+
+    if (active != last) {
+        MQPUB_TRACE_EV(MQPUB_TR_SIM7020, active);
+        last = active;
+    }
+    return active;
+}
+#endif /* MODULE_SIM7020 */
+
+#ifdef MQPUB_TICKLESS
+static void _periodic_handler(mqpub_event_t *ev);
+static void _retry_handler(mqpub_event_t *ev);
+static mqpub_event_t periodic_ev = MQPUB_EVENT_INIT(_periodic_handler);
+static mqpub_event_t retry_ev = MQPUB_EVENT_INIT(_retry_handler);
+#ifdef MODULE_SIM7020
+/* Periodic publish is due, and waits for the modem to be activated */
+static volatile uint8_t modem_wait;
+#endif /* MODULE_SIM7020 */
+
+/*
+ * Housekeeping has no deadlines of its own -- it is done when the
+ * thread wakes up for publishing
+ */
+static void _housekeeping(void) {
+#ifdef SNTP_SYNC
+    sync_periodic();
+#endif /* SNTP_SYNC */
+#ifdef DNS_CACHE_REFRESH
+    dns_resolve_refresh();
+#endif /* DNS_CACHE_REFRESH */
+}
+
+/*
+ * Retry gateway when it is no longer backed off -- publish cycle
+ * left from failed connect, or queued reports
+ */
+static void _schedule_retry(void) {
+    uint32_t msec;
+
+    if (!pub_cycle
+#ifdef REPORT_QUEUE
+        && report_queue_depth() == 0
+#endif /* REPORT_QUEUE */
+        )
+        return;
+    msec = mqpub_gw_next_retry() / US_PER_MS;
+    if (msec < MQPUB_STATE_INTERVAL * MS_PER_SEC)
+        msec = MQPUB_STATE_INTERVAL * MS_PER_SEC;
+    mqpub_event_in(&retry_ev, msec);
+}
+
+static void _periodic_handler(mqpub_event_t *ev) {
+#ifdef MODULE_SIM7020
+    /* Set before the check, so that an activation in between is not missed */
+    modem_wait = 1;
+    if (!_sim7020_active())
+        /* Posted again by mqttsn_publisher_sim7020_active() */
+        return;
+    modem_wait = 0;
+#endif /* MODULE_SIM7020 */
+    _housekeeping();
+    mqpub_event_cancel(&retry_ev);
+    _publish_all(1, 1);
+#ifdef MQPUB_ADAPTIVE_INTERVAL
+    _interval_update();
+#endif /* MQPUB_ADAPTIVE_INTERVAL */
+    mqpub_event_in(ev, publish_interval * MS_PER_SEC);
+    _schedule_retry();
+}
+
+static void _retry_handler(mqpub_event_t *ev) {
+    (void) ev;
+    _housekeeping();
+    /* Only what is left or queued -- not a new cycle for each retry */
+    _publish_all(0, 0);
+    _schedule_retry();
+}
+
+static void _async_handler(mqpub_event_t *ev) {
+    (void) ev;
+    _publish_all(0, 1);
+    _schedule_retry();
+}
+
+#ifdef MODULE_SIM7020
+void mqttsn_publisher_sim7020_active(void) {
+    if (modem_wait) {
+        modem_wait = 0;
+        mqpub_event_post(&periodic_ev);
+    }
+}
+#endif /* MODULE_SIM7020 */
+
+static void *mqpub_thread(void *arg)
+{
+    (void)arg;
+    state = MQTTSN_NOT_CONNECTED;
+    /* Make the first publish asap */
+    mqpub_event_post(&periodic_ev);
+    mqpub_events_loop();
+    return NULL;
+}
+#else
 /*
  * Time for periodic publish?
  */
@@ -460,10 +1604,16 @@ again:
  */
 static timex_t last_periodic;
 
+#ifdef MODULE_SIM7020
+void mqttsn_publisher_sim7020_active(void) {
+    /* The thread checks the modem when it wakes up */
+}
+#endif /* MODULE_SIM7020 */
+
 static int timeforperiodic(void) {
 
 #ifdef MODULE_SIM7020
-    if (!sim7020_active()) {
+    if (!_sim7020_active()) {
         return 0;
     }
 #endif
@@ -477,12 +1627,11 @@ static int timeforperiodic(void) {
     /* Has timer expired? */
     timex_t now;
     xtimer_now_timex(&now);
-    timex_t periodic_due = timex_add(last_periodic, timex_set(MQTTSN_PUBLISH_INTERVAL, 0));
+    timex_t periodic_due = timex_add(last_periodic, timex_set(publish_interval, 0));
     return timex_cmp(now, periodic_due) >= 0;
 }
 
 
-#define MQPUB_THREAD_MAX_INTERVAL_SEC 60
 static void *mqpub_thread(void *arg)
 {
     (void)arg;
@@ -501,7 +1650,7 @@ static void *mqpub_thread(void *arg)
 
         switch (msg.type) {
         case MSG_EVT_ASYNC:
-            _publish_all(0);
+            _publish_all(0, 1);
             break;
         case MSG_EVT_PERIODIC:
 #ifdef SNTP_SYNC
@@ -511,12 +1660,31 @@ static void *mqpub_thread(void *arg)
             dns_resolve_refresh();
 #endif /* DNS_CACHE_REFRESH */
             if (timeforperiodic()) {
-                _publish_all(1);
+                _publish_all(1, 1);
                 xtimer_now_timex(&last_periodic);
+#ifdef MQPUB_ADAPTIVE_INTERVAL
+                _interval_update();
+#endif /* MQPUB_ADAPTIVE_INTERVAL */
             }
-            else 
-            if (interval_secs < MQPUB_THREAD_MAX_INTERVAL_SEC) {
-                interval_secs <<= 1;
+            else if (pub_cycle
+#ifdef REPORT_QUEUE
+                     || report_queue_depth() > 0
+#endif /* REPORT_QUEUE */
+                ) {
+                /* Retry gateway -- publish cycle left from failed
+                 * connect, or queued reports. No new cycle, or every
+                 * retry would add one to the queue.
+                 */
+                _publish_all(0, 0);
+            }
+            else {
+#ifdef MQPUB_KEEP_SESSION
+                /* Asleep -- wake up now and then for buffered messages */
+                _sleep_poll();
+#endif /* MQPUB_KEEP_SESSION */
+                if (interval_secs < MQPUB_THREAD_MAX_INTERVAL_SEC) {
+                    interval_secs <<= 1;
+                }
             }
             xtimer_set(&interval_timer, interval_secs*US_PER_SEC);
             break;
@@ -526,6 +1694,7 @@ static void *mqpub_thread(void *arg)
     }
     return NULL;
 }
+#endif /* MQPUB_TICKLESS */
 #endif /* MQTTSN_PUBLISHER_THREAD */
 
 
@@ -540,9 +1709,28 @@ void mqttsn_publisher_init(void) {
     _init_default_topicstr();
     _init_default_basename();
     dns_resolve_init();
+    report_init();
+#ifdef REPORT_QUEUE
+    report_queue_init();
+#endif /* REPORT_QUEUE */
+#ifdef MQPUB_DISCOVERY
+    mqpub_discovery_init();
+#endif /* MQPUB_DISCOVERY */
+    static report_sched_t mqttsn_sched;
+    report_register(&mqttsn_sched, mqttsn_report, "mqttsn",
+                    MQTTSN_PUBLISH_INTERVAL, 3*MQTTSN_PUBLISH_INTERVAL, 1);
+#ifdef MQPUB_PIPELINE
+    report_ring_init(default_topicstr, default_basename);
+#endif /* MQPUB_PIPELINE */
 #ifdef APP_WATCHDOG
     app_watchdog_init();
 #endif /* APP_WATCHDOG */    
+#ifdef MEM_STATS
+    mem_stats_init();
+#endif /* MEM_STATS */
+#ifdef MQPUB_TRACE
+    mqpub_trace_init();
+#endif /* MQPUB_TRACE */
 
     /* start emcute thread */
     emcute_pid = thread_create(emcute_stack, sizeof(emcute_stack), EMCUTE_PRIO, THREAD_CREATE_STACKTEST,
@@ -555,8 +1743,22 @@ void mqttsn_publisher_init(void) {
 #endif /* MQTTSN_PUBLISHER_THREAD */
 }
 
+#define REPORT_SCHEMA_MQTTSN_STATS
+#define REPORT_SCHEMA_SET mqttsn_stats_schema
+#define REPORT_SCHEMA_TYPE mqttsn_stats_t
+#include "report_schema_gen.h"
+#undef REPORT_SCHEMA_MQTTSN_STATS
+
+#ifdef REPORT_QUEUE
+#define REPORT_SCHEMA_QUEUE_STATS
+#define REPORT_SCHEMA_SET queue_stats_schema
+#define REPORT_SCHEMA_TYPE report_queue_stats_t
+#include "report_schema_gen.h"
+#undef REPORT_SCHEMA_QUEUE_STATS
+#endif /* REPORT_QUEUE */
+
 typedef enum {
-    s_gateway, s_connect, s_register, s_publish, s_reset} mqttsn_report_state_t;
+    s_gateway, s_stats, s_queue, s_interval, s_interval_reason, s_events, s_pmtu, s_latency} mqttsn_report_state_t;
 
 int mqttsn_report(uint8_t *buf, size_t len, uint8_t *finished, 
                   __attribute__((unused)) char **topicp, __attribute__((unused)) char **basenamep) {
@@ -569,44 +1771,162 @@ int mqttsn_report(uint8_t *buf, size_t len, uint8_t *finished,
      
      switch (state) {
      case s_gateway:
-          RECORD_START(s + nread, l - nread);
-          PUTFMT(",{\"n\": \"mqtt_sn;gateway\",\"vs\":\"[%s]:%d\"}",MQTTSN_GATEWAY_HOST, MQTTSN_GATEWAY_PORT);
-          RECORD_END(nread);
-          state = s_connect;
+          if (report_delta_full()) {
+               mqpub_gw_t *cur = mqpub_gw_current();
+               char gw[MQPUB_TOPIC_LENGTH + sizeof("[]:65535")];
+               size_t n;
+
+               strlcpy(gw, "[", sizeof(gw));
+               strlcat(gw, cur->host, sizeof(gw) - sizeof("]:65535") + 1);
+               strlcat(gw, "]:", sizeof(gw));
+               n = strlen(gw);
+               report_utoa(gw + n, cur->port);
+               RECORD_START(s + nread, l - nread);
+               PUTNAME("mqtt_sn;gateway");
+               PUTKEY(SENML_VS);
+               PUTSTR(gw);
+               PUTCLOSE();
+               RECORD_END(nread);
+          }
+          state = s_stats;
+
+     case s_stats:
+     {
+          static uint8_t schema_state;
+          uint8_t done;
+          REPORT_DELTA_SLOTS(delta, REPORT_SCHEMA_LEN(mqttsn_stats_schema));
+          int n;
+
+          n = report_schema_gen(mqttsn_stats_schema, REPORT_SCHEMA_LEN(mqttsn_stats_schema), &mqttsn_stats,
+                                REPORT_DELTA_ARG(delta), &schema_state, s + nread, l - nread, &done);
+          nread += n;
+          if (!done)
+               return nread;
+     }
+          state = s_queue;
+
+     case s_queue:
+#ifdef REPORT_QUEUE
+     {
+          static uint8_t schema_state;
+          uint8_t done;
+          REPORT_DELTA_SLOTS(delta, REPORT_SCHEMA_LEN(queue_stats_schema));
+          int n;
+
+          n = report_schema_gen(queue_stats_schema, REPORT_SCHEMA_LEN(queue_stats_schema), &report_queue_stats,
+                                REPORT_DELTA_ARG(delta), &schema_state, s + nread, l - nread, &done);
+          nread += n;
+          if (!done)
+               return nread;
+     }
+#endif /* REPORT_QUEUE */
+          state = s_interval;
 
-     case s_connect:
+     case s_interval:
+#ifdef MQPUB_ADAPTIVE_INTERVAL
           RECORD_START(s + nread, l - nread);
-          PUTFMT(",{\"n\":\"mqtt_sn;stats;connect\",\"vj\":[");
-          PUTFMT("{\"n\":\"ok\",\"u\":\"count\",\"v\":%d},", mqttsn_stats.connect_ok);
-          PUTFMT("{\"n\":\"fail\",\"u\":\"count\",\"v\":%d}", mqttsn_stats.connect_fail);
-          PUTFMT("]}");
+          PUTGROUP("mqtt_sn;interval;");
+          PUTMEAS("publish", "sec", publish_interval);
+          PUTGROUPEND();
           RECORD_END(nread);
-          state = s_register;
+#endif /* MQPUB_ADAPTIVE_INTERVAL */
+          state = s_interval_reason;
+
+     case s_interval_reason:
+#ifdef MQPUB_ADAPTIVE_INTERVAL
+     {
+          static const struct {
+               uint8_t bit;
+               const char *name;
+          } reasons[] = {
+               {MQPUB_INTERVAL_R_BUSY, "busy"},
+               {MQPUB_INTERVAL_R_QUIET, "quiet"},
+               {MQPUB_INTERVAL_R_TOPOLOGY, "topology"},
+               {MQPUB_INTERVAL_R_COSTLY, "costly"},
+               {MQPUB_INTERVAL_R_BOUND, "bound"},
+          };
+          char reason[sizeof("busy,quiet,topology,costly,bound")];
+          uint8_t i;
+
+          reason[0] = '\0';
+          for (i = 0; i < sizeof(reasons)/sizeof(reasons[0]); i++) {
+               if (interval_reasons & reasons[i].bit) {
+                    if (reason[0] != '\0')
+                         strlcat(reason, ",", sizeof(reason));
+                    strlcat(reason, reasons[i].name, sizeof(reason));
+               }
+          }
+          if (reason[0] != '\0') {
+               RECORD_START(s + nread, l - nread);
+               PUTNAME("mqtt_sn;interval;reason");
+               PUTKEY(SENML_VS);
+               PUTSTR(reason);
+               PUTCLOSE();
+               RECORD_END(nread);
+          }
+     }
+#endif /* MQPUB_ADAPTIVE_INTERVAL */
+          state = s_events;
 
-     case s_register:
+     case s_events:
+#ifdef MQPUB_TICKLESS
           RECORD_START(s + nread, l - nread);
-          PUTFMT(",{\"n\":\"mqtt_sn;stats;register\",\"vj\":[");
-          PUTFMT("{\"n\":\"ok\",\"u\":\"count\",\"v\":%d},", mqttsn_stats.register_ok);
-          PUTFMT("{\"n\":\"fail\",\"u\":\"count\",\"v\":%d}", mqttsn_stats.register_fail);
-          PUTFMT("]}");
+          PUTGROUP("mqtt_sn;events;");
+          PUTCOUNT("wakeups", mqpub_events_stats.wakeups);
+          PUTCOUNT("wakeups_hour", mqpub_events_stats.hour_wakeups);
+          PUTCOUNT("wakeups_timer", mqpub_events_stats.timer_wakeups);
+          PUTMEAS("late", "msec", mqpub_events_stats.late_ms);
+          PUTGROUPEND();
           RECORD_END(nread);
-          state = s_publish;
-     
-     case s_publish:
-          RECORD_START(s + nread, l - nread);
-          PUTFMT(",{\"n\":\"mqtt_sn;stats;publish\",\"vj\":[");
-          PUTFMT("{\"n\":\"ok\",\"u\":\"count\",\"v\":%d},", mqttsn_stats.publish_ok);
-          PUTFMT("{\"n\":\"fail\",\"u\":\"count\",\"v\":%d}", mqttsn_stats.publish_fail);
-          PUTFMT("]}");
-          RECORD_END(nread);
-          state = s_reset;
-          
-     case s_reset:
+#endif /* MQPUB_TICKLESS */
+          state = s_pmtu;
+
+     case s_pmtu:
+#ifdef MQPUB_PMTU
           RECORD_START(s + nread, l - nread);
-          PUTFMT(",{\"n\":\"mqtt_sn;stats;reset\",\"u\":\"count\",\"v\":%d}", mqttsn_stats.reset);
-          PUTFMT(",{\"n\":\"mqtt_sn;stats;commreset\",\"u\":\"count\",\"v\":%d}", mqttsn_stats.commreset);
+          PUTGROUP("mqtt_sn;pmtu;");
+          PUTMEAS("limit", "byte", mqpub_pmtu_limit());
+          PUTCOUNT("probes", mqpub_pmtu_stats.probes);
+          PUTCOUNT("lost", mqpub_pmtu_stats.lost);
+          PUTCOUNT("slow", mqpub_pmtu_stats.slow);
+          PUTCOUNT("blackhole", mqpub_pmtu_stats.blackhole);
+          PUTGROUPEND();
           RECORD_END(nread);
-
+#endif /* MQPUB_PMTU */
+          state = s_latency;
+
+     case s_latency:
+#ifdef MQPUB_LATENCY
+     {
+          /* One record per phase, with the buckets that are not empty */
+          static uint8_t phase;
+
+          for (; phase < MQPUB_LAT_NUMOF; phase++) {
+               mqpub_lat_hist_t *h = &mqpub_lat_hist[phase];
+               char name[sizeof("mqtt_sn;latency;disconnect")];
+               uint8_t b;
+
+               if (h->n == 0)
+                    continue;
+               strlcpy(name, "mqtt_sn;latency;", sizeof(name));
+               strlcat(name, mqpub_lat_name(phase), sizeof(name));
+               RECORD_START(s + nread, l - nread);
+               PUTGROUP(name);
+               for (b = 0; b < MQPUB_LAT_BUCKETS; b++) {
+                    if (h->count[b] > 0) {
+                         char bucket[MQPUB_LAT_NAMELEN];
+
+                         mqpub_lat_bucket_name(bucket, b);
+                         PUTCOUNT(bucket, h->count[b]);
+                    }
+               }
+               PUTMEAS("max", "msec", h->max_ms);
+               PUTGROUPEND();
+               RECORD_END(nread);
+          }
+          phase = 0;
+     }
+#endif /* MQPUB_LATENCY */
           state = s_gateway;
      }
      *finished = 1;
@@ -627,10 +1947,16 @@ int mqttsn_stats_cmd(int argc, char **argv) {
           break;
       case MQTTSN_PUBLISHING:
           puts("publishing");
+          break;
       case MQTTSN_LINGER:
           puts("linger");
+          break;
       case MQTTSN_DISCONNECTED:
           puts("disconnected");
+          break;
+      case MQTTSN_IDLE:
+          puts("asleep");
+          break;
     }
 #else
     puts("not started");
@@ -638,10 +1964,64 @@ int mqttsn_stats_cmd(int argc, char **argv) {
     puts("\n");
     puts("Statistics:");
     mqttsn_stats_t *st = &mqttsn_stats;
-    printf("  connect: success %d, fail %d\n", st->connect_ok, st->connect_fail);
-    printf("  register: success %d, fail %d\n", st->register_ok, st->register_fail);
-    printf("  publish: success %d, fail %d\n", st->publish_ok, st->publish_fail);
-    printf("  reset: %d\n", st->reset);
-    printf("  commreset: %d\n", st->commreset);
+    printf("  connect: success %" PRIu32 ", fail %" PRIu32 ", resume %" PRIu32 ", failover %" PRIu32 "\n",
+           st->connect_ok, st->connect_fail, st->resume, st->failover);
+    printf("  register: success %" PRIu32 ", fail %" PRIu32 "\n", st->register_ok, st->register_fail);
+    printf("  publish: success %" PRIu32 ", fail %" PRIu32 ", qos 0 %" PRIu32 ", qos -1 %" PRIu32 "\n",
+           st->publish_ok, st->publish_fail, st->publish_sent, st->publish_noconn);
+    printf("  reset: %" PRIu32 "\n", st->reset);
+    printf("  commreset: %" PRIu32 "\n", st->commreset);
+    printf("  records: %" PRIu32 ", rollback %" PRIu32 ", discarded %" PRIu32 " bytes, sized %" PRIu32 " bytes\n",
+           report_stats.records, report_stats.rollbacks, report_stats.discarded, report_stats.sized);
+#ifdef MQPUB_PIPELINE
+    printf("  ring: %u/%u slots used, max %u, generator waits %" PRIu32 ", publisher waits %" PRIu32 "\n",
+           report_ring_stats.used, REPORT_RING_SLOTS, report_ring_stats.maxused,
+           report_ring_stats.full_waits, report_ring_stats.empty_waits);
+#endif /* MQPUB_PIPELINE */
+#ifdef REPORT_QUEUE
+    report_queue_stats_t *qs = &report_queue_stats;
+    printf("  queue: %u payloads (%" PRIu32 " bytes), max %u, queued %" PRIu32 ", dropped %" PRIu32
+           ", spilled %" PRIu32 ", drained %" PRIu32 " (%" PRIu32 "/min)\n",
+           qs->depth, qs->bytes, qs->maxdepth, qs->queued, qs->dropped,
+           qs->spilled, qs->drained, qs->drain_rate);
+#endif /* REPORT_QUEUE */
+#ifdef MQPUB_WINDOW
+    mqpub_window_stats_t *ws = &mqpub_window_stats;
+    printf("  window: %u/%u in flight, max %u, retransmits %" PRIu32 ", out of order %" PRIu32 "\n",
+           ws->inflight, MQPUB_WINDOW_SIZE, ws->maxinflight, ws->retransmits, ws->out_of_order);
+#endif /* MQPUB_WINDOW */
+    mqpub_topics_stats_t *ts = &mqpub_topics_stats;
+    printf("  topics: %u/%u, %u/%u bytes, longest chain %u, evicted %u, full %u\n",
+           ts->count, MQTTSN_MAX_TOPICS, ts->bytes, MQPUB_TOPIC_ARENA_SIZE, ts->maxchain,
+           ts->evicted, ts->full);
+#ifdef MQPUB_ADAPTIVE_INTERVAL
+    printf("  interval: %" PRIu32 " sec (%u-%u), reasons 0x%02x\n",
+           publish_interval, MQPUB_INTERVAL_MIN, MQPUB_INTERVAL_MAX, interval_reasons);
+#endif /* MQPUB_ADAPTIVE_INTERVAL */
+    mqpub_gw_print();
+#ifdef MQPUB_DISCOVERY
+    printf("  discovery: searches %u, gwinfo %u, advertise %u\n", mqpub_discovery_stats.searches,
+           mqpub_discovery_stats.gwinfo, mqpub_discovery_stats.advertise);
+#endif /* MQPUB_DISCOVERY */
+#ifdef MQPUB_PMTU
+    mqpub_pmtu_stats_t *ps = &mqpub_pmtu_stats;
+    printf("  pmtu: limit %u/%u bytes, probes %u, lost %u, slow %u, searches %u, blackhole %u, base rtt %" PRIu32 " ms\n",
+           mqpub_pmtu_limit(), MQTTSN_BUFFER_SIZE, ps->probes, ps->lost, ps->slow, ps->searches,
+           ps->blackhole, ps->base_rtt);
+#endif /* MQPUB_PMTU */
+#ifdef MQPUB_TICKLESS
+    printf("  events: wakeups %" PRIu32 " (%" PRIu32 " last hour, %" PRIu32 " by timers), events %" PRIu32
+           ", max late %" PRIu32 " ms\n",
+           mqpub_events_stats.wakeups, mqpub_events_stats.hour_wakeups, mqpub_events_stats.timer_wakeups,
+           mqpub_events_stats.events, mqpub_events_stats.late_ms);
+#endif /* MQPUB_TICKLESS */
+#ifdef MQPUB_LATENCY
+    mqpub_lat_print();
+#endif /* MQPUB_LATENCY */
+#ifdef MQPUB_AIRTIME
+    mqpub_airtime_print();
+#endif /* MQPUB_AIRTIME */
+    puts("Schedule:");
+    report_sched_print();
     return 0;
 }
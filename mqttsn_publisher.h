@@ -2,6 +2,7 @@
 #define MQTTSN_PUBLISHER_T
 
 #include "net/emcute.h"
+#include "mqpub_topics.h"
 
 typedef enum {
     MQTTSN_NOT_CONNECTED,
@@ -9,23 +10,26 @@ typedef enum {
     MQTTSN_PUBLISHING,
     MQTTSN_LINGER,
     MQTTSN_DISCONNECTED,
+    MQTTSN_IDLE,                /* Session kept, asleep between publish cycles */
 } mqttsn_state_t;
 
 typedef struct mqttsn_stats {
-  uint16_t connect_ok;
-  uint16_t register_ok;
-  uint16_t publish_ok;
-  uint16_t connect_fail;
-  uint16_t register_fail;
-  uint16_t publish_fail;
-  uint16_t reset;
-  uint16_t commreset;  
+  uint32_t connect_ok;
+  uint32_t register_ok;
+  uint32_t publish_ok;
+  uint32_t connect_fail;
+  uint32_t register_fail;
+  uint32_t publish_fail;
+  uint32_t reset;
+  uint32_t commreset;  
+  uint32_t resume;              /* Publish cycles in a kept session */
+  uint32_t publish_sent;        /* QoS 0 -- sent, not acknowledged */
+  uint32_t publish_noconn;      /* QoS -1 -- sent without connection */
+  uint32_t failover;            /* Changes of gateway */
 } mqttsn_stats_t;
 
 extern mqttsn_stats_t mqttsn_stats;
 
-typedef emcute_topic_t mqpub_topic_t;
-
 void mqttsn_publisher_init(void);
 mqttsn_state_t mqttsn_publisher_state(void);
 
@@ -37,6 +41,19 @@ mqttsn_state_t mqttsn_publisher_state(void);
 #define MQTT_TOPIC_BASE "KTH/avr-rss2"
 #endif
 
+/*
+ * Define MQPUB_SENML_CBOR to publish reports in SenML CBOR instead
+ * of SenML JSON. CBOR reports go to a topic of their own, so that
+ * JSON consumers are not affected.
+ */
+#ifndef MQPUB_SENSOR_TOPIC
+#ifdef MQPUB_SENML_CBOR
+#define MQPUB_SENSOR_TOPIC "/sensors/cbor"
+#else
+#define MQPUB_SENSOR_TOPIC "/sensors"
+#endif /* MQPUB_SENML_CBOR */
+#endif /* MQPUB_SENSOR_TOPIC */
+
 #ifndef MQPUB_BASENAME_LENGTH
 #define MQPUB_BASENAME_LENGTH  (32U)
 #endif /* MQPUB_BASENAME_LENGTH */
@@ -67,24 +84,95 @@ mqttsn_state_t mqttsn_publisher_state(void);
 #define MQTTSN_PUBLISH_INTERVAL 600 //1200
 #endif /* MQTTSN_PUBLISH_INTERVAL */
 
-#ifndef MQTTSN_MAX_TOPICS
-/* Max no of topics during a connection  */
-#define MQTTSN_MAX_TOPICS 8
-#endif /* MQTTSN_MAX_TOPICS */
+/*
+ * Define MQPUB_ADAPTIVE_INTERVAL to adapt the publish interval,
+ * within bounds, to how much the reported data changes, and to
+ * the cost of connecting. Changed counters are only counted with
+ * REPORT_DELTA.
+ */
+#if defined(MQPUB_ADAPTIVE_INTERVAL) && !defined(REPORT_DELTA)
+#error "MQPUB_ADAPTIVE_INTERVAL needs REPORT_DELTA"
+#endif
+#ifndef MQPUB_INTERVAL_MIN
+#define MQPUB_INTERVAL_MIN (MQTTSN_PUBLISH_INTERVAL/4)
+#endif /* MQPUB_INTERVAL_MIN */
+#ifndef MQPUB_INTERVAL_MAX
+#define MQPUB_INTERVAL_MAX (MQTTSN_PUBLISH_INTERVAL*4)
+#endif /* MQPUB_INTERVAL_MAX */
+
+/*
+ * With MQPUB_KEEP_SESSION, the client sleeps between publish cycles:
+ * sleep duration in the DISCONNECT message, in seconds. The gateway
+ * keeps the session this long, so it must outlast the longest
+ * publish interval.
+ */
+#ifndef MQPUB_SLEEP_SEC
+#define MQPUB_SLEEP_SEC (MQPUB_INTERVAL_MAX + MQPUB_INTERVAL_MAX/2)
+#endif /* MQPUB_SLEEP_SEC */
+/* Wake up with PINGREQ, when asleep this long without a publish cycle */
+#ifndef MQPUB_SLEEP_POLL_SEC
+#define MQPUB_SLEEP_POLL_SEC (MQPUB_SLEEP_SEC*3/4)
+#endif /* MQPUB_SLEEP_POLL_SEC */
+
+#ifdef MQPUB_KEEP_SESSION
+#ifndef MQPUB_WINDOW
+/* emcute has no sleeping client, and keeps sending keep-alive PINGREQs */
+#error "MQPUB_KEEP_SESSION needs MQPUB_WINDOW"
+#endif
+#if MQPUB_SLEEP_SEC <= MQPUB_INTERVAL_MAX || MQPUB_SLEEP_SEC > 0xffff
+#error "MQPUB_SLEEP_SEC must be longer than MQPUB_INTERVAL_MAX, and fit in 16 bits"
+#endif
+#if MQPUB_SLEEP_POLL_SEC >= MQPUB_SLEEP_SEC
+#error "MQPUB_SLEEP_POLL_SEC must be shorter than MQPUB_SLEEP_SEC"
+#endif
+#endif /* MQPUB_KEEP_SESSION */
+/* Changed counters in a publish cycle for a busy cycle, and for a quiet one */
+#ifndef MQPUB_INTERVAL_BUSY
+#define MQPUB_INTERVAL_BUSY 8
+#endif /* MQPUB_INTERVAL_BUSY */
+#ifndef MQPUB_INTERVAL_QUIET
+#define MQPUB_INTERVAL_QUIET 1
+#endif /* MQPUB_INTERVAL_QUIET */
+/* Connect (or modem activation) time that makes the link costly */
+#ifndef MQPUB_INTERVAL_COSTLY_MS
+#define MQPUB_INTERVAL_COSTLY_MS 10000
+#endif /* MQPUB_INTERVAL_COSTLY_MS */
+
+/* Reasons for last interval decision */
+#define MQPUB_INTERVAL_R_BUSY      0x01 /* Many counters changed -- shorter */
+#define MQPUB_INTERVAL_R_QUIET     0x02 /* Few counters changed -- longer */
+#define MQPUB_INTERVAL_R_TOPOLOGY  0x04 /* RPL topology changed -- shorter */
+#define MQPUB_INTERVAL_R_COSTLY    0x08 /* Slow or failing connects -- longer */
+#define MQPUB_INTERVAL_R_BOUND     0x10 /* Limited by min or max */
 
 #ifndef MQTTSN_MAX_SUBSCRIPTIONS
 #define MQTTSN_MAX_SUBSCRIPTIONS 1
 #endif /* MQTTSN_MAX_SUBSCRIPTIONS */
 
 void mqttsn_publisher_init(void);
+#ifdef MODULE_SIM7020
+/*
+ * SIM7020 has been activated. Call from the driver's activation
+ * callback, and after sim7020_activate(). With MQPUB_TICKLESS, a
+ * periodic publish that waits for the modem starts now -- the
+ * publisher does not poll the modem.
+ */
+void mqttsn_publisher_sim7020_active(void);
+#endif /* MODULE_SIM7020 */
 
 int get_nodeid(char *buf, size_t size);
 
 int mqttsn_stats_cmd(int argc, char **argv);
+int mqttsn_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
 
 int mqpub_pub(mqpub_topic_t *topic, void *data, size_t len);
+int mqpub_pub_qos(mqpub_topic_t *topic, void *data, size_t len, int qos);
+#ifdef MQPUB_QOS_NOCONN
+int mqpub_pub_noconn(mqpub_topic_t *topic, void *data, size_t len);
+#endif /* MQPUB_QOS_NOCONN */
 int mqpub_con(char *host, uint16_t port);
 int mqpub_reg(mqpub_topic_t *topic, char *topicstr);
+int mqpub_topic_predef(const char *topicstr, uint16_t id);
 int mqpub_discon(void);
 int mqpub_reset(void);
 size_t mqpub_init_topic(char *topic, size_t topiclen, char *nodeid, char *suffix);
@@ -93,6 +181,8 @@ int mqpub_pubtopic(char *topicstr, uint8_t *data, size_t datalen);
 int mqpub_start_subscription(char *topic, emcute_cb_t cb);
 
 void mqpub_report_ready(void);
+/* Size of payload buffers */
+size_t mqpub_buffer_bytes(void);
 
 int dns_resolve_inetaddr(char *host, ipv6_addr_t *result);
 
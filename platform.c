@@ -56,9 +56,18 @@ int boot_report(uint8_t *buf, size_t len, uint8_t *finished,
      *finished = 0;
      
      RECORD_START(s + nread, l - nread);
-     PUTFMT(",{\"n\": \"boot;application\",\"vs\":\"" APPLICATION "\"}");
-     PUTFMT(",{\"n\": \"boot;build\",\"vs\":\"RIOT %s\"}", RIOT_VERSION);
-     PUTFMT(",{\"n\": \"boot;reset_cause\",\"vs\":\"%s\"}", reset_cause(GPIOR0));
+     PUTNAME("boot;application");
+     PUTKEY(SENML_VS);
+     PUTSTR(APPLICATION);
+     PUTCLOSE();
+     PUTNAME("boot;build");
+     PUTKEY(SENML_VS);
+     PUTSTR("RIOT " RIOT_VERSION);
+     PUTCLOSE();
+     PUTNAME("boot;reset_cause");
+     PUTKEY(SENML_VS);
+     PUTSTR(reset_cause(GPIOR0));
+     PUTCLOSE();
      RECORD_END(nread);
 
      *finished = 1;
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 
 #include "msg.h"
+#include "mutex.h"
 #include "net/ipv6/addr.h"
 #include "xtimer.h"
 
@@ -30,10 +31,10 @@
 
 static int seq_nr_value = 0;
 
-#if defined(MODULE_GNRC_RPL)
+#if defined(REPORT_GEN_RPL)
 int rpl_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
 #endif
-#if defined(MODULE_SIM7020)
+#if defined(REPORT_GEN_SIM7020)
 int sim7020_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
 #endif
 #ifdef EPCGW
@@ -42,28 +43,576 @@ int epcgwstats_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp
 #ifdef MODULE_NETSTATS
 int if_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
 #endif /* MODULE_NETSTATS */
-#ifdef APP_WATCHDOG
-int app_watchdog_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
-#endif /* APP_WATCHDOG */
-int mqttsn_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
 int boot_report(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep);
 
+report_ctx_t report_ctx;
+
+/*
+ * SenML writers. In JSON, a separator is written before an item
+ * unless it follows an opening bracket or a key. In CBOR, records
+ * and arrays use indefinite length, so that items can be appended
+ * one by one.
+ */
+
+#define CBOR_UINT       0x00
+#define CBOR_NINT       0x20
+#define CBOR_TEXT       0x60
+#define CBOR_ARRAY      0x80
+#define CBOR_MAP        0xa0
+#define CBOR_TAG        0xc0
+#define CBOR_INDEF      0x1f
+#define CBOR_BREAK      0xff
+#define CBOR_TAG_DECFRAC 4
+
+/*
+ * Write CBOR head for major type and argument.
+ * Return the number of bytes needed.
+ */
+static size_t cbor_head(uint8_t *buf, size_t len, uint8_t major, uint64_t arg) {
+     size_t n, i;
+
+     if (arg < 24)
+          n = 0;
+     else if (arg <= UINT8_MAX)
+          n = 1;
+     else if (arg <= UINT16_MAX)
+          n = 2;
+     else if (arg <= UINT32_MAX)
+          n = 4;
+     else
+          n = 8;
+     if (n + 1 > len)
+          return n + 1;
+     if (n == 0)
+          buf[0] = major | (uint8_t) arg;
+     else {
+          /* Additional info 24..27 for 1, 2, 4 and 8 bytes */
+          buf[0] = major | (n == 1 ? 24 : n == 2 ? 25 : n == 4 ? 26 : 27);
+          for (i = n; i > 0; i--) {
+               buf[i] = (uint8_t) arg;
+               arg >>= 8;
+          }
+     }
+     return n + 1;
+}
+
+static size_t cbor_byte(uint8_t *buf, size_t len, uint8_t b) {
+     if (len >= 1)
+          buf[0] = b;
+     return 1;
+}
+
+static size_t cbor_int(uint8_t *buf, size_t len, int64_t v) {
+     if (v < 0)
+          return cbor_head(buf, len, CBOR_NINT, (uint64_t) (-1 - v));
+     else
+          return cbor_head(buf, len, CBOR_UINT, (uint64_t) v);
+}
+
+static size_t cbor_text(uint8_t *buf, size_t len, const char *str) {
+     size_t slen = strlen(str);
+     size_t n = cbor_head(buf, len, CBOR_TEXT, slen);
+
+     if (n + slen <= len)
+          memcpy(buf + n, str, slen);
+     return n + slen;
+}
+
+static const char *senml_label_str(int label) {
+     switch (label) {
+     case SENML_BN:
+          return "bn";
+     case SENML_BT:
+          return "bt";
+     case SENML_N:
+          return "n";
+     case SENML_U:
+          return "u";
+     case SENML_V:
+          return "v";
+     case SENML_VS:
+          return "vs";
+     case SENML_T:
+          return "t";
+     case SENML_VJ:
+          return "vj";
+     }
+     return "?";
+}
+
+/*
+ * JSON output, written without snprintf. Characters are
+ * counted also when the buffer is full, as with snprintf, so that
+ * the caller gets the number of bytes needed.
+ */
+typedef struct {
+     char *buf;
+     size_t len;
+     size_t n;
+} json_out_t;
+
+static inline void json_c(json_out_t *o, char c) {
+     if (o->n < o->len)
+          o->buf[o->n] = c;
+     o->n++;
+}
+
+static void json_s(json_out_t *o, const char *str) {
+     while (*str)
+          json_c(o, *str++);
+}
+
+/*
+ * Begin item -- write separator, if needed
+ */
+static inline void json_begin(json_out_t *o, char *buf, size_t len) {
+     o->buf = buf;
+     o->len = len;
+     o->n = 0;
+     if (report_ctx.sep)
+          json_c(o, ',');
+}
+
+/*
+ * End item -- null terminate if there is room, and return length
+ */
+static inline size_t json_end(json_out_t *o) {
+     if (o->n < o->len)
+          o->buf[o->n] = '\0';
+     return o->n;
+}
+
+/*
+ * Convert unsigned to decimal digits, with at least width digits.
+ * Digits are found by subtracting powers of ten, which is much
+ * cheaper than 32-bit division on the AVR.
+ * Return the number of digits.
+ */
+static const uint32_t pow10_u32[] = {
+     1000000000UL, 100000000UL, 10000000UL, 1000000UL,
+     100000UL, 10000UL, 1000UL, 100UL, 10UL
+};
+#define NPOW10 (sizeof(pow10_u32)/sizeof(pow10_u32[0]))
+
+static size_t fmt_u32(char *dst, uint32_t v, unsigned width) {
+     size_t n = 0;
+     unsigned i;
+
+     for (i = 0; i < NPOW10; i++) {
+          char c = '0';
+          while (v >= pow10_u32[i]) {
+               v -= pow10_u32[i];
+               c++;
+          }
+          if (c != '0' || n > 0 || NPOW10 - i < width)
+               dst[n++] = c;
+     }
+     dst[n++] = '0' + (char) v;
+     return n;
+}
+
+static void json_u32(json_out_t *o, uint32_t v, unsigned width) {
+     char digits[10];
+     size_t i, n = fmt_u32(digits, v, width);
+
+     for (i = 0; i < n; i++)
+          json_c(o, digits[i]);
+}
+
+size_t report_utoa(char *buf, uint32_t v) {
+     size_t n = fmt_u32(buf, v, 1);
+     buf[n] = '\0';
+     return n;
+}
+
+size_t report_hex(char *buf, const uint8_t *data, size_t len) {
+     static const char hexdigits[] = "0123456789abcdef";
+     size_t i;
+
+     for (i = 0; i < len; i++) {
+          *buf++ = hexdigits[data[i] >> 4];
+          *buf++ = hexdigits[data[i] & 0xf];
+     }
+     *buf = '\0';
+     return 2*len;
+}
+
+size_t senml_open(char *buf, size_t len) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR)
+          n = cbor_byte((uint8_t *) buf, len, CBOR_MAP | CBOR_INDEF);
+     else {
+          json_out_t o;
+          json_begin(&o, buf, len);
+          json_c(&o, '{');
+          n = json_end(&o);
+     }
+     report_ctx.sep = 0;
+     return n;
+}
+
+size_t senml_close(char *buf, size_t len) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR)
+          n = cbor_byte((uint8_t *) buf, len, CBOR_BREAK);
+     else {
+          json_out_t o = { .buf = buf, .len = len };
+          json_c(&o, '}');
+          n = json_end(&o);
+     }
+     report_ctx.sep = 1;
+     return n;
+}
+
+size_t senml_array(char *buf, size_t len) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR)
+          n = cbor_byte((uint8_t *) buf, len, CBOR_ARRAY | CBOR_INDEF);
+     else {
+          json_out_t o;
+          json_begin(&o, buf, len);
+          json_c(&o, '[');
+          n = json_end(&o);
+     }
+     report_ctx.sep = 0;
+     return n;
+}
+
+size_t senml_array_end(char *buf, size_t len) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR)
+          n = cbor_byte((uint8_t *) buf, len, CBOR_BREAK);
+     else {
+          json_out_t o = { .buf = buf, .len = len };
+          json_c(&o, ']');
+          n = json_end(&o);
+     }
+     report_ctx.sep = 1;
+     return n;
+}
+
+static size_t json_key(char *buf, size_t len, const char *key) {
+     json_out_t o;
+
+     json_begin(&o, buf, len);
+     json_c(&o, '"');
+     json_s(&o, key);
+     json_s(&o, "\":");
+     return json_end(&o);
+}
+
+size_t senml_key(char *buf, size_t len, int label) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR)
+          n = cbor_int((uint8_t *) buf, len, label);
+     else
+          n = json_key(buf, len, senml_label_str(label));
+     report_ctx.sep = 0;
+     return n;
+}
+
+size_t senml_tkey(char *buf, size_t len, const char *key) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR)
+          n = cbor_text((uint8_t *) buf, len, key);
+     else
+          n = json_key(buf, len, key);
+     report_ctx.sep = 0;
+     return n;
+}
+
+size_t senml_u32(char *buf, size_t len, uint32_t v) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR)
+          n = cbor_head((uint8_t *) buf, len, CBOR_UINT, v);
+     else {
+          json_out_t o;
+          json_begin(&o, buf, len);
+          json_u32(&o, v, 1);
+          n = json_end(&o);
+     }
+     report_ctx.sep = 1;
+     return n;
+}
+
+size_t senml_i32(char *buf, size_t len, int32_t v) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR)
+          n = cbor_int((uint8_t *) buf, len, v);
+     else {
+          json_out_t o;
+          json_begin(&o, buf, len);
+          if (v < 0) {
+               json_c(&o, '-');
+               json_u32(&o, -(uint32_t) v, 1);
+          }
+          else
+               json_u32(&o, v, 1);
+          n = json_end(&o);
+     }
+     report_ctx.sep = 1;
+     return n;
+}
+
+/*
+ * Fixed-point seconds. In CBOR, encode as a decimal fraction
+ * (tag 4) with exponent -3, which needs no floating point.
+ */
+size_t senml_sec(char *buf, size_t len, uint32_t sec, uint16_t msec) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR) {
+          uint8_t *b = (uint8_t *) buf;
+          if (msec == 0)
+               n = cbor_head(b, len, CBOR_UINT, sec);
+          else {
+               n = cbor_head(b, len, CBOR_TAG, CBOR_TAG_DECFRAC);
+               n += cbor_head(b + n, len > n ? len - n : 0, CBOR_ARRAY, 2);
+               n += cbor_int(b + n, len > n ? len - n : 0, -3);
+               n += cbor_head(b + n, len > n ? len - n : 0, CBOR_UINT, (uint64_t) sec*1000 + msec);
+          }
+     }
+     else {
+          json_out_t o;
+          json_begin(&o, buf, len);
+          json_u32(&o, sec, 1);
+          json_c(&o, '.');
+          json_u32(&o, msec, 3);
+          n = json_end(&o);
+     }
+     report_ctx.sep = 1;
+     return n;
+}
+
+/*
+ * Strings are written as is, without JSON escapes
+ */
+size_t senml_str(char *buf, size_t len, const char *str) {
+     size_t n;
+
+     if (report_ctx.enc == REPORT_ENC_CBOR)
+          n = cbor_text((uint8_t *) buf, len, str);
+     else {
+          json_out_t o;
+          json_begin(&o, buf, len);
+          json_c(&o, '"');
+          json_s(&o, str);
+          json_c(&o, '"');
+          n = json_end(&o);
+     }
+     report_ctx.sep = 1;
+     return n;
+}
+
+/*
+ * Record sizing
+ */
+report_stats_t report_stats;
+
+int report_sizing(size_t len) {
+     return REPORT_SIZING && len <= report_stats.maxrec;
+}
+
+void report_record_done(size_t n) {
+     report_stats.records++;
+     if (n > report_stats.maxrec)
+          report_stats.maxrec = n;
+}
+
+void report_record_full(size_t n) {
+     report_stats.rollbacks++;
+     report_stats.discarded += n;
+     if (n > report_stats.maxrec)
+          report_stats.maxrec = n;
+}
+
+static mutex_t report_mutex = MUTEX_INIT;
+
+void report_lock(void) {
+     mutex_lock(&report_mutex);
+}
+
+void report_unlock(void) {
+     mutex_unlock(&report_mutex);
+}
+
+/*
+ * Delta reporting
+ */
+static uint8_t delta_snapshot_req = 1;
+
+#ifdef REPORT_DELTA
+static uint8_t delta_full;
+
+int report_delta_full(void) {
+     return delta_full;
+}
+
+int report_delta_changed(report_delta_t *slot, uint32_t v) {
+     return delta_full || v != slot->acked;
+}
+
+#endif /* REPORT_DELTA */
+
+void report_delta_add(report_delta_t *slot, uint32_t v) {
+     report_commit_t *c = report_ctx.commit;
+
+     /* No slot without REPORT_DELTA -- nothing to commit */
+     if (slot == NULL)
+          return;
+     if (c != NULL && report_ctx.ndelta < REPORT_DELTA_MAX_COUNTERS) {
+          c->delta[report_ctx.ndelta].slot = slot;
+          c->delta[report_ctx.ndelta].v = v;
+          report_ctx.ndelta++;
+     }
+}
+
+void report_delta_cycle(void) {
+#ifdef REPORT_DELTA
+     static unsigned cycles;
+
+     report_lock();
+     if (delta_snapshot_req || cycles >= REPORT_DELTA_FULL_CYCLES - 1) {
+          delta_full = 1;
+          delta_snapshot_req = 0;
+          cycles = 0;
+     }
+     else {
+          delta_full = 0;
+          cycles++;
+     }
+     report_unlock();
+#endif /* REPORT_DELTA */
+}
+
+void report_delta_snapshot(void) {
+     report_lock();
+     delta_snapshot_req = 1;
+     report_unlock();
+}
+
+static void sched_sent(report_sched_t *sched, uint32_t time);
+
+void report_commit_init(report_commit_t *c) {
+     report_ctx.commit = c;
+}
+
+void report_commit(report_commit_t *c, int acked) {
+     uint8_t i;
+
+     report_lock();
+     for (i = 0; i < c->nsched; i++)
+          sched_sent(c->sched[i], c->time);
+     for (i = 0; i < c->ndelta; i++) {
+          if (c->delta[i].slot == NULL)
+               continue;
+#ifdef REPORT_DELTA
+          /* Counted here, once per payload sent -- not when records are sized */
+          if (c->delta[i].v != c->delta[i].slot->acked)
+               report_stats.changed++;
+#endif /* REPORT_DELTA */
+          if (acked)
+               c->delta[i].slot->acked = c->delta[i].v;
+     }
+     report_unlock();
+     report_commit_clear(c);
+}
+
+void report_commit_clear(report_commit_t *c) {
+     c->ndelta = 0;
+     c->nsched = 0;
+}
+
+void report_commit_add(report_commit_t *dst, const report_commit_t *c) {
+     uint8_t i;
+
+     report_lock();
+     for (i = 0; i < c->nsched; i++) {
+          if (dst->nsched < REPORT_COMMIT_MAX_SCHED)
+               dst->sched[dst->nsched++] = c->sched[i];
+          else
+               /* Not tracked -- count it as sent */
+               sched_sent(c->sched[i], c->time);
+     }
+     dst->time = c->time;
+     report_unlock();
+     for (i = 0; i < c->ndelta && dst->ndelta < REPORT_DELTA_MAX_COUNTERS; i++) {
+          if (c->delta[i].slot != NULL)
+               dst->delta[dst->ndelta++] = c->delta[i];
+     }
+}
+
+/*
+ * Per-topic encodings
+ */
+#ifndef REPORT_MAX_ENC_TOPICS
+#define REPORT_MAX_ENC_TOPICS 2
+#endif /* REPORT_MAX_ENC_TOPICS */
+
+static struct {
+     const char *topic;
+     report_enc_t enc;
+} topic_encs[REPORT_MAX_ENC_TOPICS];
+
+int report_set_topic_enc(const char *topic, report_enc_t enc) {
+     unsigned i;
+
+     for (i = 0; i < REPORT_MAX_ENC_TOPICS; i++) {
+          if (topic_encs[i].topic == NULL || strcmp(topic_encs[i].topic, topic) == 0) {
+               topic_encs[i].topic = topic;
+               topic_encs[i].enc = enc;
+               return 0;
+          }
+     }
+     return -1;
+}
+
+report_enc_t report_topic_enc(const char *topic) {
+     unsigned i;
+
+     for (i = 0; i < REPORT_MAX_ENC_TOPICS && topic_encs[i].topic != NULL; i++) {
+          if (strcmp(topic_encs[i].topic, topic) == 0)
+               return topic_encs[i].enc;
+     }
+     return REPORT_ENC_JSON;
+}
+
 static size_t preamble(uint8_t *buf, size_t len, char *basename) {
      char *s = (char *) buf;
      size_t l = len;
      int nread = 0;
-     
+     char bn[MQPUB_BASENAME_LENGTH + 1];
+
+     strlcpy(bn, basename, sizeof(bn) - 1);
+     strlcat(bn, ";", sizeof(bn));
+
      RECORD_START(s + nread, l - nread);
-     PUTFMT("{\"bn\":\"%s;\"", basename);
+     PUTOPEN();
+     PUTKEY(SENML_BN);
+     PUTSTR(bn);
 
      uint64_t basetime = sync_basetime();
      uint32_t utime_sec = basetime/1000000;
      uint32_t utime_msec = (basetime/1000) % 1000;
-     PUTFMT(",\"bt\":%" PRIu32 ".%03" PRIu32 "}", utime_sec, utime_msec);
+     PUTKEY(SENML_BT);
+     PUTSEC(utime_sec, utime_msec);
+     PUTCLOSE();
 
-     PUTFMT(",{\"n\":\"seq_no\",\"v\":%d}", seq_nr_value++);
+     PUTNAME("seq_no");
+     PUTKEY(SENML_V);
+     PUTI32(seq_nr_value);
+     PUTCLOSE();
      RECORD_END(nread);
 
+     seq_nr_value++;
      return (nread);
 }
 
@@ -71,102 +620,208 @@ static size_t preamble(uint8_t *buf, size_t len, char *basename) {
  * Report scheduler -- return report generator function to use next
  */
 
-typedef enum {
-#if defined(MODULE_GNRC_RPL)
-  s_rpl_report,
-#endif
-#if defined(MODULE_SIM7020)
-  s_sim7020_report,
-#endif
-#if defined(EPCGW)
-  s_epcgwstats_report,
-#endif
-#if defined(MODULE_NETSTATS)
-  s_if_report,
-#endif
-#if defined(APP_WATCHDOG)
-  s_app_watchdog_report,
-#endif
-  s_mqttsn_report,
-  s_max_report
-} report_state_t;
+#define RS_RUN          0x01    /* Called in this cycle */
+#define RS_STARTED      0x02    /* Called at least once */
 
+static report_sched_t *schedule;
+static uint8_t in_cycle;
+static uint32_t cycle_time;
+/* Generator returned last, NULL if not from the schedule */
+static report_sched_t *cur_sched;
+/* Priority and QoS of the generator returned last */
+static uint8_t sched_prio;
+static int8_t sched_qos;
+
+static uint32_t sched_now(void) {
+     return (uint32_t) (xtimer_now_usec64()/US_PER_SEC);
+}
+
+void report_register(report_sched_t *sched, report_gen_t gen, const char *name,
+                     uint16_t period, uint16_t maxstale, uint8_t prio) {
+     report_sched_t **sp;
+
+     sched->gen = gen;
+     sched->name = name;
+     sched->period = period;
+     sched->maxstale = maxstale;
+     sched->prio = prio;
+     sched->flags = 0;
+     sched->last = 0;
+     sched->count = 0;
+     sched->qos = REPORT_QOS_DEFAULT;
+     sched->next = NULL;
+     /* Append, so that generators registered at the same time keep their order */
+     for (sp = &schedule; *sp != NULL; sp = &(*sp)->next)
+          ;
+     *sp = sched;
+}
+
+void report_set_qos(report_sched_t *sched, int8_t qos) {
+     sched->qos = qos;
+}
+
+void report_sched_trigger(report_sched_t *sched) {
+     report_lock();
+     sched->flags &= ~RS_STARTED;
+     report_unlock();
+}
+
+static int sched_due(report_sched_t *sched, uint32_t now) {
+     if (!(sched->flags & RS_STARTED))
+          return 1;
+     /* Too stale -- also for generators that report once */
+     if (sched->maxstale != 0 && now + REPORT_SCHED_SLACK >= sched->last + sched->maxstale)
+          return 1;
+     if (sched->period == REPORT_PERIOD_ONCE)
+          return 0;
+     return now + REPORT_SCHED_SLACK >= sched->last + sched->period;
+}
+
+static uint32_t sched_deadline(report_sched_t *sched) {
+     if (!(sched->flags & RS_STARTED))
+          return 0;
+     return sched->last + sched->maxstale;
+}
+
+/*
+ * Return the next generator that is due in this publish cycle, in
+ * deadline and priority order. Return NULL at the end of the cycle.
+ */
 report_gen_t next_report_gen(void) {
-     static unsigned int reportno = 0;
-     static uint8_t done_once = 0;
+     report_sched_t *sched, *best = NULL;
 
 #ifdef EPCGW
      /* EPC reports have priority. If there is an epc report
       * waiting, send it now
       */
      report_gen_t epcgen = epcgw_report_gen();
-     if (epcgen != NULL)
+     if (epcgen != NULL) {
+         cur_sched = NULL;
+         sched_prio = 0;
+         sched_qos = REPORT_QOS_1;
          return epcgen;
+     }
 #endif /* EPCGW */
 
-     if (done_once == 0) {
-       done_once = 1;
-       return(boot_report);
+     if (!in_cycle) {
+          in_cycle = 1;
+          cycle_time = sched_now();
+          for (sched = schedule; sched != NULL; sched = sched->next)
+               sched->flags &= ~RS_RUN;
+     }
+     for (sched = schedule; sched != NULL; sched = sched->next) {
+          if ((sched->flags & RS_RUN) || !sched_due(sched, cycle_time))
+               continue;
+          if (best == NULL ||
+              sched_deadline(sched) < sched_deadline(best) ||
+              (sched_deadline(sched) == sched_deadline(best) && sched->prio < best->prio))
+               best = sched;
+     }
+     if (best == NULL) {
+          /* End of cycle */
+          in_cycle = 0;
+          return NULL;
+     }
+     best->flags |= RS_RUN;
+     cur_sched = best;
+     sched_prio = best->prio;
+     sched_qos = best->qos;
+     return best->gen;
+}
+
+/*
+ * Report from generator was sent
+ */
+static void sched_sent(report_sched_t *sched, uint32_t time) {
+     sched->flags |= RS_STARTED;
+     sched->last = time;
+     sched->count++;
+}
+
+/*
+ * Generator has reported in the current report. It gets its time of
+ * last report when the report is sent.
+ */
+static void sched_reported(report_sched_t *sched) {
+     report_commit_t *c = report_ctx.commit;
+
+     if (sched == NULL)
+          return;
+     if (c == NULL || c->nsched >= REPORT_COMMIT_MAX_SCHED) {
+          /* Not tracked -- count it as sent */
+          sched_sent(sched, cycle_time);
+          return;
+     }
+     /* Generator may continue from the previous report */
+     if (c->nsched > 0 && c->sched[c->nsched - 1] == sched)
+          return;
+     c->sched[c->nsched++] = sched;
+     c->time = cycle_time;
+}
+
+void report_sched_print(void) {
+     report_sched_t *sched;
+     uint32_t now = sched_now();
+
+     printf("  %-10s %6s %6s %4s %3s %6s %6s %6s\n", "report", "period", "stale", "prio", "qos", "count", "age", "due");
+     for (sched = schedule; sched != NULL; sched = sched->next) {
+          int32_t age = -1, due = 0;
+
+          if (sched->flags & RS_STARTED) {
+               age = now - sched->last;
+               if (sched->period == REPORT_PERIOD_ONCE)
+                    due = -1;
+               else
+                    due = (int32_t) (sched->last + sched->period - now);
+          }
+          printf("  %-10s %6u %6u %4u %3d %6" PRIu32 " %6" PRId32 " %6" PRId32 "\n",
+                 sched->name, sched->period, sched->maxstale, sched->prio, sched->qos,
+                 sched->count, age, due);
      }
+}
 
-     switch (reportno++ % s_max_report) {
-#if defined(MODULE_GNRC_RPL)
-     case s_rpl_report:
-          return(rpl_report);
+void report_init(void) {
+     static report_sched_t boot_sched;
+     report_register(&boot_sched, boot_report, "boot", REPORT_PERIOD_ONCE, 0, 0);
+#if defined(REPORT_GEN_RPL)
+     static report_sched_t rpl_sched;
+     report_register(&rpl_sched, rpl_report, "rpl",
+                     MQTTSN_PUBLISH_INTERVAL, 3*MQTTSN_PUBLISH_INTERVAL, 2);
+     report_set_qos(&rpl_sched, REPORT_QOS_COUNTERS);
 #endif
-#if defined(MODULE_SIM7020)
-     case s_sim7020_report:
-          return(sim7020_report);
+#if defined(REPORT_GEN_SIM7020)
+     static report_sched_t sim7020_sched;
+     report_register(&sim7020_sched, sim7020_report, "sim7020",
+                     MQTTSN_PUBLISH_INTERVAL, 3*MQTTSN_PUBLISH_INTERVAL, 2);
+     report_set_qos(&sim7020_sched, REPORT_QOS_COUNTERS);
 #endif
 #if defined(EPCGW)
-     case s_epcgwstats_report:
-         return epcgwstats_report;
+     static report_sched_t epcgwstats_sched;
+     report_register(&epcgwstats_sched, epcgwstats_report, "epcgwstats",
+                     MQTTSN_PUBLISH_INTERVAL, 3*MQTTSN_PUBLISH_INTERVAL, 2);
+     report_set_qos(&epcgwstats_sched, REPORT_QOS_COUNTERS);
 #endif
 #if defined(MODULE_NETSTATS)
-     case s_if_report:
-         return if_report;
+     static report_sched_t if_sched;
+     report_register(&if_sched, if_report, "if",
+                     MQTTSN_PUBLISH_INTERVAL, 3*MQTTSN_PUBLISH_INTERVAL, 3);
+     report_set_qos(&if_sched, REPORT_QOS_COUNTERS);
 #endif
-#if defined(APP_WATCHDOG)
-     case s_app_watchdog_report:
-         return app_watchdog_report;
-#endif
-     case s_mqttsn_report:
-          return(mqttsn_report);
-     default:
-         printf("Bad report no %d\n", reportno);
-     }
-     return NULL;
 }
 
 #if ENABLE_DEBUG
-static char *reportfunstr(report_gen_t fun) {
-  if (fun == NULL)
-    return "NUL";
-  else if (fun == boot_report)
-    return "boot";
-#if defined(MODULE_GNRC_RPL)
-  else if (fun == rpl_report)
-    return("rpl");
-#endif
-#if defined(MODULE_SIM7020)
-  else if (fun == sim7020_report)
-    return("sim7020");
-#endif
-#if defined(EPCGW)
-  else if (fun == epcgwstats_report)
-    return("epcgwstats");
-#endif
-#if defined(APP_GATEWAY)
-  else if (fun == app_gateway_report)
-    return("app_gateway");
-#endif
-  else if (fun == mqttsn_report)
-    return("mqttsn");
-  else
-    return("???");
+static const char *reportfunstr(report_gen_t fun) {
+     report_sched_t *sched;
+
+     if (fun == NULL)
+          return "NUL";
+     for (sched = schedule; sched != NULL; sched = sched->next)
+          if (sched->gen == fun)
+               return sched->name;
+     return "???";
 }
 #else
-static char *reportfunstr(__attribute__((unused)) report_gen_t fun) {
+static const char *reportfunstr(__attribute__((unused)) report_gen_t fun) {
     return NULL;
 }
 #endif /* ENABLE_DEBUG */
@@ -198,34 +853,90 @@ size_t xreports(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char
      return (nread);
 }
 
-static size_t reports(uint8_t *buf, size_t len, uint8_t *finished, char **topicp, char **basenamep) {
-     char *s = (char *) buf;
-     size_t l = len;
-     size_t nread = 0;
-     static report_gen_t reportfun = NULL;
+static report_gen_t reportfun = NULL;
+
+/*
+ * Let report generator set topic and basename, by calling it with a
+ * null buffer
+ */
+static void report_target(report_gen_t fun, char **topicp, char **basenamep) {
+     report_stats_t stats = report_stats;
+     uint8_t finished;
+
+     (void) fun(NULL, 0, &finished, topicp, basenamep);
+     /* Not a real record */
+     report_stats = stats;
+}
 
+/*
+ * Schedule report generator for next report, and let it set
+ * topic and basename. The topic gives the encoding.
+ */
+static void report_select(char **topicp, char **basenamep) {
      if (reportfun == NULL) {
           reportfun = next_report_gen();
      }
-     /* Call reportfun with null buffer to set basename first */
-     (void) reportfun(NULL, 0, finished, topicp, basenamep);
-     
-     int n = preamble((uint8_t *) s + nread, l - nread, *basenamep); /* Save one for last bracket */
+     if (reportfun == NULL)
+          return;
+     report_target(reportfun, topicp, basenamep);
+     report_ctx.enc = report_topic_enc(*topicp);
+}
+
+/*
+ * Fill buffer with records. When a report generator is done, continue
+ * with the next one, as long as it reports to the same topic and
+ * basename -- topic and basename start from the defaults
+ * deftopic and defbasename.
+ * Records are kept within limit, except the first one.
+ * finished is set at the end of the publish cycle, when all report
+ * generators are done.
+ */
+static size_t reports(uint8_t *buf, size_t len, size_t limit, uint8_t *finished, char **topicp, char **basenamep,
+                      char *deftopic, char *defbasename) {
+     char *s = (char *) buf;
+     size_t l = len;
+     size_t nread = 0, npreamble;
+
+     *finished = 0;
+     int n = preamble((uint8_t *) s + nread, l - nread, *basenamep);
      if (n == 0)
          return (nread);
      else
          nread += n;
+     npreamble = nread;
 
-     do {
-         int n = reportfun((uint8_t *) s + nread, l - nread, finished, topicp, NULL);
-         DEBUG("reportfun '%s', n %d (tot %d) finished %d\n", reportfunstr(reportfun), n, nread, (int) finished);
-         if (n == 0)
+     while (1) {
+         uint8_t done;
+         char *topic = deftopic, *basename = defbasename;
+         size_t room = nread < limit ? limit - nread : 0;
+
+         int n = reportfun((uint8_t *) s + nread, room, &done, topicp, NULL);
+         if (n == 0 && !done && nread == npreamble && room < l - nread)
+             /* Record does not fit within limit -- exceed it, or the record is never sent */
+             n = reportfun((uint8_t *) s + nread, l - nread, &done, topicp, NULL);
+         DEBUG("reportfun '%s', n %d (tot %d) done %d\n", reportfunstr(reportfun), n, nread, (int) done);
+         /* Nothing written is no room, unless there was nothing to report */
+         if (n == 0 && !done)
              return (nread);
-         else
-             nread += n;
-     } while (!finished);
-     reportfun = NULL;
-     return (nread);
+         sched_reported(cur_sched);
+         if (n > 0 && sched_prio < report_ctx.prio)
+             report_ctx.prio = sched_prio;
+         if (n > 0 && sched_qos > report_ctx.qos)
+             report_ctx.qos = sched_qos;
+         nread += n;
+         if (!done)
+             continue;
+         reportfun = next_report_gen();
+         if (reportfun == NULL) {
+             /* End of cycle */
+             *finished = 1;
+             return (nread);
+         }
+         report_target(reportfun, &topic, &basename);
+         if (strcmp(topic, *topicp) != 0 || strcmp(basename, *basenamep) != 0)
+             /* Different topic -- next report */
+             return (nread);
+     }
 }
 
 /*
@@ -235,14 +946,36 @@ static size_t reports(uint8_t *buf, size_t len, uint8_t *finished, char **topicp
 size_t makereport(uint8_t *buffer, size_t len, uint8_t *finished, char **topicp, char **basenamep) {
      char *s = (char *) buffer;
      size_t l = len;
-     size_t n;
+     size_t n, room, limit;
      int nread = 0;
-     
-     RECORD_START(s + nread, l - nread);
-     PUTFMT("[");
-     n = reports((uint8_t *) RECORD_STR(), RECORD_LEN()-1, finished, topicp, basenamep); /* Save one for last bracket */
+     char *deftopic = *topicp, *defbasename = *basenamep;
+
+     report_select(topicp, basenamep);
+     if (reportfun == NULL) {
+          /* Nothing due */
+          *finished = 1;
+          return 0;
+     }
+     report_ctx.sep = 0;
+     report_ctx.ndelta = 0;
+     report_ctx.prio = REPORT_PRIO_NONE;
+     report_ctx.qos = REPORT_QOS_NOCONN;
+     if (report_ctx.commit != NULL)
+          report_commit_clear(report_ctx.commit);
+
+     RECORD_START_NOSIZE(s + nread, l - nread);
+     PUTARRAY();
+     room = RECORD_LEN() - 1; /* Save one for last bracket */
+     limit = room;
+     if (report_ctx.limit > 0 && report_ctx.limit < len)
+          /* Less the brackets */
+          limit = report_ctx.limit > len - room ? report_ctx.limit - (len - room) : 0;
+     n = reports((uint8_t *) RECORD_STR(), room, limit, finished, topicp, basenamep,
+                 deftopic, defbasename);
      RECORD_ADD(n);
-     PUTFMT("]");
+     PUTARRAYEND();
+     if (report_ctx.commit != NULL)
+          report_ctx.commit->ndelta = report_ctx.ndelta;
      RECORD_END(nread);
 
      return (nread);
@@ -258,11 +991,11 @@ size_t xmakereport(uint8_t *buffer, size_t len, uint8_t *finished, char **topics
      size_t n;
      int nread = 0;
      
-     RECORD_START(s + nread, l - nread);
+     RECORD_START_NOSIZE(s + nread, l - nread);
      PUTFMT("[");
      n = preamble((uint8_t *) RECORD_STR(), RECORD_LEN()-1, NULL); /* Save one for last bracket */
      RECORD_ADD(n);
-     n = reports((uint8_t *) RECORD_STR(), RECORD_LEN()-1, finished, topicstrp, NULL); /* Save one for last bracket */
+     n = xreports((uint8_t *) RECORD_STR(), RECORD_LEN()-1, finished, topicstrp, NULL); /* Save one for last bracket */
      RECORD_ADD(n);
      PUTFMT("]");
      RECORD_END(nread);
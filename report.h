@@ -7,6 +7,89 @@
  */
 
 
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Report encodings. SenML JSON is the default. SenML CBOR (RFC 8428)
+ * uses integer labels and binary values, and gives roughly twice as
+ * much data per packet. The encoding is selected per topic, see
+ * report_set_topic_enc().
+ */
+typedef enum {
+    REPORT_ENC_JSON,
+    REPORT_ENC_CBOR,
+} report_enc_t;
+
+/*
+ * Built-in report generators for RPL and SIM7020 statistics. They
+ * follow the RIOT modules, unless set otherwise -- the native
+ * benchmark sets them, with stand-ins for the statistics sources.
+ */
+#if defined(MODULE_GNRC_RPL) && !defined(REPORT_GEN_RPL)
+#define REPORT_GEN_RPL
+#endif
+#if defined(MODULE_SIM7020) && !defined(REPORT_GEN_SIM7020)
+#define REPORT_GEN_SIM7020
+#endif
+
+/*
+ * State of the report being built
+ */
+typedef struct {
+    report_enc_t enc;           /* Encoding of current report */
+    uint8_t sep;                /* JSON: separator needed before next item */
+    uint8_t ndelta;             /* Delta counters in current report */
+    uint8_t prio;               /* Highest priority (lowest value) of generators in report */
+    int8_t qos;                 /* Highest QoS of generators in report */
+    struct report_commit *commit; /* Contents of current report, see report_commit_init() */
+    size_t limit;               /* Preferred max report length, 0 for none -- see makereport() */
+} report_ctx_t;
+
+/* report_ctx.prio when no generator has written to the report */
+#define REPORT_PRIO_NONE 0xff
+
+/*
+ * MQTT-SN QoS for reports. REPORT_QOS_NOCONN is QoS -1 -- publish
+ * without connection to the gateway.
+ */
+#define REPORT_QOS_NOCONN (-1)
+#define REPORT_QOS_0 0
+#define REPORT_QOS_1 1
+
+/* QoS of report generators, unless set with report_set_qos() */
+#ifndef REPORT_QOS_DEFAULT
+#define REPORT_QOS_DEFAULT REPORT_QOS_1
+#endif /* REPORT_QOS_DEFAULT */
+
+/* QoS of the built-in counter reports (RPL, interface and modem statistics) */
+#ifndef REPORT_QOS_COUNTERS
+#define REPORT_QOS_COUNTERS REPORT_QOS_DEFAULT
+#endif /* REPORT_QOS_COUNTERS */
+
+extern report_ctx_t report_ctx;
+
+/*
+ * SenML labels (RFC 8428, Table 4). Negative labels are base fields.
+ */
+#define SENML_BN        (-2)
+#define SENML_BT        (-3)
+#define SENML_N         0
+#define SENML_U         1
+#define SENML_V         2
+#define SENML_VS        3
+#define SENML_T         6
+/* 
+ * Nested records ("vj" in JSON). Not a registered SenML label, 
+ * so it is configurable.
+ */
+#ifndef SENML_VJ
+#define SENML_VJ        22
+#endif /* SENML_VJ */
+
 /*
  * Macros for writing sensor records 
  * A record is a unit of text that must be kept together 
@@ -20,22 +103,62 @@
 //#define WARN printf
 #define WARN(...)
 
+/*
+ * Record sizing. When there may not be room left for a record, it
+ * is first sized: the body is run with no buffer space, which only
+ * counts the bytes needed (the writers work like snprintf). The
+ * record is then written if it fits, else it is left for the next
+ * report without having been formatted. Sizing is used when the
+ * space left is no more than the largest record seen so far.
+ * Define REPORT_SIZING as 0 to turn it off.
+ */
+#ifndef REPORT_SIZING
+#define REPORT_SIZING 1
+#endif /* REPORT_SIZING */
+
+typedef struct {
+    uint32_t records;           /* Records written */
+    uint32_t rollbacks;         /* Records that did not fit */
+    uint32_t discarded;         /* Bytes formatted in records that did not fit */
+    uint32_t sized;             /* Bytes counted in sizing passes */
+    uint32_t changed;           /* Delta counters sent with a new value */
+    size_t maxrec;              /* Largest record written */
+} report_stats_t;
+
+extern report_stats_t report_stats;
+
+int report_sizing(size_t len);
+void report_record_done(size_t n);
+void report_record_full(size_t n);
+
 /*
  * Mark start of a record. 
  * Save current state as starting state (string pointer and length).
  */
-#define RECORD_START(STR, LEN) {                                        \
-   __label__ _full, _notfull;                                           \
+#define RECORD_START(STR, LEN) _RECORD_START(STR, LEN, 1)
+/*
+ * - Record without sizing, for records that contain other records
+ *   (added with RECORD_ADD)
+ */
+#define RECORD_START_NOSIZE(STR, LEN) _RECORD_START(STR, LEN, 0)
+
+#define _RECORD_START(STR, LEN, SIZABLE) {                              \
+   __label__ _full, _notfull, _pass;                                    \
    char *_str = (STR);                                                  \
    size_t _len = (LEN), _nread = 0;                                     \
+   uint8_t _sep = report_ctx.sep;                                       \
+   uint8_t _ndelta = report_ctx.ndelta;                                 \
+   const uint8_t _sizable = (SIZABLE);                                  \
+   uint8_t _sizing = _sizable && report_sizing(_len);                   \
+  _pass:
 
 /*
  * Attempt to write printf-formatted text to a record
  */
 
 #define PUTFMT(...) {                                                   \
-    size_t _n = snprintf(_str + _nread, _len - _nread, __VA_ARGS__);    \
-    if (_n < _len - _nread) {                                           \
+    size_t _n = snprintf(_str + _nread, RECORD_LEN(), __VA_ARGS__);     \
+    if (_sizing || _n < _len - _nread) {                                \
         _nread += _n;                                                   \
     }                                                                   \
     else {                                                              \
@@ -48,14 +171,31 @@
  * starting state.
  * Causes current function to return. The return value is NREAD
  * plus the number of chars successfully written.
+ * After a sizing pass, go back and write the record if it fits.
  */
 #define RECORD_END(NREAD)                                               \
-   goto _notfull;                                                       \
+   if (!_sizing)                                                        \
+       goto _notfull;                                                   \
+   _sizing = 0;                                                         \
+   report_stats.sized += _nread;                                        \
+   report_ctx.sep = _sep;                                               \
+   report_ctx.ndelta = _ndelta;                                         \
+   if (_nread < _len) {                                                 \
+       _nread = 0;                                                      \
+       goto _pass;                                                      \
+   }                                                                    \
+   _nread = 0;                                                          \
   _full:                                                                \
     WARN("%s: %d: no space left\n", __FILE__, __LINE__);                \
-    *(_str) = '\0';                                                     \
+    report_record_full(_nread);                                         \
+    if (_len > 0)                                                       \
+        *(_str) = '\0';                                                 \
+    report_ctx.sep = _sep;                                              \
+    report_ctx.ndelta = _ndelta;                                        \
     return ((NREAD));                                                   \
   _notfull:                                                             \
+  if (_sizable)                                                         \
+      report_record_done(_nread);                                       \
   (NREAD) += _nread;                                                    \
   }
 
@@ -65,12 +205,12 @@
  * - Get current buffer pointer and len
  */
 #define RECORD_STR() (_str + _nread)
-#define RECORD_LEN() (_len - _nread)
+#define RECORD_LEN() (_sizing ? 0 : _len - _nread)
 /*
  * - Advance no of bytes written to buffer by N
  */
 #define RECORD_ADD(N)                                                   \
-  if ((N) < _len - _nread) {                                            \
+  if (_sizing || (N) < _len - _nread) {                                 \
       _nread += (N);                                                    \
    }                                                                    \
    else {                                                               \
@@ -78,6 +218,273 @@
    }                                                                    \
    
 
+/*
+ * Advance no of bytes written to buffer by the result of
+ * expression N, which is evaluated once. N is the number of bytes
+ * needed, and the record is full if they did not fit.
+ */
+#define RECORD_PUT(N) {                                                 \
+    size_t _n = (N);                                                    \
+    if (_sizing || _n < _len - _nread) {                                \
+        _nread += _n;                                                   \
+    }                                                                   \
+    else {                                                              \
+        goto _full;                                                     \
+    }                                                                   \
+  }
+
+/*
+ * Encoding-neutral SenML writers. Each writes one item in the
+ * encoding of the current report, and returns the number of bytes
+ * needed for it. The item is complete only if it fits.
+ * The writers do not use snprintf, to keep formatting cheap on the
+ * report hot path.
+ */
+size_t senml_open(char *buf, size_t len);
+size_t senml_close(char *buf, size_t len);
+size_t senml_array(char *buf, size_t len);
+size_t senml_array_end(char *buf, size_t len);
+size_t senml_key(char *buf, size_t len, int label);
+size_t senml_tkey(char *buf, size_t len, const char *key);
+size_t senml_u32(char *buf, size_t len, uint32_t v);
+size_t senml_i32(char *buf, size_t len, int32_t v);
+size_t senml_sec(char *buf, size_t len, uint32_t sec, uint16_t msec);
+size_t senml_str(char *buf, size_t len, const char *str);
+
+/*
+ * Helpers for building strings for reports without snprintf.
+ * Both null terminate and return the length.
+ *
+ * - Unsigned to decimal
+ */
+size_t report_utoa(char *buf, uint32_t v);
+/*
+ * - Bytes to hex, buf must have room for 2*len+1 chars
+ */
+size_t report_hex(char *buf, const uint8_t *data, size_t len);
+
+/*
+ * Write SenML items to a record. Must appear within a
+ * RECORD_START/RECORD_END pair.
+ *
+ * - Open and close a record (object in JSON, map in CBOR)
+ */
+#define PUTOPEN()       RECORD_PUT(senml_open(RECORD_STR(), RECORD_LEN()))
+#define PUTCLOSE()      RECORD_PUT(senml_close(RECORD_STR(), RECORD_LEN()))
+/*
+ * - Open and close an array
+ */
+#define PUTARRAY()      RECORD_PUT(senml_array(RECORD_STR(), RECORD_LEN()))
+#define PUTARRAYEND()   RECORD_PUT(senml_array_end(RECORD_STR(), RECORD_LEN()))
+/*
+ * - Key as SenML label, or as text for non-SenML objects
+ */
+#define PUTKEY(L)       RECORD_PUT(senml_key(RECORD_STR(), RECORD_LEN(), (L)))
+#define PUTTKEY(K)      RECORD_PUT(senml_tkey(RECORD_STR(), RECORD_LEN(), (K)))
+/*
+ * - Values: unsigned, signed, fixed-point seconds (msec resolution)
+ *   and string
+ */
+#define PUTU32(V)       RECORD_PUT(senml_u32(RECORD_STR(), RECORD_LEN(), (V)))
+#define PUTI32(V)       RECORD_PUT(senml_i32(RECORD_STR(), RECORD_LEN(), (V)))
+#define PUTSEC(S, MS)   RECORD_PUT(senml_sec(RECORD_STR(), RECORD_LEN(), (S), (MS)))
+#define PUTSTR(S)       RECORD_PUT(senml_str(RECORD_STR(), RECORD_LEN(), (S)))
+
+/*
+ * Common SenML elements
+ *
+ * - {"n":NAME
+ */
+#define PUTNAME(NAME) {                                                 \
+    PUTOPEN();                                                          \
+    PUTKEY(SENML_N);                                                    \
+    PUTSTR(NAME);                                                       \
+  }
+/*
+ * - {"n":NAME,"u":UNIT,"v":V}
+ */
+#define PUTMEAS(NAME, UNIT, V) {                                        \
+    PUTNAME(NAME);                                                      \
+    PUTKEY(SENML_U);                                                    \
+    PUTSTR(UNIT);                                                       \
+    PUTKEY(SENML_V);                                                    \
+    PUTU32(V);                                                          \
+    PUTCLOSE();                                                         \
+  }
+#define PUTCOUNT(NAME, V) PUTMEAS(NAME, "count", V)
+/*
+ * - {"n":NAME,"vj":[ ... ]}
+ */
+#define PUTGROUP(NAME) {                                                \
+    PUTNAME(NAME);                                                      \
+    PUTKEY(SENML_VJ);                                                   \
+    PUTARRAY();                                                         \
+  }
+#define PUTGROUPEND() {                                                 \
+    PUTARRAYEND();                                                      \
+    PUTCLOSE();                                                         \
+  }
+
+/*
+ * Delta reporting. Define REPORT_DELTA to report a counter only if
+ * it has changed since the value last delivered with a PUBACK.
+ * A full snapshot is sent every REPORT_DELTA_FULL_CYCLES publish
+ * cycles, and after the connection has been lost.
+ *
+ * Each counter has a delta slot that holds the value last delivered.
+ * The values written to a payload are kept with the payload, in a
+ * report_commit_t, until it is delivered.
+ */
+typedef struct {
+    uint32_t acked;
+} report_delta_t;
+
+#ifndef REPORT_DELTA_FULL_CYCLES
+#define REPORT_DELTA_FULL_CYCLES 6
+#endif /* REPORT_DELTA_FULL_CYCLES */
+
+/* Max no of delta counters tracked in one report */
+#ifndef REPORT_DELTA_MAX_COUNTERS
+#ifdef REPORT_DELTA
+#define REPORT_DELTA_MAX_COUNTERS 48
+#else
+/* Only progress markers, such as the event trace's */
+#define REPORT_DELTA_MAX_COUNTERS 4
+#endif /* REPORT_DELTA */
+#endif /* REPORT_DELTA_MAX_COUNTERS */
+
+/*
+ * Start of publish cycle -- decide if it should be a full snapshot
+ */
+void report_delta_cycle(void);
+/*
+ * Make next publish cycle a full snapshot
+ */
+void report_delta_snapshot(void);
+
+/* Max no of report generators tracked in one report */
+#ifndef REPORT_COMMIT_MAX_SCHED
+#define REPORT_COMMIT_MAX_SCHED 8
+#endif /* REPORT_COMMIT_MAX_SCHED */
+
+/*
+ * Contents of a payload: delta counters, with the values written,
+ * and the report generators that wrote to it. The values become the
+ * new baseline when the payload is delivered -- PUBACK, or kept in
+ * the store-and-forward queue. A payload that is lost leaves the
+ * baseline as it was, and the counters are sent again. Generators
+ * get their time of last report when the payload is sent.
+ */
+typedef struct report_commit {
+    uint8_t ndelta;
+    uint8_t nsched;
+    uint32_t time;              /* Publish cycle of the reports (sec) */
+    struct report_sched *sched[REPORT_COMMIT_MAX_SCHED];
+    struct {
+        report_delta_t *slot;
+        uint32_t v;
+    } delta[REPORT_DELTA_MAX_COUNTERS];
+} report_commit_t;
+
+/*
+ * Record contents of payloads built with makereport() in c, or
+ * nowhere if NULL
+ */
+void report_commit_init(report_commit_t *c);
+/*
+ * Payload was delivered. acked is 0 for QoS 0 and -1, with no
+ * PUBACK -- the delta baseline stays, but the generators count
+ * as reported.
+ */
+void report_commit(report_commit_t *c, int acked);
+/*
+ * Payload was lost
+ */
+void report_commit_clear(report_commit_t *c);
+/*
+ * Add contents of c to dst, for payloads that are acknowledged
+ * together. Counters that do not fit are left out, and sent again.
+ */
+void report_commit_add(report_commit_t *dst, const report_commit_t *c);
+/*
+ * Counter written to current report. If too many to keep track of,
+ * it is not committed, and is sent again. Also without REPORT_DELTA,
+ * for generators that keep track of what has been delivered.
+ * A NULL slot (REPORT_DELTA_SLOT() without REPORT_DELTA) is ignored.
+ */
+void report_delta_add(report_delta_t *slot, uint32_t v);
+
+#ifdef REPORT_DELTA
+/*
+ * Declare delta slots for N counters
+ */
+#define REPORT_DELTA_SLOTS(NAME, N) static report_delta_t NAME[N]
+/*
+ * Slots as argument, and slot I of them
+ */
+#define REPORT_DELTA_ARG(NAME) (NAME)
+#define REPORT_DELTA_SLOT(NAME, I) (&(NAME)[I])
+
+int report_delta_full(void);
+int report_delta_changed(report_delta_t *slot, uint32_t v);
+
+/*
+ * Record group with delta counters -- the group is written only if
+ * at least one counter in it has changed. At most one group per
+ * record.
+ */
+#define PUTDGROUP(NAME)                                                 \
+    const char *_dgroup = (NAME);                                       \
+    uint8_t _dgroup_open = 0;
+#define PUTDGROUPEND() {                                                \
+    if (_dgroup_open) {                                                 \
+        PUTGROUPEND();                                                  \
+    }                                                                   \
+  }
+/*
+ * - Delta counter in group
+ */
+#define PUTDGMEAS(NAME, UNIT, V, SLOT) {                                \
+    uint32_t _v = (V);                                                  \
+    if (report_delta_changed((SLOT), _v)) {                             \
+        if (!_dgroup_open) {                                            \
+            PUTGROUP(_dgroup);                                          \
+            _dgroup_open = 1;                                           \
+        }                                                               \
+        PUTMEAS(NAME, UNIT, _v);                                        \
+        report_delta_add((SLOT), _v);                                   \
+    }                                                                   \
+  }
+/*
+ * - Delta counter on its own
+ */
+#define PUTDMEAS(NAME, UNIT, V, SLOT) {                                 \
+    uint32_t _v = (V);                                                  \
+    if (report_delta_changed((SLOT), _v)) {                             \
+        PUTMEAS(NAME, UNIT, _v);                                        \
+        report_delta_add((SLOT), _v);                                   \
+    }                                                                   \
+  }
+#else
+#define REPORT_DELTA_SLOTS(NAME, N)
+#define REPORT_DELTA_ARG(NAME) NULL
+#define REPORT_DELTA_SLOT(NAME, I) NULL
+
+static inline int report_delta_full(void) {
+    return 1;
+}
+static inline int report_delta_changed(report_delta_t *slot, uint32_t v) {
+    (void) slot; (void) v;
+    return 1;
+}
+#define PUTDGROUP(NAME) PUTGROUP(NAME)
+#define PUTDGROUPEND() PUTGROUPEND()
+#define PUTDGMEAS(NAME, UNIT, V, SLOT) PUTMEAS(NAME, UNIT, V)
+#define PUTDMEAS(NAME, UNIT, V, SLOT) PUTMEAS(NAME, UNIT, V)
+#endif /* REPORT_DELTA */
+#define PUTDGCOUNT(NAME, V, SLOT) PUTDGMEAS(NAME, "count", V, SLOT)
+#define PUTDCOUNT(NAME, V, SLOT) PUTDMEAS(NAME, "count", V, SLOT)
+
 /*
  * Report generator.
  * Write a report into buffer buf of size len.
@@ -90,5 +497,93 @@
  */
 typedef int (* report_gen_t)(uint8_t *buf, size_t len, uint8_t *finished, char **topicsp, char **basenamep);
 
+/*
+ * Build report of at most len bytes. If report_ctx.limit is set, the
+ * report is kept within it, except that the first record is written
+ * even if it only fits in len -- else it would never be sent.
+ */
 size_t makereport(uint8_t *buffer, size_t len, uint8_t *finished, char **topicp, char **basenamep);
 
+/*
+ * Report state -- report_ctx, report_stats, the schedule and the
+ * delta baselines -- is shared by the thread that builds payloads
+ * and the thread that publishes and commits them. Hold the lock
+ * while building a payload with makereport(). The other functions
+ * here take it themselves.
+ */
+void report_lock(void);
+void report_unlock(void);
+
+/*
+ * Report scheduler. Report generators are registered with a period,
+ * a max staleness and a priority. In each publish cycle, generators
+ * that are due (period has passed since last report, or max
+ * staleness if non-zero) are called in deadline order, where the
+ * deadline is the time of the last report plus max staleness.
+ * Generators with the same deadline are called in priority order
+ * (lower value first). The time of last report is set when the
+ * payload is sent (see report_commit()), so a generator whose report
+ * was lost is due again in the next cycle. A generator that has
+ * never been reported is due at once.
+ */
+typedef struct report_sched {
+    struct report_sched *next;
+    report_gen_t gen;
+    const char *name;
+    uint16_t period;            /* Seconds between reports, 0 for once */
+    uint16_t maxstale;          /* Max seconds between reports */
+    uint8_t prio;               /* Priority, lower value first */
+    int8_t qos;                 /* QoS for reports */
+    uint8_t flags;
+    uint32_t last;              /* Time of last report sent (sec) */
+    uint32_t count;             /* No of reports sent */
+} report_sched_t;
+
+/* Report only once, at start */
+#define REPORT_PERIOD_ONCE 0
+
+/* Allow generator to be called this much early (sec) */
+#ifndef REPORT_SCHED_SLACK
+#define REPORT_SCHED_SLACK 1
+#endif /* REPORT_SCHED_SLACK */
+
+/*
+ * Register report generator. sched is owned by the caller, and
+ * must not be freed.
+ */
+void report_register(report_sched_t *sched, report_gen_t gen, const char *name,
+                     uint16_t period, uint16_t maxstale, uint8_t prio);
+/*
+ * Set QoS for reports from generator. A payload with records from
+ * several generators is published with the highest QoS among them.
+ */
+void report_set_qos(report_sched_t *sched, int8_t qos);
+/*
+ * Make generator due at once, as if it had never been called, also
+ * with REPORT_PERIOD_ONCE
+ */
+void report_sched_trigger(report_sched_t *sched);
+/*
+ * Register the built-in report generators
+ */
+void report_init(void);
+/*
+ * Print schedule
+ */
+void report_sched_print(void);
+
+/*
+ * Set encoding for reports published on topic. The topic string
+ * is not copied. Topics without an encoding use JSON.
+ */
+int report_set_topic_enc(const char *topic, report_enc_t enc);
+report_enc_t report_topic_enc(const char *topic);
+
+#ifdef REPORT_BENCH
+/*
+ * Shell command to compare SenML writers with PUTFMT
+ */
+int report_bench_cmd(int argc, char **argv);
+#endif /* REPORT_BENCH */
+
+#endif /* REPORT_H */
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Benchmark report formatting: the typed SenML writers compared
+ * with snprintf-based PUTFMT, for the counter records of a full
+ * publish cycle (RPL, MQTT-SN, SIM7020 and watchdog statistics).
+ * Both produce the same JSON, which is checked.
+ */
+
+#ifdef REPORT_BENCH
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "xtimer.h"
+#include "hashes.h"
+
+#include "report.h"
+
+#ifdef BOARD_AVR_RSS2
+#include "pstr_print.h"
+#endif
+
+#ifndef REPORT_BENCH_ROUNDS
+#define REPORT_BENCH_ROUNDS 20
+#endif /* REPORT_BENCH_ROUNDS */
+
+#define BENCH_BUFSIZE 1200
+
+/*
+ * Record groups in a publish cycle, and the number of counters in each
+ */
+static const struct {
+     const char *name;
+     uint8_t ncounters;
+} groups[] = {
+     { "rpl;stats;dio", 4 },
+     { "rpl;stats;dis", 4 },
+     { "rpl;stats;dao", 4 },
+     { "rpl;stats;dao_ack", 4 },
+     { "mqtt_sn;stats;connect", 2 },
+     { "mqtt_sn;stats;register", 2 },
+     { "mqtt_sn;stats;publish", 2 },
+     { "sim7020;stats;", 9 },
+     { "appwd;stats;", 3 },
+};
+#define NGROUPS (sizeof(groups)/sizeof(groups[0]))
+
+static const char *counter_names[] = {
+     "u_rx", "u_tx", "m_rx", "m_tx", "tx", "tx_failed", "rx", "commfail", "reset"
+};
+
+static uint32_t counter(unsigned g, unsigned c) {
+     /* Spread over small and large values */
+     return ((uint32_t) (g + 1) * 7919UL) << (2*c);
+}
+
+static int cycle_putfmt(char *str, size_t len) {
+     char *s = str;
+     size_t l = len;
+     int nread = 0;
+     unsigned g, c;
+
+     for (g = 0; g < NGROUPS; g++) {
+          RECORD_START(s + nread, l - nread);
+          PUTFMT(",{\"n\":\"%s\",\"vj\":[", groups[g].name);
+          for (c = 0; c < groups[g].ncounters; c++) {
+               PUTFMT("%s{\"n\":\"%s\",\"u\":\"count\",\"v\":%" PRIu32 "}",
+                      c == 0 ? "" : ",", counter_names[c], counter(g, c));
+          }
+          PUTFMT("]}");
+          RECORD_END(nread);
+     }
+     return nread;
+}
+
+static int cycle_emit(char *str, size_t len) {
+     char *s = str;
+     size_t l = len;
+     int nread = 0;
+     unsigned g, c;
+
+     for (g = 0; g < NGROUPS; g++) {
+          RECORD_START(s + nread, l - nread);
+          PUTGROUP(groups[g].name);
+          for (c = 0; c < groups[g].ncounters; c++) {
+               PUTCOUNT(counter_names[c], counter(g, c));
+          }
+          PUTGROUPEND();
+          RECORD_END(nread);
+     }
+     return nread;
+}
+
+static uint32_t time_cycle(int (*fun)(char *, size_t), char *buf, size_t len, int *n) {
+     unsigned i;
+     uint32_t start = xtimer_now_usec();
+
+     for (i = 0; i < REPORT_BENCH_ROUNDS; i++) {
+          report_ctx.sep = 1;
+          *n = fun(buf, len);
+     }
+     return (xtimer_now_usec() - start)/REPORT_BENCH_ROUNDS;
+}
+
+int report_bench_cmd(int argc, char **argv) {
+     (void) argc; (void) argv;
+     static char buf[BENCH_BUFSIZE];
+     int n_putfmt, n_emit;
+     uint32_t hash_putfmt, hash_emit;
+     /* Not while the publisher builds reports */
+     report_lock();
+     /* The records written here are not part of the live report */
+     report_ctx_t ctx = report_ctx;
+     report_stats_t stats = report_stats;
+
+     report_ctx.enc = REPORT_ENC_JSON;
+     report_ctx.commit = NULL;
+     report_ctx.limit = 0;
+     uint32_t us_putfmt = time_cycle(cycle_putfmt, buf, sizeof(buf), &n_putfmt);
+     hash_putfmt = djb2_hash((uint8_t *) buf, n_putfmt);
+     uint32_t us_emit = time_cycle(cycle_emit, buf, sizeof(buf), &n_emit);
+     hash_emit = djb2_hash((uint8_t *) buf, n_emit);
+     report_ctx = ctx;
+     report_stats = stats;
+     report_unlock();
+
+     printf("Publish cycle: %u groups, %d bytes, %u rounds\n", (unsigned) NGROUPS, n_emit, REPORT_BENCH_ROUNDS);
+     printf("  putfmt: %" PRIu32 " usec\n", us_putfmt);
+     printf("  emit:   %" PRIu32 " usec\n", us_emit);
+     if (n_putfmt != n_emit || hash_putfmt != hash_emit) {
+          printf("  output differs\n");
+          return 1;
+     }
+     return 0;
+}
+
+#endif /* REPORT_BENCH */
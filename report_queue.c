@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef REPORT_QUEUE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "timex.h"
+
+#include "mqttsn_publisher.h"
+#include "report_queue.h"
+
+#ifdef REPORT_QUEUE_EEPROM
+#include <avr/eeprom.h>
+#include "eedata.h"
+#endif /* REPORT_QUEUE_EEPROM */
+
+/*
+ * Queued payloads are kept back to back in a byte pool, oldest
+ * first. Each entry is a header, followed by the topic string
+ * (with NUL) and the payload.
+ */
+typedef struct {
+     uint16_t len;              /* Payload length */
+     uint8_t prio;
+     int8_t qos;                /* QoS to publish with */
+     uint8_t topiclen;          /* Topic length, including NUL */
+} rq_hdr_t;
+
+static uint8_t pool[REPORT_QUEUE_SIZE];
+static size_t pool_used;
+static uint16_t pool_count;
+
+report_queue_stats_t report_queue_stats;
+
+static inline size_t entry_size(const rq_hdr_t *hdr) {
+     return sizeof(*hdr) + hdr->topiclen + hdr->len;
+}
+
+static size_t pool_entry(size_t off, rq_hdr_t *hdr) {
+     memcpy(hdr, &pool[off], sizeof(*hdr));
+     return entry_size(hdr);
+}
+
+static void pool_remove(size_t off) {
+     rq_hdr_t hdr;
+     size_t size = pool_entry(off, &hdr);
+
+     memmove(&pool[off], &pool[off + size], pool_used - off - size);
+     pool_used -= size;
+     pool_count--;
+}
+
+/*
+ * Entry to drop when the queue is full, to make room for a payload
+ * with priority prio
+ */
+static size_t pool_victim(uint8_t prio) {
+#ifdef REPORT_QUEUE_DROP_PRIO
+     size_t off, victim = 0;
+     uint8_t found = 0, vprio = 0;
+
+     /* Oldest of the lowest priority, but not higher than prio.
+      * report_queue_put() has made sure there is one.
+      */
+     for (off = 0; off < pool_used; ) {
+          rq_hdr_t hdr;
+          size_t size = pool_entry(off, &hdr);
+
+          if (hdr.prio >= prio && (!found || hdr.prio > vprio)) {
+               found = 1;
+               vprio = hdr.prio;
+               victim = off;
+          }
+          off += size;
+     }
+     return victim;
+#else
+     (void) prio;
+     return 0;
+#endif /* REPORT_QUEUE_DROP_PRIO */
+}
+
+#ifdef REPORT_QUEUE_DROP_PRIO
+/*
+ * Bytes that can be freed for a payload with priority prio
+ */
+static size_t pool_droppable(uint8_t prio) {
+     size_t off, bytes = 0;
+
+     for (off = 0; off < pool_used; ) {
+          rq_hdr_t hdr;
+          size_t size = pool_entry(off, &hdr);
+
+          if (hdr.prio >= prio)
+               bytes += size;
+          off += size;
+     }
+     return bytes;
+}
+#endif /* REPORT_QUEUE_DROP_PRIO */
+
+#ifdef REPORT_QUEUE_EEPROM
+/*
+ * Spilled entries are appended to the EEPROM pool, and consumed
+ * from the head. The pool starts over when it is empty.
+ */
+typedef struct {
+     uint16_t head;
+     uint16_t tail;
+     uint16_t count;
+} rq_ee_state_t;
+
+static EEMEM uint8_t ee_pool[REPORT_QUEUE_EEPROM_SIZE];
+static EEMEM struct {
+     eehash_t ee_hash;
+     rq_ee_state_t ee_state;
+} ee_data;
+
+static rq_ee_state_t ee_state;
+
+/* Oldest EEPROM entry, read back for publishing */
+static uint8_t ee_entry[sizeof(rq_hdr_t) + MQPUB_TOPIC_LENGTH + MQTTSN_BUFFER_SIZE];
+static uint8_t ee_entry_valid;
+
+static void ee_reset(void) {
+     ee_state.head = ee_state.tail = ee_state.count = 0;
+     update_eeprom(&ee_state, &ee_data, sizeof(ee_state));
+}
+
+/*
+ * Move oldest RAM entry to EEPROM. Return 0 if there is no room.
+ */
+static int ee_spill(void) {
+     rq_hdr_t hdr;
+     size_t size;
+
+     if (pool_count == 0)
+          return 0;
+     size = pool_entry(0, &hdr);
+     if (size > sizeof(ee_entry) || ee_state.tail + size > REPORT_QUEUE_EEPROM_SIZE)
+          return 0;
+     eeprom_update_block(pool, &ee_pool[ee_state.tail], size);
+     ee_state.tail += size;
+     ee_state.count++;
+     update_eeprom(&ee_state, &ee_data, sizeof(ee_state));
+     pool_remove(0);
+     report_queue_stats.spilled++;
+     return 1;
+}
+
+static int ee_load(void) {
+     rq_hdr_t hdr;
+
+     if (ee_entry_valid)
+          return 1;
+     eeprom_read_block(&hdr, &ee_pool[ee_state.head], sizeof(hdr));
+     if (entry_size(&hdr) > sizeof(ee_entry) ||
+         ee_state.head + entry_size(&hdr) > ee_state.tail) {
+          printf("report_queue: bad EEPROM entry, dropping %u payloads\n", ee_state.count);
+          report_queue_stats.dropped += ee_state.count;
+          report_queue_stats.depth -= ee_state.count;
+          report_queue_stats.bytes -= ee_state.tail - ee_state.head;
+          ee_reset();
+          return 0;
+     }
+     eeprom_read_block(ee_entry, &ee_pool[ee_state.head], entry_size(&hdr));
+     ee_entry_valid = 1;
+     return 1;
+}
+#endif /* REPORT_QUEUE_EEPROM */
+
+void report_queue_init(void) {
+#ifdef REPORT_QUEUE_EEPROM
+     rq_ee_state_t st;
+
+     if (read_eeprom(&st, &ee_data, sizeof(st)) &&
+         st.head <= st.tail && st.tail <= REPORT_QUEUE_EEPROM_SIZE) {
+          ee_state = st;
+          report_queue_stats.depth = report_queue_stats.maxdepth = ee_state.count;
+          report_queue_stats.bytes = ee_state.tail - ee_state.head;
+          if (ee_state.count > 0)
+               printf("report_queue: %u payloads in EEPROM\n", ee_state.count);
+     }
+     else
+          ee_reset();
+#endif /* REPORT_QUEUE_EEPROM */
+}
+
+int report_queue_put(const char *topic, const uint8_t *data, size_t len, uint8_t prio, int8_t qos) {
+     rq_hdr_t hdr;
+     size_t size;
+     int dropped = 0;
+
+     hdr.len = len;
+     hdr.prio = prio;
+     hdr.qos = qos;
+     hdr.topiclen = strlen(topic) + 1;
+     size = entry_size(&hdr);
+     if (size > sizeof(pool) || hdr.topiclen > MQPUB_TOPIC_LENGTH) {
+          report_queue_stats.dropped++;
+          return -1;
+     }
+     while (pool_used + size > sizeof(pool)) {
+          rq_hdr_t victim;
+          size_t off;
+
+#ifdef REPORT_QUEUE_EEPROM
+          if (ee_spill())
+               continue;
+#endif /* REPORT_QUEUE_EEPROM */
+#ifdef REPORT_QUEUE_DROP_PRIO
+          if (pool_used - pool_droppable(prio) + size > sizeof(pool)) {
+               /* Would take payloads of higher priority -- drop this one instead */
+               report_queue_stats.dropped++;
+               return -1;
+          }
+#endif /* REPORT_QUEUE_DROP_PRIO */
+          off = pool_victim(prio);
+          report_queue_stats.bytes -= pool_entry(off, &victim);
+          report_queue_stats.depth--;
+          report_queue_stats.dropped++;
+          pool_remove(off);
+          dropped++;
+     }
+     memcpy(&pool[pool_used], &hdr, sizeof(hdr));
+     memcpy(&pool[pool_used + sizeof(hdr)], topic, hdr.topiclen);
+     memcpy(&pool[pool_used + sizeof(hdr) + hdr.topiclen], data, len);
+     pool_used += size;
+     pool_count++;
+
+     report_queue_stats.queued++;
+     report_queue_stats.bytes += size;
+     if (++report_queue_stats.depth > report_queue_stats.maxdepth)
+          report_queue_stats.maxdepth = report_queue_stats.depth;
+     return dropped;
+}
+
+int report_queue_peek(const char **topicp, const uint8_t **datap, size_t *lenp,
+                      uint8_t *priop, int8_t *qosp) {
+     const uint8_t *entry;
+     rq_hdr_t hdr;
+
+#ifdef REPORT_QUEUE_EEPROM
+     /* Spilled entries are older than those in RAM */
+     if (ee_state.count > 0 && ee_load())
+          entry = ee_entry;
+     else
+#endif /* REPORT_QUEUE_EEPROM */
+     if (pool_count > 0)
+          entry = pool;
+     else
+          return 0;
+     memcpy(&hdr, entry, sizeof(hdr));
+     *topicp = (const char *) &entry[sizeof(hdr)];
+     *datap = &entry[sizeof(hdr) + hdr.topiclen];
+     *lenp = hdr.len;
+     *priop = hdr.prio;
+     *qosp = hdr.qos;
+     return 1;
+}
+
+void report_queue_pop(void) {
+     rq_hdr_t hdr;
+     size_t size;
+
+#ifdef REPORT_QUEUE_EEPROM
+     if (ee_state.count > 0 && ee_load()) {
+          memcpy(&hdr, ee_entry, sizeof(hdr));
+          size = entry_size(&hdr);
+          ee_state.head += size;
+          /* Saved only when the pool starts over, or at the next
+           * spill. After a reboot, payloads popped since then are
+           * published again.
+           */
+          if (--ee_state.count == 0) {
+               ee_state.head = ee_state.tail = 0;
+               update_eeprom(&ee_state, &ee_data, sizeof(ee_state));
+          }
+          ee_entry_valid = 0;
+     }
+     else
+#endif /* REPORT_QUEUE_EEPROM */
+     if (pool_count > 0) {
+          size = pool_entry(0, &hdr);
+          pool_remove(0);
+     }
+     else
+          return;
+     report_queue_stats.bytes -= size;
+     report_queue_stats.depth--;
+}
+
+void report_queue_drained(unsigned n, uint32_t usec) {
+     report_queue_stats.drained += n;
+     if (usec > 0)
+          report_queue_stats.drain_rate = (uint64_t) n * SEC_PER_MIN * US_PER_SEC / usec;
+}
+
+#endif /* REPORT_QUEUE */
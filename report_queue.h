@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Store-and-forward queue. Payloads that could not be published,
+ * because the gateway is unreachable, are kept in a bounded queue
+ * in RAM, and published in order after reconnect. Each payload
+ * carries its own SenML base time, so it is reported with the
+ * time it was generated.
+ *
+ * When the queue is full, the oldest payload is dropped, or, with
+ * REPORT_QUEUE_DROP_PRIO, the oldest payload of the lowest priority.
+ * With REPORT_QUEUE_EEPROM, payloads are first spilled from RAM to
+ * EEPROM, where they also survive a reboot.
+ *
+ * Enabled with REPORT_QUEUE.
+ */
+
+#ifndef REPORT_QUEUE_H
+#define REPORT_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Bytes of RAM for queued payloads, including topics and headers */
+#ifndef REPORT_QUEUE_SIZE
+#define REPORT_QUEUE_SIZE 1024
+#endif /* REPORT_QUEUE_SIZE */
+
+/* Bytes of EEPROM for spilled payloads */
+#ifndef REPORT_QUEUE_EEPROM_SIZE
+#define REPORT_QUEUE_EEPROM_SIZE 2048
+#endif /* REPORT_QUEUE_EEPROM_SIZE */
+
+/* Max payloads to drain in one publish cycle */
+#ifndef REPORT_QUEUE_BATCH
+#define REPORT_QUEUE_BATCH 8
+#endif /* REPORT_QUEUE_BATCH */
+
+typedef struct {
+     uint16_t depth;            /* Payloads in queue, RAM and EEPROM */
+     uint16_t maxdepth;         /* Max payloads in queue */
+     uint32_t bytes;            /* Bytes of queued payloads */
+     uint32_t queued;           /* Payloads put in queue */
+     uint32_t dropped;          /* Payloads dropped because queue was full */
+     uint32_t spilled;          /* Payloads moved to EEPROM */
+     uint32_t drained;          /* Payloads published from queue */
+     uint32_t drain_rate;       /* Payloads per minute in last drain */
+} report_queue_stats_t;
+
+extern report_queue_stats_t report_queue_stats;
+
+/*
+ * Recover payloads spilled to EEPROM before reboot
+ */
+void report_queue_init(void);
+/*
+ * Put payload for topic in queue. prio is the priority of the
+ * payload, lower value first, and qos the QoS to publish it with.
+ * Return the number of payloads dropped to make room, or -1 if the
+ * payload was not queued -- it can never fit, or, with
+ * REPORT_QUEUE_DROP_PRIO, only by dropping payloads of higher priority.
+ */
+int report_queue_put(const char *topic, const uint8_t *data, size_t len, uint8_t prio, int8_t qos);
+/*
+ * Get the oldest payload in queue, with its priority and QoS,
+ * without removing it. Return 0 if the queue is empty.
+ */
+int report_queue_peek(const char **topicp, const uint8_t **datap, size_t *lenp,
+                      uint8_t *priop, int8_t *qosp);
+/*
+ * Remove the oldest payload, after it has been published
+ */
+void report_queue_pop(void);
+/*
+ * Account for a drain of n payloads that took usec microseconds
+ */
+void report_queue_drained(unsigned n, uint32_t usec);
+
+static inline unsigned report_queue_depth(void) {
+     return report_queue_stats.depth;
+}
+
+#endif /* REPORT_QUEUE_H */
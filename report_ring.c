@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MQPUB_PIPELINE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "irq.h"
+#include "mbox.h"
+#include "msg.h"
+#include "thread.h"
+
+#include "report.h"
+#include "report_ring.h"
+#ifdef MQPUB_PMTU
+#include "mqpub_pmtu.h"
+#endif /* MQPUB_PMTU */
+
+#ifdef BOARD_AVR_RSS2
+#include "pstr_print.h"
+#endif
+
+/* Below publisher and emcute, so that network events go first */
+#define REPORT_RING_PRIO (THREAD_PRIORITY_MAIN + 2)
+
+static char ring_stack[THREAD_STACKSIZE_DEFAULT + 384];
+
+static report_slot_t slots[REPORT_RING_SLOTS];
+
+/*
+ * Slots are passed between the threads by index: free slots to the
+ * generator, and filled slots, in order, to the publisher.
+ */
+static msg_t free_queue[REPORT_RING_SLOTS];
+static mbox_t free_mbox = MBOX_INIT(free_queue, REPORT_RING_SLOTS);
+static msg_t full_queue[REPORT_RING_SLOTS];
+static mbox_t full_mbox = MBOX_INIT(full_queue, REPORT_RING_SLOTS);
+
+#define CYCLE_QUEUE_SIZE 2
+static msg_t cycle_queue[CYCLE_QUEUE_SIZE];
+static mbox_t cycle_mbox = MBOX_INIT(cycle_queue, CYCLE_QUEUE_SIZE);
+
+static char *default_topic, *default_basename;
+
+report_ring_stats_t report_ring_stats;
+
+/*
+ * Get slot index from mailbox, and count if we had to wait
+ */
+static uint8_t slot_get(mbox_t *mbox, uint32_t *waits) {
+     msg_t msg;
+
+     if (!mbox_try_get(mbox, &msg)) {
+          (*waits)++;
+          mbox_get(mbox, &msg);
+     }
+     return (uint8_t) msg.content.value;
+}
+
+static void slot_put(mbox_t *mbox, uint8_t i) {
+     msg_t msg = { .content.value = i };
+     mbox_put(mbox, &msg);
+}
+
+static void *ring_thread(void *arg) {
+     (void) arg;
+
+     while (1) {
+          msg_t msg;
+          uint8_t finished;
+
+          mbox_get(&cycle_mbox, &msg);
+          report_delta_cycle();
+          do {
+               uint8_t i = slot_get(&free_mbox, &report_ring_stats.full_waits);
+               report_slot_t *slot = &slots[i];
+               char *topic = default_topic;
+               char *basename = default_basename;
+
+               /* The publisher commits slots while we build the next one */
+               report_lock();
+               report_commit_init(&slot->commit);
+#ifdef MQPUB_PMTU
+               report_ctx.limit = mqpub_pmtu_limit();
+#endif /* MQPUB_PMTU */
+               slot->len = makereport(slot->buf, sizeof(slot->buf), &finished, &topic, &basename);
+               slot->topic = topic;
+               slot->enc = report_ctx.enc;
+               slot->prio = report_ctx.prio;
+               slot->qos = report_ctx.qos;
+               slot->last = finished;
+               report_unlock();
+
+               unsigned state = irq_disable();
+               if (++report_ring_stats.used > report_ring_stats.maxused)
+                    report_ring_stats.maxused = report_ring_stats.used;
+               irq_restore(state);
+               slot_put(&full_mbox, i);
+          } while (!finished);
+     }
+     return NULL;
+}
+
+void report_ring_init(char *deftopic, char *defbasename) {
+     uint8_t i;
+
+     default_topic = deftopic;
+     default_basename = defbasename;
+     for (i = 0; i < REPORT_RING_SLOTS; i++)
+          slot_put(&free_mbox, i);
+     thread_create(ring_stack, sizeof(ring_stack), REPORT_RING_PRIO, THREAD_CREATE_STACKTEST,
+                   ring_thread, NULL, "mqgen");
+}
+
+void report_ring_cycle(void) {
+     msg_t msg = { .type = 0 };
+     mbox_try_put(&cycle_mbox, &msg);
+}
+
+report_slot_t *report_ring_get(void) {
+     return &slots[slot_get(&full_mbox, &report_ring_stats.empty_waits)];
+}
+
+void report_ring_release(report_slot_t *slot) {
+     unsigned state = irq_disable();
+     report_ring_stats.used--;
+     irq_restore(state);
+     slot_put(&free_mbox, (uint8_t) (slot - slots));
+}
+
+size_t report_ring_bytes(void) {
+     return sizeof(slots);
+}
+
+#endif /* MQPUB_PIPELINE */
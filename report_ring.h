@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Report pipeline. A generator thread builds the reports of a
+ * publish cycle into a ring of payload slots, while the publisher
+ * thread publishes filled slots. Formatting of the next report then
+ * overlaps with waiting for PUBACK for the previous one.
+ *
+ * Enabled with MQPUB_PIPELINE (requires MQTTSN_PUBLISHER_THREAD).
+ */
+
+#ifndef REPORT_RING_H
+#define REPORT_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mqttsn_publisher.h"
+#include "report.h"
+
+/* No of payload slots, a power of 2 (mbox queue size) */
+#ifndef REPORT_RING_SLOTS
+#define REPORT_RING_SLOTS 2
+#endif /* REPORT_RING_SLOTS */
+
+#if (REPORT_RING_SLOTS & (REPORT_RING_SLOTS - 1)) != 0
+#error "REPORT_RING_SLOTS must be a power of 2"
+#endif
+
+/*
+ * Payload slot. Also used by the publisher, for a single payload,
+ * when the pipeline is not enabled.
+ */
+typedef struct {
+     uint8_t buf[MQTTSN_BUFFER_SIZE];
+     size_t len;                /* Payload length, 0 if nothing to publish */
+     char *topic;
+     report_enc_t enc;
+     uint8_t prio;              /* Priority of payload, see report_ctx */
+     int8_t qos;                /* QoS of payload, see report_ctx */
+     uint8_t last;              /* Last payload in publish cycle */
+     report_commit_t commit;    /* Committed when payload is delivered */
+} report_slot_t;
+
+typedef struct {
+     uint8_t used;              /* Filled slots */
+     uint8_t maxused;           /* Max filled slots */
+     uint32_t full_waits;       /* Generator waited for a free slot */
+     uint32_t empty_waits;      /* Publisher waited for a filled slot */
+} report_ring_stats_t;
+
+extern report_ring_stats_t report_ring_stats;
+
+/*
+ * Start generator thread. Reports use the default topic and basename,
+ * unless the report generator sets them.
+ */
+void report_ring_init(char *deftopic, char *defbasename);
+/*
+ * Start building reports for a publish cycle
+ */
+void report_ring_cycle(void);
+/*
+ * Get next filled slot, waiting for it if needed
+ */
+report_slot_t *report_ring_get(void);
+/*
+ * Slot has been published -- return it to generator
+ */
+void report_ring_release(report_slot_t *slot);
+/*
+ * Size of payload slots
+ */
+size_t report_ring_bytes(void);
+
+#endif /* REPORT_RING_H */
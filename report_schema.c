@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Generic report generator for schema tables
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "report.h"
+#include "report_schema.h"
+
+#ifdef BOARD_AVR_RSS2
+#include "pstr_print.h"
+#endif
+
+static const char *units[] = {
+     [REPORT_UNIT_COUNT] = "count",
+     [REPORT_UNIT_BYTE] = "byte",
+     [REPORT_UNIT_MSEC] = "msec",
+     [REPORT_UNIT_PERMIN] = "1/min",
+};
+
+/*
+ * Get schema entry, and its name, into RAM
+ */
+static void entry(const report_schema_t *e, report_schema_t *ent, char *name) {
+#ifdef __AVR__
+     memcpy_P(ent, e, sizeof(*ent));
+     strlcpy_P(name, ent->name, REPORT_SCHEMA_NAMELEN);
+#else
+     *ent = *e;
+     strlcpy(name, ent->name, REPORT_SCHEMA_NAMELEN);
+#endif /* __AVR__ */
+}
+
+static uint32_t value(const void *src, const report_schema_t *ent) {
+     const uint8_t *p = (const uint8_t *) src + ent->offset;
+
+     switch (ent->size) {
+     case 1:
+          return *p;
+     case 2:
+     {
+          uint16_t v;
+          memcpy(&v, p, sizeof(v));
+          return v;
+     }
+     default:
+     {
+          uint32_t v;
+          memcpy(&v, p, sizeof(v));
+          return v;
+     }
+     }
+}
+
+/*
+ * One record per group
+ */
+int report_schema_gen(const report_schema_t *schema, uint8_t n, const void *src,
+                      report_delta_t *delta, uint8_t *state,
+                      char *str, size_t len, uint8_t *finished) {
+     char *s = str;
+     size_t l = len;
+     int nread = 0;
+     uint8_t i = *state;
+
+     (void) delta;
+     *finished = 0;
+     while (i < n) {
+          report_schema_t grp, ent;
+          char gname[REPORT_SCHEMA_NAMELEN], name[REPORT_SCHEMA_NAMELEN];
+          uint8_t j;
+
+          *state = i;
+          entry(&schema[i], &grp, gname);
+          RECORD_START(s + nread, l - nread);
+          /* Record may be run twice (sizing), so no state in here */
+          uint8_t open = 0;
+          for (j = i + 1; j < n; j++) {
+               uint32_t v;
+
+               entry(&schema[j], &ent, name);
+               if (ent.size == 0)
+                    break;
+               v = value(src, &ent);
+               if (!report_delta_changed(REPORT_DELTA_SLOT(delta, j), v))
+                    continue;
+               if (!open && gname[0]) {
+                    PUTGROUP(gname);
+               }
+               open = 1;
+               PUTMEAS(name, units[ent.unit], v);
+               report_delta_add(REPORT_DELTA_SLOT(delta, j), v);
+          }
+          if (open && gname[0]) {
+               PUTGROUPEND();
+          }
+          RECORD_END(nread);
+          i = j;
+     }
+     *state = 0;
+     *finished = 1;
+     return nread;
+}
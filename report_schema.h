@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Schema-driven reports. Counter groups are described in
+ * report_schema.def, and turned into constant descriptor tables by
+ * report_schema_gen.h. One generic walker, report_schema_gen(),
+ * writes the records for a table with the SenML writers, so it works
+ * for all encodings.
+ *
+ * On AVR, the tables and names are kept in flash.
+ */
+
+#ifndef REPORT_SCHEMA_H
+#define REPORT_SCHEMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "report.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define REPORT_PROGMEM PROGMEM
+#else
+#define REPORT_PROGMEM
+#endif /* __AVR__ */
+
+/* Longest group or field name */
+#ifndef REPORT_SCHEMA_NAMELEN
+#define REPORT_SCHEMA_NAMELEN 32
+#endif /* REPORT_SCHEMA_NAMELEN */
+
+typedef enum {
+     REPORT_UNIT_COUNT,
+     REPORT_UNIT_BYTE,
+     REPORT_UNIT_MSEC,
+     REPORT_UNIT_PERMIN,
+} report_unit_t;
+
+/*
+ * Schema entry. A group entry (size 0) is followed by the field
+ * entries of the group. A group with an empty name has no group
+ * record -- its fields are written on their own.
+ */
+typedef struct {
+     const char *name;
+     uint16_t offset;           /* Field offset in source struct */
+     uint8_t size;              /* Field size, 0 for group */
+     uint8_t unit;
+} report_schema_t;
+
+#define REPORT_SCHEMA_LEN(SCHEMA) (sizeof(SCHEMA)/sizeof((SCHEMA)[0]))
+
+/*
+ * Write records for schema entries, starting at entry *state, with
+ * field values from struct src. delta has one slot per entry (or is
+ * unused without REPORT_DELTA). Sets *finished when all entries are
+ * written, else *state is where to continue next time.
+ */
+int report_schema_gen(const report_schema_t *schema, uint8_t n, const void *src,
+                      report_delta_t *delta, uint8_t *state,
+                      char *str, size_t len, uint8_t *finished);
+
+#endif /* REPORT_SCHEMA_H */
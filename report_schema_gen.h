@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Generate a schema table from report_schema.def. Include with
+ *
+ *   REPORT_SCHEMA_<SECTION>  section of report_schema.def to use
+ *   REPORT_SCHEMA_SET        table name
+ *   REPORT_SCHEMA_TYPE       source struct for the fields
+ *
+ * defined. Defines the table "static const report_schema_t <set>[]".
+ * No include guard -- may be included once per set.
+ */
+
+#include <stddef.h>
+
+#include "report_schema.h"
+
+#define _RS_NAME3(S, G, F) S ## _ ## G ## _ ## F
+#define _RS_NAME2(S, G, F) _RS_NAME3(S, G, F)
+#define _RS_NAME(G, F) _RS_NAME2(REPORT_SCHEMA_SET, G, F)
+
+/* Names */
+#define REPORT_GROUP(G, NAME)                                           \
+     static const char _RS_NAME(G, group) [] REPORT_PROGMEM = NAME;
+#define REPORT_FIELD(G, NAME, UNIT, MEMBER)                             \
+     static const char _RS_NAME(G, MEMBER) [] REPORT_PROGMEM = NAME;
+
+#include "report_schema.def"
+
+#undef REPORT_GROUP
+#undef REPORT_FIELD
+
+/* Table */
+#define REPORT_GROUP(G, NAME)                                           \
+     { _RS_NAME(G, group), 0, 0, 0 },
+#define REPORT_FIELD(G, NAME, UNIT, MEMBER)                             \
+     { _RS_NAME(G, MEMBER),                                             \
+       offsetof(REPORT_SCHEMA_TYPE, MEMBER),                            \
+       sizeof(((REPORT_SCHEMA_TYPE *) 0)->MEMBER),                      \
+       REPORT_UNIT_ ## UNIT },
+
+static const report_schema_t REPORT_SCHEMA_SET[] REPORT_PROGMEM = {
+#include "report_schema.def"
+};
+
+#undef REPORT_GROUP
+#undef REPORT_FIELD
+#undef _RS_NAME
+#undef _RS_NAME2
+#undef _RS_NAME3
+#undef REPORT_SCHEMA_SET
+#undef REPORT_SCHEMA_TYPE
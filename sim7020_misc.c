@@ -19,6 +19,9 @@
 #include "net/sock/udp.h"
 
 #include "net/sim7020.h"
+#ifdef MODULE_MQTTSN_PUBLISHER
+#include "mqttsn_publisher.h"
+#endif /* MODULE_MQTTSN_PUBLISHER */
 
 int sim7020cmd_init(int argc, char **argv) {
   
@@ -52,8 +55,12 @@ int sim7020cmd_activate(int argc, char **argv) {
   int res = sim7020_activate();
   if (res < 0)
     printf("Error %d\n", res);
-  else
+  else {
     printf("OK");
+#ifdef MODULE_MQTTSN_PUBLISHER
+    mqttsn_publisher_sim7020_active();
+#endif /* MODULE_MQTTSN_PUBLISHER */
+  }
   return res;
 }
   
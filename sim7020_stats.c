@@ -19,82 +19,116 @@
 #include "report.h"
 
 #include "net/sim7020.h"
+#ifdef MQPUB_AIRTIME
+#include "mqpub_airtime.h"
+#endif /* MQPUB_AIRTIME */
 
 #ifdef BOARD_AVR_RSS2
 #include "pstr_print.h"
 #endif
 
+#define REPORT_SCHEMA_SIM7020_STATS
+#define REPORT_SCHEMA_SET sim7020_stats
+#define REPORT_SCHEMA_TYPE sim7020_netstats_t
+#include "report_schema_gen.h"
+
 typedef enum {
-  s_register, s_traffic, s_delay,
+  s_register, s_traffic, s_delay, s_airtime,
 } sim7020_report_state_t;
 
 static int stats(char *str, size_t len, uint8_t *finished) {
     char *s = str;
     size_t l = len;
     static sim7020_report_state_t state = s_register;
-    sim7020_netstats_t *ns;
+    REPORT_DELTA_SLOTS(delta, REPORT_SCHEMA_LEN(sim7020_stats));
     int nread = 0;
   
     *finished = 0;
     
     switch (state) {
     case s_register:
-        RECORD_START(s + nread, l - nread);
-        PUTFMT(",{\"n\":\"sim7020;register;\",\"vj\":[");
-        PUTFMT("{\"n\":\"imsi\",\"vs\":\"");
-        RECORD_ADD((unsigned) sim7020_imsi(RECORD_STR(), RECORD_LEN()));
-        PUTFMT("\"},");
-        PUTFMT("{\"n\":\"imei\",\"vs\":\"");
-        RECORD_ADD((unsigned) sim7020_imei(RECORD_STR(), RECORD_LEN()));
-        PUTFMT("\"}");
-        PUTFMT("]}");
-        RECORD_END(nread);
+        /* Identities do not change -- only in full snapshots */
+        if (report_delta_full()) {
+            char imsi[20], imei[20];
+            int n;
+
+            n = sim7020_imsi(imsi, sizeof(imsi) - 1);
+            imsi[n > 0 ? n : 0] = '\0';
+            n = sim7020_imei(imei, sizeof(imei) - 1);
+            imei[n > 0 ? n : 0] = '\0';
+            RECORD_START(s + nread, l - nread);
+            PUTGROUP("sim7020;register;");
+            PUTNAME("imsi");
+            PUTKEY(SENML_VS);
+            PUTSTR(imsi);
+            PUTCLOSE();
+            PUTNAME("imei");
+            PUTKEY(SENML_VS);
+            PUTSTR(imei);
+            PUTCLOSE();
+            PUTGROUPEND();
+            RECORD_END(nread);
+        }
         state = s_traffic;
-        break;
     case s_traffic:
-        ns = sim7020_get_netstats();
+    {
+        static uint8_t schema_state;
+        uint8_t done;
+        int n;
 
-        RECORD_START(s + nread, l - nread);
-        PUTFMT(",{\"n\":\"sim7020;stats;\",\"vj\":[");
-        PUTFMT("{\"n\":\"tx\",\"u\":\"count\",\"v\":%" PRIu32 "},", ns->tx_success);
-        PUTFMT("{\"n\":\"tx_failed\",\"u\":\"count\",\"v\":%" PRIu32 "},", ns->tx_failed);
-        PUTFMT("{\"n\":\"tx\",\"u\":\"byte\",\"v\":%" PRIu32 "},", ns->tx_bytes);
-        PUTFMT("{\"n\":\"rx\",\"u\":\"count\",\"v\":%" PRIu32 "},", ns->rx_count);
-        PUTFMT("{\"n\":\"rx\",\"u\":\"byte\",\"v\":%" PRIu32 "},", ns->rx_bytes);
-        PUTFMT("{\"n\":\"commfail\",\"u\":\"count\",\"v\":%" PRIu32 "},", ns->commfail_count);
-        PUTFMT("{\"n\":\"reset\",\"u\":\"count\",\"v\":%" PRIu32 "},", ns->reset_count);
-        PUTFMT("{\"n\":\"activation_success\",\"u\":\"count\",\"v\":%" PRIu32 "},", ns->activation_count);
-        PUTFMT("{\"n\":\"activation_fail\",\"u\":\"count\",\"v\":%" PRIu32 "}", ns->activation_fail_count);
-        PUTFMT("]}");
-        RECORD_END(nread);
+        n = report_schema_gen(sim7020_stats, REPORT_SCHEMA_LEN(sim7020_stats), sim7020_get_netstats(),
+                              REPORT_DELTA_ARG(delta), &schema_state, s + nread, l - nread, &done);
+        nread += n;
+        if (!done)
+            return nread;
+    }
         state = s_delay;
     case s_delay:
         RECORD_START(s + nread, l - nread);
-        PUTFMT(",{\"n\":\"sim7020;delay;\",\"vj\":[");
-        int first = 1;
+        PUTGROUP("sim7020;delay;");
         {
             extern uint32_t sim7020_activation_usecs;
             if (sim7020_active()) {
-                if (first)
-                    first = 0;
-                else
-                    PUTFMT(",");
-                PUTFMT("{\"n\":\"activation_time\",\"u\":\"msec\",\"v\":%" PRIu32 "}", sim7020_activation_usecs/1000);
+                PUTMEAS("activation_time", "msec", sim7020_activation_usecs/1000);
             }
         }
         {
             extern uint64_t sim7020_prev_active_duration_usecs;
             if (sim7020_prev_active_duration_usecs != 0) {
-                if (first)
-                    first = 0;
-                else
-                    PUTFMT(",");
-                PUTFMT("{\"n\":\"prev_duration\",\"u\":\"msec\",\"v\":%" PRIu32 "}", (uint32_t) (sim7020_prev_active_duration_usecs/1000));
+                PUTMEAS("prev_duration", "msec", (uint32_t) (sim7020_prev_active_duration_usecs/1000));
             }
         }
-        PUTFMT("]}");
+        PUTGROUPEND();
         RECORD_END(nread);     
+        state = s_airtime;
+    case s_airtime:
+#ifdef MQPUB_AIRTIME
+        if (mqpub_airtime_stats.cycles > 0) {
+            mqpub_airtime_stats_t *st = &mqpub_airtime_stats;
+
+            /* Last publish cycle */
+            RECORD_START(s + nread, l - nread);
+            PUTGROUP("sim7020;airtime;");
+            PUTMEAS("active", "msec", st->active_ms);
+            PUTMEAS("activation", "msec", st->activation_ms);
+            PUTMEAS("tx", "byte", st->tx_bytes);
+            PUTMEAS("rx", "byte", st->rx_bytes);
+            PUTMEAS("sent", "byte", st->sent);
+            PUTMEAS("acked", "byte", st->acked);
+            PUTMEAS("rate", "byte/sec", mqpub_airtime_rate(0));
+            PUTMEAS("overhead", "%", mqpub_airtime_overhead());
+            PUTMEAS("total_rate", "byte/sec", mqpub_airtime_rate(1));
+            PUTGROUPEND();
+            RECORD_END(nread);
+        }
+#endif /* MQPUB_AIRTIME */
+#ifdef REPORT_DELTA
+        /* Identities again in the next full snapshot */
+        state = s_register;
+#else
+        /* Every report is a full snapshot -- identities once per boot */
         state = s_traffic;
+#endif /* REPORT_DELTA */
     }
     *finished = 1;
 